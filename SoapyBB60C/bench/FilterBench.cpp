@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////////////
+// Throughput of the user filter stage, overlap-save against direct form
+//
+// Usage: bb60_filter_bench [samples] [decimation]
+///////////////////////////////////////////////////////////////////////
+
+#include "FastFilter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// Pushes the input in acquisition sized blocks, returns MS/s of input
+static double run(SoapyBB60FastFilter &filter, const std::vector<std::complex<float>> &in,
+        std::vector<std::complex<float>> &out)
+{
+    const size_t block = 8192;
+    filter.reset();
+    out.clear();
+    out.reserve(in.size() / filter.decimation() + block);
+    std::vector<std::complex<float>> chunk(block);
+
+    const Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < in.size(); i += block) {
+        filter.push(in.data() + i, std::min(block, in.size() - i));
+        const size_t len = filter.pop(chunk.data(), chunk.size());
+        out.insert(out.end(), chunk.begin(), chunk.begin() + len);
+    }
+    const double sec = std::chrono::duration<double>(Clock::now() - t0).count();
+    return in.size() / sec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t n = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : (1 << 21);
+    const size_t decimation = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 1;
+
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    std::vector<std::complex<float>> iq(n);
+    for(auto &x : iq) x = std::complex<float>(noise(rng), noise(rng));
+
+    printf("%zu samples, decimation %zu\n\n", n, decimation);
+    printf("%8s %12s %12s %8s %10s\n", "taps", "direct MS/s", "fast MS/s", "FFT", "max error");
+
+    bool ok = true;
+    for(size_t taps = 64; taps <= 16384; taps *= 2) {
+        // Windowed sinc lowpass at the output Nyquist rate, with a complex shift
+        std::vector<std::complex<float>> h(taps);
+        for(size_t k = 0; k < taps; k++) {
+            const double x = (k - (taps - 1) / 2.0) / (2.0 * decimation);
+            const double sinc = (x == 0.0) ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            const double w = 0.54 - 0.46 * std::cos(2 * M_PI * k / (taps - 1));
+            h[k] = std::polar((float)(sinc * w / (2.0 * decimation)), (float)(0.1 * k));
+        }
+
+        // Direct form gets slow for long filters, time it on a shorter input
+        const size_t directLen = std::min(n, std::max<size_t>(n * 256 / taps, 1 << 16));
+        std::vector<std::complex<float>> head(iq.begin(), iq.begin() + directLen);
+
+        SoapyBB60FastFilter direct, fast;
+        direct.design(h, decimation, false);
+        fast.design(h, decimation, true);
+
+        std::vector<std::complex<float>> outDirect, outFast, outHead;
+        const double directMsps = run(direct, head, outDirect);
+        const double fastMsps = run(fast, iq, outFast);
+        run(fast, head, outHead);
+
+        // Same outputs at the same input indices, up to float rounding
+        const size_t common = std::min(outDirect.size(), outHead.size());
+        float err = 0.0f;
+        for(size_t i = 0; i < common; i++) err = std::max(err, std::abs(outDirect[i] - outHead[i]));
+        ok = ok and common > 0 and err < 1e-4f;
+
+        printf("%8zu %12.1f %12.1f %8zu %10.2e%s\n", taps, directMsps, fastMsps, fast.fftSize(), err,
+            SoapyBB60FastFilter::useFast(taps, decimation) ? "  (fast)" : "");
+    }
+
+    printf("\nOverlap-save %s direct form\n", ok ? "matches" : "DOES NOT MATCH");
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
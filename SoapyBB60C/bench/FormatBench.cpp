@@ -0,0 +1,139 @@
+///////////////////////////////////////////////////////////////////////
+// Throughput, compression ratio and accuracy of the stream format kernels
+//
+// Usage: bb60_format_bench [samples] [noise dBFS]
+///////////////////////////////////////////////////////////////////////
+
+#include "Kernels.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double msps(const Clock::time_point &t0, const size_t n, const int reps)
+{
+    const double sec = std::chrono::duration<double>(Clock::now() - t0).count();
+    return (double)n * reps / sec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t n = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : (1 << 20);
+    const double noiseDb = (argc > 2) ? std::atof(argv[2]) : -30.0;
+    const int reps = 20;
+
+    // Noise floor plus a tone, roughly what the BB60C delivers below ref level
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, (float)std::pow(10.0, noiseDb / 20.0) / std::sqrt(2.0f));
+    std::vector<std::complex<float>> iq(n);
+    for(size_t i = 0; i < n; i++) {
+        iq[i] = std::polar(0.25f, 0.01f * i) + std::complex<float>(noise(rng), noise(rng));
+    }
+
+    std::vector<int16_t> cs16(2 * n), check(2 * n);
+    std::vector<uint8_t> cs12(3 * n);
+    std::vector<uint8_t> z(((n + BB60_COMPRESS_FRAME - 1) / BB60_COMPRESS_FRAME) * BB60_COMPRESS_MAX_FRAME);
+
+    printf("%zu samples, noise %.1f dBFS, %d reps\n\n", n, noiseDb, reps);
+    printf("%-20s %12s %10s\n", "kernel", "MS/s", "bytes/S");
+
+    Clock::time_point t0 = Clock::now();
+    for(int r = 0; r < reps; r++) SoapyBB60Kernels::convertSamples(SOAPY_SDR_CS16, iq.data(), cs16.data(), n);
+    printf("%-20s %12.1f %10.2f\n", "CF32 -> CS16", msps(t0, n, reps), 4.0);
+
+    t0 = Clock::now();
+    for(int r = 0; r < reps; r++) SoapyBB60Kernels::convertSamples(SOAPY_SDR_CS12, iq.data(), cs12.data(), n);
+    printf("%-20s %12.1f %10.2f\n", "CF32 -> CS12", msps(t0, n, reps), 3.0);
+
+    t0 = Clock::now();
+    for(int r = 0; r < reps; r++) SoapyBB60Kernels::unpackCS12(cs12.data(), check.data(), n);
+    printf("%-20s %12.1f %10s\n", "CS12 -> CS16", msps(t0, n, reps), "");
+
+    // CS12 holds the same samples as CS16 scaled to 12 bits
+    std::vector<int16_t> cs16at12(2 * n);
+    SoapyBB60Kernels::toInt16(iq.data(), cs16at12.data(), n, 2047.0f);
+    const bool cs12Exact = (check == cs16at12);
+
+    size_t zBytes = 0;
+    t0 = Clock::now();
+    for(int r = 0; r < reps; r++) {
+        zBytes = 0;
+        for(size_t i = 0; i < n; i += BB60_COMPRESS_FRAME) {
+            const size_t len = std::min<size_t>(BB60_COMPRESS_FRAME, n - i);
+            zBytes += SoapyBB60Kernels::compressCS16(cs16.data() + 2 * i, len, z.data() + zBytes);
+        }
+    }
+    printf("%-20s %12.1f %10.2f\n", "CS16 -> CS16Z", msps(t0, n, reps), (double)zBytes / n);
+
+    t0 = Clock::now();
+    for(int r = 0; r < reps; r++) {
+        size_t in = 0, out = 0;
+        while(out < n) {
+            size_t len = 0;
+            in += SoapyBB60Kernels::decompressCS16(z.data() + in, check.data() + 2 * out, len);
+            out += len;
+        }
+    }
+    printf("%-20s %12.1f %10s\n", "CS16Z -> CS16", msps(t0, n, reps), "");
+
+    // Derived formats, one float per sample
+    std::vector<float> derived(n);
+    const char *derivedFormats[] = {BB60_FORMAT_POWER, BB60_FORMAT_DB, BB60_FORMAT_MAG, BB60_FORMAT_PHASE, BB60_FORMAT_FREQ};
+    for(const char *format : derivedFormats) {
+        SoapyBB60Kernels::ConvertState state;
+        state.freqScale = 40e6f / (2.0f * (float)M_PI);
+        t0 = Clock::now();
+        for(int r = 0; r < reps; r++) SoapyBB60Kernels::convertSamples(format, iq.data(), derived.data(), n, &state);
+        printf("%-20s %12.1f %10.2f\n", (std::string("CF32 -> ") + format).c_str(), msps(t0, n, reps), 4.0);
+    }
+
+    // Accuracy of the fast log and atan2, over 120 dB of levels and all angles
+    std::vector<std::complex<float>> sweep(n);
+    for(size_t i = 0; i < n; i++) {
+        sweep[i] = std::polar((float)std::pow(10.0, -6.0 * i / n), 2.0f * (float)M_PI * (float)((i * 0.618034) - std::floor(i * 0.618034)));
+    }
+    double dbError = 0.0, phaseError = 0.0;
+    SoapyBB60Kernels::ConvertState sweepState;
+    SoapyBB60Kernels::convertSamples(BB60_FORMAT_DB, sweep.data(), derived.data(), n, &sweepState);
+    for(size_t i = 0; i < n; i++) {
+        const double re = sweep[i].real(), im = sweep[i].imag();
+        dbError = std::max(dbError, std::fabs(derived[i] - 10.0 * std::log10(re * re + im * im)));
+    }
+    SoapyBB60Kernels::convertSamples(BB60_FORMAT_PHASE, sweep.data(), derived.data(), n, &sweepState);
+    for(size_t i = 0; i < n; i++) {
+        phaseError = std::max(phaseError, std::fabs(derived[i] - std::atan2((double)sweep[i].imag(), (double)sweep[i].real())));
+    }
+
+    // In place correction, on a copy so the input above stays untouched
+    std::vector<std::complex<float>> corrected(iq);
+    std::vector<float> power((n + 63) / 64);
+    SoapyBB60Kernels::IQCorrection corr;
+    corr.dcI = 0.001f;
+    corr.balanceRe = 0.01f;
+    SoapyBB60Kernels::IQStats stats;
+    t0 = Clock::now();
+    for(int r = 0; r < reps; r++) SoapyBB60Kernels::correctIQ(corrected.data(), n, corr, stats, 64, power.data());
+    printf("%-20s %12.1f %10s\n", "DC/IQ correction", msps(t0, n, reps), "");
+
+    // Direct RF, the real parts of the test signal stand in for the ADC samples
+    std::vector<float> real(2 * n);
+    for(size_t i = 0; i < 2 * n; i++) real[i] = ((const float *)iq.data())[i];
+    std::vector<std::complex<float>> baseband(n);
+    SoapyBB60Kernels::QuarterRateDecimator decimator;
+    decimator.design(48);
+    t0 = Clock::now();
+    for(int r = 0; r < reps; r++) decimator.process(real.data(), 2 * n, baseband.data());
+    printf("%-20s %12.1f %10s\n", "direct RF -> CF32/2", msps(t0, n, reps), "");
+
+    const bool lossless = (check == cs16);
+    printf("\nCS12 saves %.1f%%, CS16Z saves %.1f%% of CS16 I/O, CS12 round trip %s, CS16Z round trip %s\n",
+        100.0 * (1.0 - 3.0 / 4.0), 100.0 * (1.0 - (double)zBytes / (4.0 * n)),
+        cs12Exact ? "exact" : "MISMATCH", lossless ? "lossless" : "MISMATCH");
+    printf("%s max error %.1e dB, %s max error %.1e rad\n", BB60_FORMAT_DB, dbError, BB60_FORMAT_PHASE, phaseError);
+
+    return (lossless and cs12Exact) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,194 @@
+#include "SoapyBB60.hpp"
+#include "Kernels.hpp"
+#include "Trace.hpp"
+
+#include <cmath>
+
+/*******************************************************************
+ * Gain mode API
+ ******************************************************************/
+
+bool SoapyBB60::hasGainMode(const int direction, const size_t channel) const
+{
+    return true;
+}
+
+void SoapyBB60::setGainMode(const int direction, const size_t channel, const bool automatic)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+
+    // The AGC steers the reference level, so it needs the reference level mode
+    SoapyBB60Config next = *getConfig();
+    next.agc = automatic;
+    if(automatic) next.refMode = true;
+    updateStream(next);
+}
+
+bool SoapyBB60::getGainMode(const int direction, const size_t channel) const
+{
+    return getConfig()->agc;
+}
+
+/*******************************************************************
+ * AGC settings
+ ******************************************************************/
+
+void SoapyBB60::writeAgcSetting(const std::string &key, const std::string &value)
+{
+    if(key == "agc_headroom" or key == "agc_hysteresis") {
+        double db = -1.0;
+        try {
+            db = std::stod(value);
+        } catch (const std::exception &) {
+        }
+        if(not (db >= 0.0 and db <= 60.0)) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "%s: '%s' is not between 0 and 60 dB", key.c_str(), value.c_str());
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(configMutex);
+        SoapyBB60Config next = *getConfig();
+        if(key == "agc_headroom") {
+            next.agcHeadroom = db;
+        } else {
+            next.agcHysteresis = db;
+        }
+        updateStream(next);
+        return;
+    }
+
+    SoapySDR_logf(SOAPY_SDR_WARNING, "Invalid setting '%s'=='%s'", key.c_str(), value.c_str());
+}
+
+std::string SoapyBB60::readAgcSetting(const std::string &key) const
+{
+    const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+
+    if(key == "agc_headroom") {
+        return std::to_string(c->agcHeadroom);
+    }
+
+    if(key == "agc_hysteresis") {
+        return std::to_string(c->agcHysteresis);
+    }
+
+    SoapySDR_logf(SOAPY_SDR_WARNING, "Unknown setting '%s'", key.c_str());
+
+    return "";
+}
+
+/*******************************************************************
+ * Level measurement on the acquisition thread
+ ******************************************************************/
+
+static float toDb(const double mw)
+{
+    return (mw > 0.0) ? (float)(10.0 * std::log10(mw)) : -200.0f;
+}
+
+void SoapyBB60::measureLevels(SoapyBB60Block *block, const bool adcOverflow)
+{
+    SoapyBB60Levels &lv = levels;
+
+    // Levels from another configuration say nothing about this one
+    if(lv.epoch != block->epoch) {
+        lv = SoapyBB60Levels();
+        lv.epoch = block->epoch;
+    }
+
+    // Samples are sqrt(mW), full scale sits at the reference level when it is in use
+    const float clip = acqConfig.refMode ?
+        (float)std::pow(10.0, (acqConfig.refLevel - BB60_CLIP_MARGIN_DB) / 10.0) : 0.0f;
+
+    float peak = 0.0f;
+    size_t clips = 0;
+    SoapyBB60Kernels::blockLevels(block->data, block->numElems, clip, peak, lv.sum, clips);
+
+    block->clips = clips;
+    block->overload = adcOverflow or clips > 0;
+    if(block->overload) {
+        BB60_TRACE_INSTANT("overload");
+        clipCount += clips;
+        overloadCount++;
+    }
+
+    lv.peak = std::max(lv.peak, peak);
+    lv.samples += block->numElems;
+    lv.overload = lv.overload or block->overload;
+
+    // An overload is acted on at once, everything else once per window
+    const bool windowDone = lv.samples >= BB60_LEVEL_WINDOW * acqConfig.captureRate();
+    if(not windowDone and not block->overload) {
+        return;
+    }
+
+    const float windowPeak = toDb(lv.peak);
+    if(windowDone) {
+        peakDb = windowPeak;
+        rmsDb = toDb(lv.sum / lv.samples);
+    }
+
+    runAgc(windowPeak, block->overload);
+
+    if(windowDone) {
+        lv.samples = 0.0;
+        lv.peak = 0.0f;
+        lv.sum = 0.0;
+        lv.overload = false;
+    }
+}
+
+void SoapyBB60::runAgc(const float peak, const bool overload)
+{
+    SoapyBB60Levels &lv = levels;
+    const SoapyBB60Config &c = acqConfig;
+
+    // Wait for the last change to be applied, until then the levels describe the old one
+    if(not c.agc or not c.refMode or acqGen < lv.agcGen) {
+        return;
+    }
+
+    double target = c.refLevel;
+    if(overload) {
+        // Clipped samples understate the peak, step up by the full headroom
+        target = std::max<double>(c.refLevel, peak) + c.agcHeadroom;
+    } else if(c.refLevel - peak < c.agcHeadroom - c.agcHysteresis) {
+        target = peak + c.agcHeadroom;
+        lv.quietWindows = 0;
+    } else if(c.refLevel - peak > c.agcHeadroom + c.agcHysteresis) {
+        // Lowered only after a sustained quiet spell, down to its loudest window
+        lv.quietPeak = (lv.quietWindows == 0) ? peak : std::max(lv.quietPeak, peak);
+        if(++lv.quietWindows < BB60_AGC_DECAY_WINDOWS) {
+            return;
+        }
+        target = lv.quietPeak + c.agcHeadroom;
+    } else {
+        lv.quietWindows = 0;
+        return;
+    }
+
+    // Whole dB steps keep the reference level from creeping
+    target = std::min<double>(std::max(std::ceil(target), -120.0), BB_MAX_REFERENCE);
+    if(target == c.refLevel) {
+        lv.quietWindows = 0;
+        return;
+    }
+
+    // Never wait on a setter, the next window tries again
+    std::unique_lock<std::mutex> lock(configMutex, std::try_to_lock);
+    if(not lock.owns_lock()) {
+        return;
+    }
+
+    SoapyBB60Config next = *getConfig();
+    if(not next.agc or not next.refMode) {
+        return;
+    }
+    next.refLevel = target;
+    updateStream(next);
+    lv.agcGen = configGen.load(std::memory_order_acquire);
+    lv.quietWindows = 0;
+
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "AGC: reference level %.0f dBm, peak %.1f dBm%s",
+        target, peak, overload ? ", overload" : "");
+}
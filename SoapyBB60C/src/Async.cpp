@@ -0,0 +1,83 @@
+#include "SoapyBB60.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+/*******************************************************************
+ * Async streaming API
+ ******************************************************************/
+
+int SoapyBB60::setStreamCallback(SoapySDR::Stream *stream, const Callback &callback, const size_t maxInFlight)
+{
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    std::lock_guard<std::mutex> lock(streamMutex);
+
+    // Blocks are handed out as-is, like acquireReadBuffer
+    if(callback and (s->format != SOAPY_SDR_CF32 or s->squelch.enabled or s->panorama or s->notifyFd >= 0 or maxInFlight == 0)) {
+        SoapySDR_log(SOAPY_SDR_ERROR, "setStreamCallback: needs a plain CF32 stream without notify_samples and maxInFlight > 0");
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+    if(callback and maxInFlight > numBuffers / 2) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "setStreamCallback: maxInFlight may be at most %zu, half the ring", numBuffers / 2);
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+    if(s->active) {
+        SoapySDR_log(SOAPY_SDR_ERROR, "setStreamCallback: deactivate the stream first");
+        return SOAPY_SDR_STREAM_ERROR;
+    }
+
+    s->callback = callback;
+    s->maxInFlight = maxInFlight;
+
+    return 0;
+}
+
+int SoapyBB60::getStreamFd(SoapySDR::Stream *stream)
+{
+    return ((SoapyBB60Stream *)stream)->notifyFd;
+}
+
+void SoapyBB60::deliverAsync(void)
+{
+    std::lock_guard<std::mutex> lock(asyncMutex);
+
+    for(auto s : asyncStreams) {
+        while(true) {
+            // Backpressure, the rest waits in the ring until blocks come back
+            {
+                std::lock_guard<std::mutex> ringLock(ringMutex);
+                if(s->held.size() >= s->maxInFlight) break;
+            }
+
+            SoapyBB60Block *block = nullptr;
+            SoapyBB60AsyncBlock info;
+            const int ret = waitForBlock(s, block, 0);
+            if(ret == SOAPY_SDR_OVERFLOW) {
+                s->callback((SoapySDR::Stream *)s, ret, info);
+                continue;
+            }
+            if(ret != 0) break;
+
+            {
+                std::lock_guard<std::mutex> ringLock(ringMutex);
+                for(size_t i = 0; i < pool.size(); i++) {
+                    if(pool[i].get() == block) info.handle = i;
+                }
+                s->held.push_back(block);
+            }
+
+            info.data = block->data;
+            info.numElems = block->numElems;
+            info.timeNs = block->timeNs;
+            info.flags = (block->timeNs != 0) ? SOAPY_SDR_HAS_TIME : 0;
+            if(checkEpoch(s, block, 0)) {
+                info.flags |= SOAPY_SDR_USER_FLAG1;
+                if(block->resumed) info.flags |= SOAPY_SDR_END_ABRUPT;
+            }
+            if(block->overload) info.flags |= SOAPY_SDR_USER_FLAG2;
+            info.sampleRate = block->sampleRate;
+            info.frequency = block->frequency;
+            s->callback((SoapySDR::Stream *)s, block->numElems, info);
+        }
+    }
+}
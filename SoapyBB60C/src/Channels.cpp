@@ -0,0 +1,218 @@
+#include "SoapyBB60.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+/*******************************************************************
+ * Channel power setup
+ ******************************************************************/
+
+void SoapyBB60::setupChannels(SoapyBB60Stream *s, const SoapySDR::Kwargs &args)
+{
+    std::unique_ptr<SoapyBB60Channels> c(new SoapyBB60Channels);
+
+    // channels=<offset>:<width>,... in Hz relative to the tuned frequency
+    try {
+        std::stringstream list(args.at("channels"));
+        std::string item;
+        while(std::getline(list, item, ',')) {
+            const size_t colon = item.find(':');
+            if(colon == std::string::npos) throw std::invalid_argument(item);
+            c->offsets.push_back(std::stod(item.substr(0, colon)));
+            c->widths.push_back(std::stod(item.substr(colon + 1)));
+            if(c->widths.back() <= 0.0) throw std::invalid_argument(item);
+        }
+        if(args.count("chan_fft") != 0) c->fftSize = std::stoul(args.at("chan_fft"));
+        if(args.count("chan_interval") != 0) c->interval = std::stod(args.at("chan_interval"));
+        const double thresholdDbm = std::stod(args.count("chan_threshold") ? args.at("chan_threshold") : "-90");
+        c->threshold = std::pow(10.0, thresholdDbm / 10.0);
+    } catch (const std::exception &) {
+        throw std::runtime_error("setupStream: channels must be <offset>:<width>,... and chan_fft, chan_interval and chan_threshold numbers");
+    }
+
+    if(c->offsets.empty() or c->interval <= 0.0) {
+        throw std::runtime_error("setupStream: channels needs at least one channel and a positive chan_interval");
+    }
+    c->fft.plan(c->fftSize);
+
+    // Hann window, scaled so the bins of a channel sum to its power
+    c->window.resize(c->fftSize);
+    double sumSq = 0.0;
+    for(size_t i = 0; i < c->fftSize; i++) {
+        c->window[i] = 0.5f - 0.5f * (float)std::cos(2.0 * M_PI * i / c->fftSize);
+        sumSq += c->window[i] * c->window[i];
+    }
+    c->scale = 1.0 / (c->fftSize * sumSq);
+    c->work.resize(c->fftSize);
+    c->output.assign(2 * c->offsets.size(), 0.0f);
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Channel power: %zu channels, %zu point FFT, %.3f ms records",
+            c->offsets.size(), c->fftSize, c->interval * 1e3);
+
+    s->channels = std::move(c);
+    resetChannels(s);
+}
+
+void SoapyBB60::resetChannels(SoapyBB60Stream *s)
+{
+    SoapyBB60Channels *c = s->channels.get();
+
+    c->planRate = 0.0;
+    c->fill = 0;
+    c->frames = 0;
+    c->powerSum.assign(c->offsets.size(), 0.0);
+    c->busy.assign(c->offsets.size(), 0);
+    c->changed = false;
+    c->outOffset = 0;
+}
+
+void SoapyBB60::planChannels(SoapyBB60Channels *c, const double rate)
+{
+    const double binHz = rate / c->fftSize;
+    const long half = c->fftSize / 2;
+
+    c->firstBin.resize(c->offsets.size());
+    c->lastBin.resize(c->offsets.size());
+    for(size_t i = 0; i < c->offsets.size(); i++) {
+        // Bins centered inside the channel, at least the one nearest its center
+        long first = (long)std::ceil((c->offsets[i] - c->widths[i] / 2) / binHz);
+        long last = (long)std::floor((c->offsets[i] + c->widths[i] / 2) / binHz);
+        if(last < first) first = last = std::lround(c->offsets[i] / binHz);
+
+        if(first < -half or last > half) {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Channel %zu (%.3f kHz) extends outside the %.3f MHz sample rate, measuring the part inside",
+                    i, c->offsets[i] / 1e3, rate / 1e6);
+        }
+        c->firstBin[i] = std::min(std::max(first, -half), half - 1);
+        c->lastBin[i] = std::min(std::max(last, -half), half - 1);
+    }
+
+    c->framesPerRecord = std::max<long long>(std::llround(c->interval * rate / c->fftSize), 1);
+    c->planRate = rate;
+
+    // A record never mixes two sample rates
+    c->fill = 0;
+    c->frames = 0;
+    std::fill(c->powerSum.begin(), c->powerSum.end(), 0.0);
+    std::fill(c->busy.begin(), c->busy.end(), 0);
+}
+
+/*******************************************************************
+ * Measurement
+ ******************************************************************/
+
+void SoapyBB60::measureChannels(SoapyBB60Channels *c)
+{
+    for(size_t i = 0; i < c->fftSize; i++) {
+        c->work[i] *= c->window[i];
+    }
+    c->fft.forward(c->work.data());
+
+    const long n = c->fftSize;
+    for(size_t i = 0; i < c->offsets.size(); i++) {
+        double sum = 0.0;
+        for(long k = c->firstBin[i]; k <= c->lastBin[i]; k++) {
+            sum += std::norm(c->work[(k + n) % n]);
+        }
+        const double power = sum * c->scale;
+        c->powerSum[i] += power;
+        if(power >= c->threshold) c->busy[i]++;
+    }
+
+    c->frames++;
+}
+
+int SoapyBB60::readChannels(
+        SoapyBB60Stream *s,
+        void * const *buffs,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    SoapyBB60Channels *c = s->channels.get();
+
+    flags = 0;
+
+    // Accumulate the next record once the previous one was read out completely
+    if(c->outOffset == 0) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+
+        while(c->planRate == 0.0 or c->frames < c->framesPerRecord) {
+            const long waitUs = std::max<long>(std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now()).count(), 0);
+            const size_t want = (c->planRate == 0.0) ? c->fftSize :
+                (c->framesPerRecord - c->frames) * c->fftSize - c->fill;
+
+            int readFlags = 0;
+            long long readNs = 0;
+            bool restarted = false;
+            int ret = readSamples(s, want, readFlags, readNs, waitUs,
+                [&](const std::complex<float> *in, size_t n) {
+                    const SoapyBB60Block *block = s->block;
+                    size_t offset = s->offset;
+                    // The read starts at a settings change, so does the record
+                    if((readFlags & SOAPY_SDR_USER_FLAG1) != 0 and not restarted) {
+                        restarted = true;
+                        c->changed = true;
+                        planChannels(c, block->sampleRate);
+                    }
+                    if(block->sampleRate != c->planRate) planChannels(c, block->sampleRate);
+
+                    while(n != 0 and c->frames < c->framesPerRecord) {
+                        if(c->fill == 0 and c->frames == 0) {
+                            c->recordNs = (block->timeNs != 0) ?
+                                block->timeNs + (long long)(offset * 1e9 / block->sampleRate) : 0;
+                        }
+                        const size_t len = std::min(n, c->fftSize - c->fill);
+                        std::copy(in, in + len, c->work.begin() + c->fill);
+                        c->fill += len;
+                        in += len;
+                        offset += len;
+                        n -= len;
+                        if(c->fill == c->fftSize) {
+                            measureChannels(c);
+                            c->fill = 0;
+                        }
+                    }
+                });
+
+            // A gap spoils the record, start over after reporting it
+            if(ret == SOAPY_SDR_OVERFLOW or s->overflow) {
+                s->overflow = false;
+                c->planRate = 0.0;
+                return SOAPY_SDR_OVERFLOW;
+            }
+            if(ret < 0) return ret;
+            if(ret == 0 and waitUs == 0) return SOAPY_SDR_TIMEOUT;
+        }
+
+        for(size_t i = 0; i < c->offsets.size(); i++) {
+            c->output[2 * i] = 10.0f * std::log10(c->powerSum[i] / c->frames + 1e-20);
+            c->output[2 * i + 1] = 100.0f * c->busy[i] / c->frames;
+            c->powerSum[i] = 0.0;
+            c->busy[i] = 0;
+        }
+        c->outputNs = c->recordNs;
+        c->frames = 0;
+        flags |= SOAPY_SDR_USER_FLAG0;
+        if(c->changed) flags |= SOAPY_SDR_USER_FLAG1;
+        c->changed = false;
+    }
+
+    const size_t n = std::min(numElems, c->output.size() - c->outOffset);
+    std::memcpy(buffs[0], c->output.data() + c->outOffset, n * sizeof(float));
+    c->outOffset += n;
+    if(c->outputNs != 0) {
+        timeNs = c->outputNs;
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+
+    if(c->outOffset == c->output.size()) {
+        flags |= SOAPY_SDR_END_BURST;
+        c->outOffset = 0;
+    }
+
+    return n;
+}
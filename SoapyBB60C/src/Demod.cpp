@@ -0,0 +1,438 @@
+#include "SoapyBB60.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+// Input frames overlap by 1/BB60_DEMOD_OVERLAP, the channel filters must ring out within it
+#define BB60_DEMOD_OVERLAP 4
+
+// Filter transition width in input FFT bins, wide enough that the response rings out within the overlap
+#define BB60_DEMOD_TRANSITION 16
+
+std::map<std::string, int> demod_modes = {
+    {"AM", BB_DEMOD_AM},
+    {"FM", BB_DEMOD_FM},
+    {"USB", BB_DEMOD_USB},
+    {"LSB", BB_DEMOD_LSB},
+};
+
+/*******************************************************************
+ * Demodulator bank setup
+ ******************************************************************/
+
+void SoapyBB60::setupDemod(SoapyBB60Stream *s, const std::vector<size_t> &channels, const SoapySDR::Kwargs &args)
+{
+    std::unique_ptr<SoapyBB60Demod> d(new SoapyBB60Demod);
+
+    // demod=<frequency>:<mode>[:<bandwidth>],... in Hz
+    try {
+        std::stringstream list(args.at("demod"));
+        std::string item;
+        while(std::getline(list, item, ',')) {
+            std::stringstream fields(item);
+            std::string frequency, mode, bandwidth;
+            std::getline(fields, frequency, ':');
+            std::getline(fields, mode, ':');
+            std::getline(fields, bandwidth, ':');
+
+            SoapyBB60DemodChannel ch;
+            ch.frequency = std::stod(frequency);
+            if(demod_modes.count(mode) == 0) throw std::invalid_argument(mode);
+            ch.mode = demod_modes.at(mode);
+            if(not bandwidth.empty()) {
+                ch.bandwidth = std::stod(bandwidth);
+            } else {
+                ch.bandwidth = (ch.mode == BB_DEMOD_FM) ? 12.5e3 : (ch.mode == BB_DEMOD_AM) ? 10e3 : 3e3;
+            }
+            if(ch.bandwidth <= 0.0) throw std::invalid_argument(bandwidth);
+            d->channels.push_back(ch);
+        }
+        if(args.count("demod_fft") != 0) d->fftSize = std::stoul(args.at("demod_fft"));
+        if(args.count("demod_rate") != 0) d->minRate = std::stod(args.at("demod_rate"));
+        if(args.count("demod_threads") != 0) {
+            d->numThreads = std::stoul(args.at("demod_threads"));
+        } else {
+            // The reading thread works too
+            const size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+            d->numThreads = std::min(cores, d->channels.size()) - 1;
+        }
+    } catch (const std::exception &) {
+        throw std::runtime_error("setupStream: demod must be <frequency>:<AM|FM|USB|LSB>[:<bandwidth>],... "
+            "and demod_fft, demod_rate and demod_threads numbers");
+    }
+
+    if(d->channels.empty() or d->fftSize < 256) {
+        throw std::runtime_error("setupStream: demod needs at least one channel and demod_fft >= 256");
+    }
+    d->fft.plan(d->fftSize);
+
+    // One output buffer per demodulated channel, in order, a single channel may leave the list empty
+    const bool defaultChannel = channels.empty() and d->channels.size() == 1;
+    if(channels.size() != d->channels.size() and not defaultChannel) {
+        throw std::runtime_error("setupStream: a demod stream has channels 0 to N-1, one per demod channel");
+    }
+    for(size_t i = 0; i < channels.size(); i++) {
+        if(channels[i] != i) {
+            throw std::runtime_error("setupStream: a demod stream has channels 0 to N-1, one per demod channel");
+        }
+    }
+
+    d->input.resize(d->fftSize);
+    d->spectrum.resize(d->fftSize);
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Demodulator bank: %zu channels, %zu point FFT, %zu worker threads",
+            d->channels.size(), d->fftSize, d->numThreads);
+
+    s->demod = std::move(d);
+    resetDemod(s);
+}
+
+void SoapyBB60::resetDemod(SoapyBB60Stream *s)
+{
+    // Planning on the next block clears the frame and the audio
+    SoapyBB60Demod *d = s->demod.get();
+    d->planRate = 0.0;
+    d->changed = false;
+    for(auto &ch : d->channels) ch.held.clear();
+}
+
+size_t SoapyBB60::demodOutSize(const SoapyBB60Demod *d, const double rate) const
+{
+    // Smallest power of two inverse FFT that gives at least the requested output rate
+    size_t m = BB60_DEMOD_OVERLAP;
+    while(m < d->fftSize and rate * m / d->fftSize < d->minRate) m *= 2;
+    return m;
+}
+
+void SoapyBB60::planDemod(SoapyBB60Demod *d, const double rate, const double frequency)
+{
+    const size_t n = d->fftSize;
+    const double binHz = rate / n;
+    const size_t m = demodOutSize(d, rate);
+
+    d->outSize = m;
+    d->outRate = rate * m / n;
+    d->outFft.plan(m);
+
+    const size_t step = n - n / BB60_DEMOD_OVERLAP;
+    const double transition = BB60_DEMOD_TRANSITION * binHz;
+
+    for(size_t i = 0; i < d->channels.size(); i++) {
+        SoapyBB60DemodChannel &ch = d->channels[i];
+        const double offset = ch.frequency - frequency;
+
+        ch.bin = std::lround(offset / binHz);
+        ch.inBand = std::fabs(offset) + ch.bandwidth / 2 < rate / 2;
+        if(not ch.inBand) {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Demod channel %zu (%.6f MHz) is outside the capture, it will be silent",
+                    i, ch.frequency / 1e6);
+        }
+
+        // Flat pass band relative to the carrier, single sided for SSB, the edges roll off outside it
+        double low = -ch.bandwidth / 2, high = ch.bandwidth / 2;
+        if(ch.mode == BB_DEMOD_USB) low = 0.0, high = ch.bandwidth;
+        if(ch.mode == BB_DEMOD_LSB) low = -ch.bandwidth, high = 0.0;
+        if(high - low + 2 * transition > d->outRate) {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Demod channel %zu: %.1f kHz does not fit the %.1f kHz output rate, raise demod_rate",
+                    i, ch.bandwidth / 1e3, d->outRate / 1e3);
+        }
+
+        // Raised cosine edges, delayed to the middle of the discarded overlap so it wraps nowhere else
+        const double residual = offset - ch.bin * binHz;
+        const double delay = (double)m / BB60_DEMOD_OVERLAP / 2;
+        ch.response.assign(m, 0.0f);
+        for(long j = -(long)m / 2; j < (long)m / 2; j++) {
+            const double f = j * binHz - residual;
+            double gain = 0.0;
+            if(f >= low and f <= high) {
+                gain = 1.0;
+            } else if(f > low - transition and f < low) {
+                gain = 0.5 + 0.5 * std::cos(M_PI * (low - f) / transition);
+            } else if(f > high and f < high + transition) {
+                gain = 0.5 + 0.5 * std::cos(M_PI * (f - high) / transition);
+            }
+            ch.response[(j + m) % m] = std::complex<float>(std::polar(gain / n, -2.0 * M_PI * j * delay / m));
+        }
+
+        ch.rot = 1.0;
+        ch.rotStep = std::polar(1.0, -2.0 * M_PI * ch.bin * (double)step / n);
+        ch.nco = 1.0;
+        ch.ncoStep = std::polar(1.0, -2.0 * M_PI * residual / d->outRate);
+        ch.work.resize(m);
+        ch.prev = 0.0f;
+        ch.dc = 0.0f;
+        ch.audio.clear();
+    }
+
+    std::fill(d->input.begin(), d->input.end(), std::complex<float>(0.0f, 0.0f));
+    d->fill = n / BB60_DEMOD_OVERLAP;
+    d->audioOffset = 0;
+    d->planRate = rate;
+    d->planFrequency = frequency;
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Demodulator bank output rate %.1f Hz", d->outRate);
+}
+
+/*******************************************************************
+ * Worker pool
+ ******************************************************************/
+
+void SoapyBB60::startDemod(SoapyBB60Demod *d)
+{
+    d->running = true;
+    for(size_t i = 0; i < d->numThreads; i++) {
+        d->workers.emplace_back(&SoapyBB60::demodWorkerLoop, this, d);
+    }
+}
+
+void SoapyBB60::stopDemod(SoapyBB60Demod *d)
+{
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        d->running = false;
+    }
+    d->cond.notify_all();
+    for(auto &worker : d->workers) worker.join();
+    d->workers.clear();
+}
+
+void SoapyBB60::demodWorkerLoop(SoapyBB60Demod *d)
+{
+    tuneThread(workerCpus, workerPriority, "Demod");
+
+    unsigned long long seen;
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        seen = d->frame;
+    }
+
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(d->mutex);
+            d->cond.wait(lock, [d, seen]{ return d->frame != seen or not d->running; });
+            if(not d->running) break;
+            seen = d->frame;
+        }
+        demodWork(d);
+    }
+}
+
+void SoapyBB60::demodWork(SoapyBB60Demod *d)
+{
+    // Claim channels until none are left, whoever is free takes the next one
+    size_t count = 0;
+    size_t i;
+    while((i = d->next.fetch_add(1)) < d->channels.size()) {
+        demodChannel(d, d->channels[i]);
+        count++;
+    }
+
+    if(count != 0) {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        d->done += count;
+        if(d->done == d->channels.size()) d->doneCond.notify_all();
+    }
+}
+
+/*******************************************************************
+ * Channelizer and demodulators
+ ******************************************************************/
+
+void SoapyBB60::demodChannel(SoapyBB60Demod *d, SoapyBB60DemodChannel &ch)
+{
+    const size_t n = d->fftSize;
+    const size_t m = d->outSize;
+    const size_t valid = m - m / BB60_DEMOD_OVERLAP;
+
+    if(not ch.inBand) {
+        ch.audio.insert(ch.audio.end(), valid, 0.0f);
+        return;
+    }
+
+    // The bins around the channel, moved to baseband
+    for(long j = -(long)m / 2; j < (long)m / 2; j++) {
+        const size_t k = (size_t)((ch.bin + j) % (long)n + (long)n) % n;
+        const size_t o = (j + m) % m;
+        ch.work[o] = d->spectrum[k] * ch.response[o];
+    }
+    d->outFft.inverse(ch.work.data());
+
+    // Overlap-save, the first quarter of the output is wrapped around
+    const std::complex<float> *y = ch.work.data() + (m - valid);
+    const float fmScale = (float)(d->outRate / (M_PI * ch.bandwidth));
+    const float dcAlpha = (float)(1.0 - std::exp(-1.0 / (0.05 * d->outRate)));
+
+    for(size_t i = 0; i < valid; i++) {
+        const std::complex<double> phase = ch.rot * ch.nco;
+        ch.nco *= ch.ncoStep;
+        const std::complex<float> x = y[i] * std::complex<float>(phase);
+
+        float v = 0.0f;
+        switch(ch.mode) {
+        case BB_DEMOD_FM:
+            // Half the channel bandwidth of deviation reads 1
+            v = std::arg(x * std::conj(ch.prev)) * fmScale;
+            ch.prev = x;
+            break;
+        case BB_DEMOD_AM: {
+            const float envelope = std::abs(x);
+            ch.dc += dcAlpha * (envelope - ch.dc);
+            v = envelope - ch.dc;
+            break;
+        }
+        default:
+            v = x.real();
+            break;
+        }
+        ch.audio.push_back(v);
+    }
+
+    // Renormalized once per frame against rounding drift
+    ch.rot *= ch.rotStep;
+    ch.rot /= std::abs(ch.rot);
+    ch.nco /= std::abs(ch.nco);
+}
+
+void SoapyBB60::demodFrame(SoapyBB60Demod *d)
+{
+    const size_t n = d->fftSize;
+    const size_t overlap = n / BB60_DEMOD_OVERLAP;
+
+    std::copy(d->input.begin(), d->input.end(), d->spectrum.begin());
+    d->fft.forward(d->spectrum.data());
+    std::copy(d->input.end() - overlap, d->input.end(), d->input.begin());
+    d->fill = overlap;
+
+    // Drop what was read before the workers append to the channels
+    const bool empty = d->channels[0].audio.size() == d->audioOffset;
+    for(auto &ch : d->channels) {
+        ch.audio.erase(ch.audio.begin(), ch.audio.begin() + d->audioOffset);
+    }
+    d->audioOffset = 0;
+    if(empty) d->audioNs = d->frameNs;
+
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        d->next = 0;
+        d->done = 0;
+        d->frame++;
+    }
+    d->cond.notify_all();
+
+    demodWork(d);
+
+    std::unique_lock<std::mutex> lock(d->mutex);
+    d->doneCond.wait(lock, [d]{ return d->done == d->channels.size(); });
+}
+
+int SoapyBB60::readDemod(
+        SoapyBB60Stream *s,
+        void * const *buffs,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    SoapyBB60Demod *d = s->demod.get();
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+
+    flags = 0;
+
+    // Held audio is returned on its own before anything after the change
+    while(d->channels[0].held.empty() and (d->planRate == 0.0 or d->channels[0].audio.size() - d->audioOffset < numElems)) {
+        const size_t available = (d->planRate == 0.0) ? 0 : d->channels[0].audio.size() - d->audioOffset;
+        const long waitUs = (available != 0) ? 0 : std::max<long>(std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - std::chrono::steady_clock::now()).count(), 0);
+
+        // Input for the frames that complete the request
+        size_t want = d->fftSize;
+        if(d->planRate != 0.0) {
+            const size_t valid = d->outSize - d->outSize / BB60_DEMOD_OVERLAP;
+            const size_t frames = (numElems - available + valid - 1) / valid;
+            want = frames * (d->fftSize - d->fftSize / BB60_DEMOD_OVERLAP) - (d->fill - d->fftSize / BB60_DEMOD_OVERLAP);
+        }
+
+        int readFlags = 0;
+        long long readNs = 0;
+        bool restarted = false;
+        int ret = readSamples(s, want, readFlags, readNs, waitUs,
+            [&](const std::complex<float> *in, size_t n) {
+                const SoapyBB60Block *block = s->block;
+                size_t offset = s->offset;
+                // The read starts at a settings change, keep the unread audio and start over
+                const bool change = (readFlags & SOAPY_SDR_USER_FLAG1) != 0 and not restarted;
+                if(change and d->planRate != 0.0) {
+                    for(auto &ch : d->channels) ch.held.assign(ch.audio.begin() + d->audioOffset, ch.audio.end());
+                    d->heldNs = d->audioNs;
+                    d->heldRate = d->outRate;
+                    d->changed = true;
+                }
+                restarted = restarted or change;
+                if(change or block->sampleRate != d->planRate or block->frequency != d->planFrequency) {
+                    planDemod(d, block->sampleRate, block->frequency);
+                }
+
+                while(n != 0) {
+                    if(d->fill == d->fftSize / BB60_DEMOD_OVERLAP) {
+                        // Audio lags the input by the filter delay
+                        const double lag = (double)d->outSize / BB60_DEMOD_OVERLAP / 2 / d->outRate;
+                        d->frameNs = (block->timeNs != 0) ?
+                            block->timeNs + (long long)((offset / block->sampleRate - lag) * 1e9) : 0;
+                    }
+                    const size_t len = std::min(n, d->fftSize - d->fill);
+                    std::copy(in, in + len, d->input.begin() + d->fill);
+                    d->fill += len;
+                    in += len;
+                    offset += len;
+                    n -= len;
+                    if(d->fill == d->fftSize) demodFrame(d);
+                }
+            });
+
+        // A gap breaks every channel, start over after reporting it
+        if(ret == SOAPY_SDR_OVERFLOW or s->overflow) {
+            s->overflow = false;
+            resetDemod(s);
+            return SOAPY_SDR_OVERFLOW;
+        }
+        if(ret < 0) {
+            if(available == 0) return ret;
+            break;
+        }
+        if(ret == 0) break;
+    }
+
+    if(not d->channels[0].held.empty()) {
+        const size_t n = std::min(numElems, d->channels[0].held.size());
+        for(size_t i = 0; i < d->channels.size(); i++) {
+            std::vector<float> &held = d->channels[i].held;
+            std::memcpy(buffs[i], held.data(), n * sizeof(float));
+            held.erase(held.begin(), held.begin() + n);
+        }
+        if(d->heldNs != 0) {
+            timeNs = d->heldNs;
+            flags |= SOAPY_SDR_HAS_TIME;
+            d->heldNs += (long long)(n * 1e9 / d->heldRate);
+        }
+        return n;
+    }
+    if(d->changed) {
+        flags |= SOAPY_SDR_USER_FLAG1;
+        d->changed = false;
+    }
+
+    const size_t n = std::min(numElems, d->channels[0].audio.size() - d->audioOffset);
+    for(size_t i = 0; i < d->channels.size(); i++) {
+        std::memcpy(buffs[i], d->channels[i].audio.data() + d->audioOffset, n * sizeof(float));
+    }
+    d->audioOffset += n;
+
+    if(d->audioNs != 0) {
+        timeNs = d->audioNs;
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+    d->audioNs += (long long)(n * 1e9 / d->outRate);
+
+    return n;
+}
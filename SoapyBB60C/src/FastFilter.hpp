@@ -0,0 +1,273 @@
+#pragma once
+
+#include "Fft.hpp"
+
+#include <algorithm>
+#include <complex>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*!
+ * Streaming complex FIR filter with integer decimation D, for long user
+ * filters. Long filters run as overlap-save fast convolution, with the
+ * decimation folded into the spectrum so the inverse FFT is D times
+ * smaller. Short ones run in direct form, which only computes the kept
+ * outputs. Outputs are queued, push and pop need not be the same size.
+ * Output k is taken at input index k * D, counted from the last reset.
+ */
+class SoapyBB60FastFilter {
+public:
+    //! Taps in input order; fast picks overlap-save, see useFast for the automatic choice
+    void design(const std::vector<std::complex<float>> &taps, const size_t decimation, const bool fast)
+    {
+        if(taps.empty() or decimation == 0) {
+            throw std::runtime_error("filter needs at least one tap and a decimation of 1 or more");
+        }
+
+        d = decimation;
+        numTaps_ = taps.size();
+        // History rounded up to whole output steps, so frames keep the output phase
+        history = (numTaps_ - 1 + d - 1) / d * d;
+
+        // Taps reversed for the direct form dot product
+        reversed.assign(taps.rbegin(), taps.rend());
+        // Whole pairs, an odd last tap is paired with zero
+        split.assign(4 * ((numTaps_ + 1) & ~size_t(1)), 0.0f);
+        for(size_t k = 0; k < numTaps_; k++) {
+            float *pair = &split[4 * (k & ~size_t(1)) + 2 * (k & 1)];
+            pair[0] = pair[1] = reversed[k].real();
+            pair[4] = -reversed[k].imag();
+            pair[5] = reversed[k].imag();
+        }
+
+        n = 0;
+        if(fast) {
+            // Frames of about four times the filter keep the FFT cost per sample low
+            n = 1024;
+            while(n < 4 * numTaps_ or n < 2 * (history + d)) n <<= 1;
+            step = (n - history) / d * d;
+            fft.plan(n);
+            folded = (n % d == 0) and n / d >= 2;
+            if(folded) small.plan(n / d);
+
+            // Filter spectrum, with the inverse FFT normalization folded in
+            response.assign(n, 0.0f);
+            for(size_t k = 0; k < numTaps_; k++) response[k] = taps[k] / (float)n;
+            fft.forward(response.data());
+
+            frame.resize(n);
+            work.resize(n);
+        }
+
+        reset();
+    }
+
+    //! Drop the history and queued outputs, the next input is index 0
+    void reset(void)
+    {
+        inputs = 0;
+        popIndex = 0;
+        nextOut = 0;
+        queue.clear();
+        queueOffset = 0;
+        hist.assign(numTaps_ - 1, 0.0f);
+        std::fill(frame.begin(), frame.end(), 0.0f);
+        fill = 0;
+    }
+
+    //! Overlap-save beats direct form from about 32 taps per output, measured with bench/FilterBench.cpp
+    static bool useFast(const size_t numTaps, const size_t decimation)
+    {
+        return numTaps >= 32 * decimation;
+    }
+
+    bool active(void) const
+    {
+        return numTaps_ != 0;
+    }
+
+    size_t numTaps(void) const
+    {
+        return numTaps_;
+    }
+
+    size_t decimation(void) const
+    {
+        return d;
+    }
+
+    //! FFT size, 0 in direct form
+    size_t fftSize(void) const
+    {
+        return n;
+    }
+
+    //! Group delay in input samples, for linear phase taps
+    size_t delay(void) const
+    {
+        return (numTaps_ - 1) / 2;
+    }
+
+    //! Input samples pushed since the reset
+    unsigned long long inputCount(void) const
+    {
+        return inputs;
+    }
+
+    //! Input index the next popped output was taken at
+    unsigned long long outputIndex(void) const
+    {
+        return popIndex;
+    }
+
+    size_t available(void) const
+    {
+        return queue.size() - queueOffset;
+    }
+
+    void push(const std::complex<float> *in, const size_t count)
+    {
+        if(n != 0) {
+            pushFast(in, count);
+        } else {
+            pushDirect(in, count);
+        }
+        inputs += count;
+    }
+
+    size_t pop(std::complex<float> *out, const size_t max)
+    {
+        const size_t len = std::min(max, available());
+        std::memcpy(out, queue.data() + queueOffset, len * sizeof(std::complex<float>));
+        queueOffset += len;
+        popIndex += len * d;
+
+        // Compact once the consumed head outgrows what is left
+        if(queueOffset > queue.size() / 2) {
+            queue.erase(queue.begin(), queue.begin() + queueOffset);
+            queueOffset = 0;
+        }
+
+        return len;
+    }
+
+private:
+    void pushDirect(const std::complex<float> *in, const size_t count)
+    {
+        // hist holds the numTaps - 1 inputs before this push, then the push
+        const unsigned long long total = inputs + count;
+        hist.insert(hist.end(), in, in + count);
+
+        for(; nextOut < total; nextOut += d) {
+            queue.push_back(dot(hist.data() + (nextOut - inputs), numTaps_));
+        }
+
+        hist.erase(hist.begin(), hist.end() - (numTaps_ - 1));
+    }
+
+    void pushFast(const std::complex<float> *in, size_t count)
+    {
+        while(count > 0) {
+            const size_t len = std::min(count, step - fill);
+            std::memcpy(frame.data() + history + fill, in, len * sizeof(std::complex<float>));
+            fill += len;
+            in += len;
+            count -= len;
+            if(fill == step) processFrame();
+        }
+    }
+
+    void processFrame(void)
+    {
+        std::memcpy(work.data(), frame.data(), n * sizeof(std::complex<float>));
+        fft.forward(work.data());
+        // Conjugated product, so a forward FFT does the inverse and only the kept outputs are conjugated back
+        for(size_t k = 0; k < n; k++) {
+            const std::complex<float> &x = work[k];
+            const std::complex<float> &h = response[k];
+            work[k] = std::complex<float>(x.real() * h.real() - x.imag() * h.imag(),
+                                          -(x.real() * h.imag() + x.imag() * h.real()));
+        }
+
+        // Outputs history, history + D, ... are the ones without circular wrap
+        const size_t outputs = step / d;
+        const size_t first = queue.size();
+        queue.resize(first + outputs);
+        std::complex<float> *out = queue.data() + first;
+        if(folded) {
+            // Decimating by D in time aliases the spectrum onto n / D bins
+            const size_t m = n / d;
+            for(size_t j = 1; j < d; j++) {
+                const std::complex<float> *src = work.data() + j * m;
+                for(size_t k = 0; k < m; k++) work[k] += src[k];
+            }
+            small.forward(work.data());
+            for(size_t k = 0; k < outputs; k++) out[k] = std::conj(work[history / d + k]);
+        } else {
+            fft.forward(work.data());
+            for(size_t k = 0; k < outputs; k++) out[k] = std::conj(work[history + k * d]);
+        }
+
+        // The tail of this frame is the history of the next
+        std::memmove(frame.data(), frame.data() + step, history * sizeof(std::complex<float>));
+        fill = 0;
+    }
+
+    //! Taps times len inputs, oldest first
+    std::complex<float> dot(const std::complex<float> *x, const size_t len) const
+    {
+        size_t k = 0;
+        float re = 0.0f, im = 0.0f;
+#if defined(__SSE2__)
+        // Two complex samples per step, (a + bi)(c + di) as (a, b) * (c, c) + (b, a) * (-d, d)
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        const float *xf = (const float *)x;
+        for(; k + 2 <= len; k += 2) {
+            const __m128 v = _mm_loadu_ps(xf + 2 * k);
+            const __m128 swapped = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+            const __m128 c = _mm_loadu_ps(&split[4 * k]);
+            const __m128 s = _mm_loadu_ps(&split[4 * k + 4]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(v, c));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(swapped, s));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+        re = lanes[0] + lanes[2];
+        im = lanes[1] + lanes[3];
+#endif
+        for(; k < len; k++) {
+            const std::complex<float> &h = reversed[k];
+            re += x[k].real() * h.real() - x[k].imag() * h.imag();
+            im += x[k].real() * h.imag() + x[k].imag() * h.real();
+        }
+        return std::complex<float>(re, im);
+    }
+
+    size_t numTaps_ = 0;
+    size_t d = 1;
+    size_t history = 0;                 // inputs kept between frames, a multiple of d
+    std::vector<std::complex<float>> reversed;
+    std::vector<float> split;           // reversed tap pairs as (c0, c0, c1, c1, -d0, d0, -d1, d1) for SSE2
+    std::vector<std::complex<float>> hist;
+
+    size_t n = 0;                       // FFT size of the fast form
+    size_t step = 0;                    // new inputs per frame, a multiple of d
+    bool folded = false;
+    SoapyBB60Fft fft, small;
+    std::vector<std::complex<float>> response;
+    std::vector<std::complex<float>> frame, work;
+    size_t fill = 0;
+
+    unsigned long long inputs = 0;
+    unsigned long long nextOut = 0;     // input index of the next output the direct form computes
+    unsigned long long popIndex = 0;
+    std::vector<std::complex<float>> queue;
+    size_t queueOffset = 0;
+};
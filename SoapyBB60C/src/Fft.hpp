@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*!
+ * In place radix-2 complex FFT, planned once for a fixed power of two size.
+ * Forward transform, unnormalized: X[k] = sum x[n] exp(-2 pi i k n / N).
+ */
+class SoapyBB60Fft {
+public:
+    SoapyBB60Fft(void) {}
+
+    explicit SoapyBB60Fft(const size_t size)
+    {
+        plan(size);
+    }
+
+    void plan(const size_t size)
+    {
+        if(size < 2 or (size & (size - 1)) != 0) {
+            throw std::runtime_error("FFT size must be a power of two");
+        }
+
+        n = size;
+        size_t bits = 0;
+        while((size_t(1) << bits) < n) bits++;
+
+        reversed.resize(n);
+        for(size_t i = 0; i < n; i++) {
+            size_t r = 0;
+            for(size_t b = 0; b < bits; b++) {
+                if(i & (size_t(1) << b)) r |= size_t(1) << (bits - 1 - b);
+            }
+            reversed[i] = r;
+        }
+
+        // Twiddles of the stage with half length h at h .. 2h - 1, contiguous per stage
+        twiddles.resize(n);
+        for(size_t h = 1; h < n; h <<= 1) {
+            for(size_t k = 0; k < h; k++) {
+                twiddles[h + k] = std::polar(1.0, -M_PI * k / h);
+            }
+        }
+    }
+
+    size_t size(void) const
+    {
+        return n;
+    }
+
+    void forward(std::complex<float> *data) const
+    {
+        for(size_t i = 0; i < n; i++) {
+            if(i < reversed[i]) std::swap(data[i], data[reversed[i]]);
+        }
+
+        // The first stage has no twiddle
+        for(size_t start = 0; start < n; start += 2) {
+            const std::complex<float> t = data[start + 1];
+            data[start + 1] = data[start] - t;
+            data[start] += t;
+        }
+
+        for(size_t half = 2; half < n; half <<= 1) {
+            const std::complex<float> *w = twiddles.data() + half;
+            for(size_t start = 0; start < n; start += 2 * half) {
+                butterflies(data + start, data + start + half, w, half);
+            }
+        }
+    }
+
+    //! Inverse transform, unnormalized like forward
+    void inverse(std::complex<float> *data) const
+    {
+        for(size_t i = 0; i < n; i++) data[i] = std::conj(data[i]);
+        forward(data);
+        for(size_t i = 0; i < n; i++) data[i] = std::conj(data[i]);
+    }
+
+private:
+    //! a, b = a + w b, a - w b over len pairs
+    static void butterflies(std::complex<float> *a, std::complex<float> *b, const std::complex<float> *w, const size_t len)
+    {
+        size_t k = 0;
+#if defined(__SSE2__)
+        // Two pairs per step, len is a power of two of at least 2
+        float *af = (float *)a;
+        float *bf = (float *)b;
+        const float *wf = (const float *)w;
+        const __m128 sign = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+        for(; k + 2 <= len; k += 2) {
+            const __m128 va = _mm_loadu_ps(af + 2 * k);
+            const __m128 vb = _mm_loadu_ps(bf + 2 * k);
+            const __m128 vw = _mm_loadu_ps(wf + 2 * k);
+            const __m128 wr = _mm_shuffle_ps(vw, vw, _MM_SHUFFLE(2, 2, 0, 0));
+            const __m128 wi = _mm_mul_ps(_mm_shuffle_ps(vw, vw, _MM_SHUFFLE(3, 3, 1, 1)), sign);
+            const __m128 swapped = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1));
+            const __m128 t = _mm_add_ps(_mm_mul_ps(vb, wr), _mm_mul_ps(swapped, wi));
+            _mm_storeu_ps(af + 2 * k, _mm_add_ps(va, t));
+            _mm_storeu_ps(bf + 2 * k, _mm_sub_ps(va, t));
+        }
+#endif
+        for(; k < len; k++) {
+            // Spelled out, std::complex multiply checks for NaN/inf
+            const float re = b[k].real() * w[k].real() - b[k].imag() * w[k].imag();
+            const float im = b[k].real() * w[k].imag() + b[k].imag() * w[k].real();
+            const std::complex<float> t(re, im);
+            b[k] = a[k] - t;
+            a[k] += t;
+        }
+    }
+
+    size_t n = 0;
+    std::vector<size_t> reversed;
+    std::vector<std::complex<float>> twiddles;
+};
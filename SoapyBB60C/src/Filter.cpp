@@ -0,0 +1,177 @@
+#include "SoapyBB60.hpp"
+#include "Trace.hpp"
+
+#include <fstream>
+#include <sstream>
+
+/*******************************************************************
+ * User filter settings
+ ******************************************************************/
+
+// Comma separated real taps
+static std::vector<std::complex<float>> parseTaps(const std::string &value)
+{
+    std::vector<std::complex<float>> taps;
+    std::stringstream ss(value);
+    std::string item;
+
+    while(std::getline(ss, item, ',')) {
+        std::istringstream field(item);
+        float tap = 0.0f;
+        if(not (field >> tap) or not (field >> std::ws).eof()) {
+            throw std::runtime_error("not a number: '" + item + "'");
+        }
+        taps.push_back(tap);
+    }
+
+    return taps;
+}
+
+// One tap per line, a real value or the real and imaginary parts; # starts a comment
+static std::vector<std::complex<float>> loadTaps(const std::string &path)
+{
+    std::ifstream file(path);
+    if(not file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+
+    std::vector<std::complex<float>> taps;
+    std::string line;
+    size_t lineNumber = 0;
+
+    while(std::getline(file, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::replace(line.begin(), line.end(), ',', ' ');
+
+        std::istringstream fields(line);
+        float re = 0.0f, im = 0.0f;
+        if(not (fields >> re)) {
+            if(line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": not a tap");
+        }
+        if(not (fields >> im)) im = 0.0f;
+        taps.emplace_back(re, im);
+    }
+
+    return taps;
+}
+
+void SoapyBB60::writeFilterSetting(const std::string &key, const std::string &value)
+{
+    if(key == "filter_taps" or key == "filter_file") {
+        std::shared_ptr<const std::vector<std::complex<float>>> taps;
+
+        // An empty value removes the filter
+        if(not value.empty()) {
+            try {
+                taps = std::make_shared<const std::vector<std::complex<float>>>(
+                    (key == "filter_taps") ? parseTaps(value) : loadTaps(value));
+            } catch (const std::exception &ex) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "%s: %s", key.c_str(), ex.what());
+                return;
+            }
+            if(taps->empty() or taps->size() > BB60_FILTER_MAX_TAPS) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "%s: needs 1 to %d taps", key.c_str(), BB60_FILTER_MAX_TAPS);
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(configMutex);
+        SoapyBB60Config next = *getConfig();
+        next.filterTaps = taps;
+        updateStream(next);
+        filterPath = (key == "filter_file") ? value : "";
+
+        if(taps) {
+            SoapySDR_logf(SOAPY_SDR_INFO, "User filter: %zu taps, decimation %d", taps->size(), next.filterDecimation);
+        }
+        return;
+    }
+
+    if(key == "filter_decimation") {
+        int decimation = 0;
+        try {
+            decimation = std::stoi(value);
+        } catch (const std::exception &) {
+        }
+        if(decimation < 1) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "filter_decimation: '%s' is not a positive integer", value.c_str());
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(configMutex);
+        SoapyBB60Config next = *getConfig();
+        next.filterDecimation = decimation;
+        updateStream(next);
+        return;
+    }
+
+    SoapySDR_logf(SOAPY_SDR_WARNING, "Invalid setting '%s'=='%s'", key.c_str(), value.c_str());
+}
+
+std::string SoapyBB60::readFilterSetting(const std::string &key) const
+{
+    const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+
+    // Reads back the number of taps, the taps themselves can be long
+    if(key == "filter_taps") {
+        return std::to_string(c->filterTaps ? c->filterTaps->size() : 0);
+    }
+
+    if(key == "filter_file") {
+        std::lock_guard<std::mutex> lock(configMutex);
+        return filterPath;
+    }
+
+    if(key == "filter_decimation") {
+        return std::to_string(c->filterDecimation);
+    }
+
+    SoapySDR_logf(SOAPY_SDR_WARNING, "Unknown setting '%s'", key.c_str());
+
+    return "";
+}
+
+/*******************************************************************
+ * Filtering on the acquisition thread
+ ******************************************************************/
+
+void SoapyBB60::designFilter(void)
+{
+    BB60_TRACE_SCOPE("designFilter");
+
+    if(not acqConfig.filterTaps) {
+        userFilter = SoapyBB60FastFilter();
+        return;
+    }
+
+    const size_t numTaps = acqConfig.filterTaps->size();
+    const size_t decimation = acqConfig.filterDecimation;
+    userFilter.design(*acqConfig.filterTaps, decimation, SoapyBB60FastFilter::useFast(numTaps, decimation));
+
+    if(userFilter.fftSize() != 0) {
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "User filter: overlap-save with %zu point FFTs", userFilter.fftSize());
+    } else {
+        SoapySDR_log(SOAPY_SDR_DEBUG, "User filter: direct form");
+    }
+}
+
+void SoapyBB60::filterBlock(SoapyBB60Block *block)
+{
+    // Outputs trail the inputs by up to a frame, time them from the last timestamped input
+    if(block->timeNs != 0) {
+        filterAnchorIndex = userFilter.inputCount();
+        filterAnchorNs = block->timeNs;
+    }
+
+    userFilter.push(block->data, block->numElems);
+    const unsigned long long index = userFilter.outputIndex();
+    block->numElems = userFilter.pop(block->data, block->capacity);
+
+    // Linear phase taps delay the signal by half their length
+    if(block->timeNs != 0) {
+        const double lag = (double)index - (double)filterAnchorIndex - (double)userFilter.delay();
+        block->timeNs = filterAnchorNs + (long long)(lag * 1e9 / acqConfig.captureRate());
+    }
+}
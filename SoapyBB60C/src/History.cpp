@@ -0,0 +1,410 @@
+#include "SoapyBB60.hpp"
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*******************************************************************
+ * History ring
+ ******************************************************************/
+
+void SoapyBB60::startHistory(const double seconds)
+{
+    if(not (seconds >= 0.1)) {
+        throw std::runtime_error("history must be at least 0.1 seconds");
+    }
+
+    historyLength = (size_t)(seconds * BB60_HISTORY_RATE);
+    historySize = historyLength * sizeof(std::complex<float>);
+    historyData = (std::complex<float> *)mapMemory(historySize);
+    if(historyData == nullptr) {
+        throw std::runtime_error("Unable to allocate " + std::to_string(historySize >> 20) + " MB for the history ring");
+    }
+    historyTriggers.assign(BB60_MAX_TRIGGERS, 0);
+
+    historyRunning = true;
+    snapshotThread = std::thread(&SoapyBB60::snapshotLoop, this);
+
+    // The internal stream keeps the acquisition, and so the history, running
+    historyStream = (SoapyBB60Stream *)setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32);
+    activateStream((SoapySDR::Stream *)historyStream);
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Keeping the last %.1f s of IQ at 40 MS/s (%zu MB)", seconds, historySize >> 20);
+}
+
+void SoapyBB60::stopHistory(void)
+{
+    if(historyData == nullptr) {
+        return;
+    }
+
+    // Called once the acquisition has stopped, pending snapshots get what is there
+    {
+        std::lock_guard<std::mutex> lock(historyMutex);
+        historyRunning = false;
+    }
+    historyCond.notify_all();
+    if(snapshotThread.joinable()) {
+        snapshotThread.join();
+    }
+
+    munmap(historyData, historySize);
+    historyData = nullptr;
+}
+
+void SoapyBB60::feedHistory(const SoapyBB60Block *block, const bbIQPacket &pkt)
+{
+    if(historyData == nullptr or block->numElems == 0) {
+        return;
+    }
+
+    const unsigned long long head = historyHead.load(std::memory_order_relaxed);
+
+    // Lost samples and settings changes start a new segment
+    if(historyBreak or block->epoch != historyEpoch or block->sampleLoss or block->resumed) {
+        SoapyBB60HistorySegment segment;
+        segment.start = head;
+        segment.timeNs = block->timeNs;
+        segment.sampleRate = acqConfig.captureRate();
+        segment.frequency = block->frequency;
+
+        std::lock_guard<std::mutex> lock(historyMutex);
+        historySegments.push_back(segment);
+        while(historySegments.size() > 1 and historySegments[1].start + historyLength <= head) {
+            historySegments.pop_front();
+        }
+        historyEpoch = block->epoch;
+        historyBreak = false;
+    }
+
+    // Published before the copy, so a reader never trusts samples that are being overwritten
+    historyWriting.store(head + block->numElems, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const size_t offset = head % historyLength;
+    const size_t first = std::min<size_t>(block->numElems, historyLength - offset);
+    std::memcpy(historyData + offset, block->data, first * sizeof(std::complex<float>));
+    std::memcpy(historyData, block->data + first, (block->numElems - first) * sizeof(std::complex<float>));
+    historyHead.store(head + block->numElems, std::memory_order_release);
+
+    // Port 2 trigger positions count packet samples, zero ends the list
+    if(pkt.triggers == nullptr) {
+        return;
+    }
+    for(int i = 0; i < pkt.triggerCount and pkt.triggers[i] != 0; i++) {
+        const unsigned long long trigger = head + (unsigned long long)pkt.triggers[i] * block->numElems / pkt.iqCount;
+        BB60_TRACE_INSTANT("trigger");
+
+        std::lock_guard<std::mutex> lock(historyMutex);
+        requestSnapshot(trigger, historySegments.back());
+    }
+}
+
+bool SoapyBB60::requestSnapshot(const unsigned long long trigger, const SoapyBB60HistorySegment &segment)
+{
+    // Called with historyMutex held, a trigger inside a pending window adds nothing
+    for(const auto &pending : snapshots) {
+        if(trigger >= pending.begin and trigger < pending.end) return false;
+    }
+
+    const unsigned long long head = historyHead.load(std::memory_order_acquire);
+    const unsigned long long oldest = (head > historyLength) ? head - historyLength : 0;
+    const unsigned long long pre = (unsigned long long)(snapshotPre * segment.sampleRate);
+
+    SoapyBB60Snapshot snap;
+    snap.trigger = trigger;
+    snap.begin = std::max(std::max((trigger > pre) ? trigger - pre : 0, oldest), segment.start);
+    snap.end = trigger + (unsigned long long)(snapshotPost * segment.sampleRate);
+    snap.segment = segment;
+
+    const long long triggerNs = (segment.timeNs != 0) ?
+        segment.timeNs + (long long)((trigger - segment.start) * 1e9 / segment.sampleRate) : 0;
+    snap.path = snapshotDir + "/bb60_" + std::to_string(serial) + "_" +
+        ((triggerNs != 0) ? std::to_string(triggerNs) : "sample" + std::to_string(trigger));
+
+    snapshots.push_back(snap);
+    historyCond.notify_all();
+
+    return true;
+}
+
+/*******************************************************************
+ * Snapshot settings
+ ******************************************************************/
+
+void SoapyBB60::writeSnapshotSetting(const std::string &key, const std::string &value)
+{
+    if(key == "snapshot") {
+        if(historyData == nullptr) {
+            SoapySDR_log(SOAPY_SDR_ERROR, "snapshot: no history, open the device with history=<seconds>");
+            return;
+        }
+
+        long long timeNs = 0;
+        if(not value.empty() and value != "now") {
+            try {
+                timeNs = std::stoll(value);
+            } catch (const std::exception &) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "snapshot: '%s' is not a time in ns", value.c_str());
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(historyMutex);
+        if(historySegments.empty()) {
+            SoapySDR_log(SOAPY_SDR_ERROR, "snapshot: nothing captured yet");
+            return;
+        }
+
+        // Now is the newest sample, otherwise find the segment that holds the time
+        const unsigned long long head = historyHead.load(std::memory_order_acquire);
+        unsigned long long trigger = head;
+        size_t index = historySegments.size() - 1;
+        if(timeNs != 0) {
+            while(index > 0 and (historySegments[index].timeNs == 0 or historySegments[index].timeNs > timeNs)) {
+                index--;
+            }
+            const SoapyBB60HistorySegment &segment = historySegments[index];
+            const unsigned long long oldest = (head > historyLength) ? head - historyLength : 0;
+            if(segment.timeNs == 0 or segment.timeNs > timeNs) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "snapshot: %lld is older than the history", timeNs);
+                return;
+            }
+            trigger = segment.start + (unsigned long long)std::llround((timeNs - segment.timeNs) * segment.sampleRate / 1e9);
+            if(trigger < oldest) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "snapshot: %lld is older than the history", timeNs);
+                return;
+            }
+            if(index + 1 < historySegments.size() and trigger >= historySegments[index + 1].start) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "snapshot: %lld falls in a gap or settings change", timeNs);
+                return;
+            }
+        }
+
+        if(not requestSnapshot(trigger, historySegments[index])) {
+            SoapySDR_log(SOAPY_SDR_INFO, "snapshot: already covered by a pending snapshot");
+        }
+        return;
+    }
+
+    if(key == "snapshot_pre" or key == "snapshot_post") {
+        double seconds = -1.0;
+        try {
+            seconds = std::stod(value);
+        } catch (const std::exception &) {
+        }
+        if(not (seconds >= 0.0)) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "%s: '%s' is not a number of seconds", key.c_str(), value.c_str());
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(historyMutex);
+        if(key == "snapshot_pre") {
+            snapshotPre = seconds;
+        } else {
+            snapshotPost = seconds;
+        }
+        return;
+    }
+
+    if(key == "snapshot_dir") {
+        std::lock_guard<std::mutex> lock(historyMutex);
+        snapshotDir = value.empty() ? "." : value;
+        return;
+    }
+
+    SoapySDR_logf(SOAPY_SDR_WARNING, "Invalid setting '%s'=='%s'", key.c_str(), value.c_str());
+}
+
+std::string SoapyBB60::readSnapshotSetting(const std::string &key) const
+{
+    std::lock_guard<std::mutex> lock(historyMutex);
+
+    // The last file written
+    if(key == "snapshot") {
+        return lastSnapshot;
+    }
+
+    if(key == "snapshot_pre") {
+        return std::to_string(snapshotPre);
+    }
+
+    if(key == "snapshot_post") {
+        return std::to_string(snapshotPost);
+    }
+
+    if(key == "snapshot_dir") {
+        return snapshotDir;
+    }
+
+    SoapySDR_logf(SOAPY_SDR_WARNING, "Unknown setting '%s'", key.c_str());
+
+    return "";
+}
+
+/*******************************************************************
+ * Snapshot writer
+ ******************************************************************/
+
+void SoapyBB60::snapshotLoop(void)
+{
+    tuneThread(workerCpus, workerPriority, "Snapshot");
+
+    std::unique_lock<std::mutex> lock(historyMutex);
+
+    while(historyRunning or not snapshots.empty()) {
+        if(snapshots.empty()) {
+            historyCond.wait(lock);
+            continue;
+        }
+
+        // Requests that arrive meanwhile queue behind this one, or merge with it
+        SoapyBB60Snapshot snap = snapshots.front();
+        lock.unlock();
+        writeSnapshot(snap);
+        lock.lock();
+
+        snapshots.pop_front();
+        lastSnapshot = snap.path + ".sigmf-data";
+    }
+}
+
+// ISO 8601 UTC with ns
+static std::string isoTime(const long long timeNs)
+{
+    const time_t sec = timeNs / 1000000000LL;
+    struct tm utc;
+    gmtime_r(&sec, &utc);
+
+    char text[64];
+    const size_t len = std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(text + len, sizeof(text) - len, ".%09lldZ", timeNs % 1000000000LL);
+
+    return text;
+}
+
+void SoapyBB60::writeSnapshot(SoapyBB60Snapshot &snap)
+{
+    BB60_TRACE_SCOPE("writeSnapshot");
+
+    const std::string dataPath = snap.path + ".sigmf-data";
+    const int fd = open(dataPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "snapshot: cannot create %s: %s", dataPath.c_str(), std::strerror(errno));
+        return;
+    }
+
+    // A backlog may have let the ring pass the start, keep clear of the samples being overwritten
+    {
+        const unsigned long long head = historyHead.load(std::memory_order_acquire);
+        const unsigned long long safe = (head > historyLength) ? head - historyLength + historyLength / 8 : 0;
+        snap.begin = std::max(snap.begin, std::min(safe, snap.end));
+    }
+
+    unsigned long long pos = snap.begin;
+    bool lost = false;
+    bool failed = false;
+
+    while(pos < snap.end) {
+        const unsigned long long head = historyHead.load(std::memory_order_acquire);
+        unsigned long long limit = std::min(head, snap.end);
+        bool segmentEnds = false;
+        {
+            std::unique_lock<std::mutex> lock(historyMutex);
+            for(const auto &segment : historySegments) {
+                if(segment.start > snap.segment.start) {
+                    limit = std::min<unsigned long long>(limit, segment.start);
+                    segmentEnds = true;
+                    break;
+                }
+            }
+
+            // Wait for the acquisition to catch up with the window
+            if(pos >= limit) {
+                if(segmentEnds or not historyRunning or not acqRunning) break;
+                historyCond.wait_for(lock, std::chrono::milliseconds(10));
+                continue;
+            }
+        }
+
+        const unsigned long long writing = historyWriting.load(std::memory_order_acquire);
+        if(writing > historyLength and pos < writing - historyLength) {
+            lost = true;
+            break;
+        }
+
+        // Straight from the ring, a few MB at a time so an overrun is noticed early
+        const size_t offset = pos % historyLength;
+        const size_t count = std::min<unsigned long long>(std::min<unsigned long long>(limit - pos,
+            historyLength - offset), 1 << 20);
+        const char *src = (const char *)(historyData + offset);
+        size_t remaining = count * sizeof(std::complex<float>);
+        while(remaining > 0) {
+            const ssize_t ret = write(fd, src, remaining);
+            if(ret < 0 and errno == EINTR) continue;
+            if(ret <= 0) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "snapshot: writing %s: %s", dataPath.c_str(), std::strerror(errno));
+                failed = true;
+                break;
+            }
+            src += ret;
+            remaining -= ret;
+        }
+        if(failed) break;
+
+        // Samples overwritten while they were written are garbage, drop them from the file
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(historyWriting.load(std::memory_order_relaxed) > pos + historyLength) {
+            lost = true;
+            break;
+        }
+        pos += count;
+    }
+
+    if(ftruncate(fd, (pos - snap.begin) * sizeof(std::complex<float>)) != 0) {
+        failed = true;
+    }
+    close(fd);
+    snap.end = pos;
+
+    // SigMF metadata, the trigger is annotated when it made it into the file
+    const SoapyBB60HistorySegment &segment = snap.segment;
+    const std::string metaPath = snap.path + ".sigmf-meta";
+    FILE *meta = std::fopen(metaPath.c_str(), "w");
+    if(meta == nullptr) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "snapshot: cannot create %s: %s", metaPath.c_str(), std::strerror(errno));
+        return;
+    }
+    std::fprintf(meta, "{\n  \"global\": {\n");
+    std::fprintf(meta, "    \"core:datatype\": \"cf32_le\",\n");
+    std::fprintf(meta, "    \"core:sample_rate\": %.17g,\n", segment.sampleRate);
+    std::fprintf(meta, "    \"core:version\": \"1.0.0\",\n");
+    std::fprintf(meta, "    \"core:hw\": \"Signal Hound BB60 S/N %d\",\n", serial);
+    std::fprintf(meta, "    \"core:description\": \"IQ in sqrt(mW)\"\n  },\n");
+    std::fprintf(meta, "  \"captures\": [\n    {\"core:sample_start\": 0, \"core:frequency\": %.17g", segment.frequency);
+    if(segment.timeNs != 0) {
+        const long long beginNs = segment.timeNs + (long long)((snap.begin - segment.start) * 1e9 / segment.sampleRate);
+        std::fprintf(meta, ", \"core:datetime\": \"%s\"", isoTime(beginNs).c_str());
+    }
+    std::fprintf(meta, "}\n  ],\n  \"annotations\": [");
+    if(snap.trigger >= snap.begin and snap.trigger < snap.end) {
+        std::fprintf(meta, "\n    {\"core:sample_start\": %llu, \"core:sample_count\": 1, \"core:label\": \"trigger\"}\n  ",
+            snap.trigger - snap.begin);
+    }
+    std::fprintf(meta, "]\n}\n");
+    std::fclose(meta);
+
+    const double rate = segment.sampleRate;
+    if(lost or failed) {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Snapshot %s cut short: %s", dataPath.c_str(),
+            failed ? "write error" : "the history ring overtook the writer");
+    } else {
+        SoapySDR_logf(SOAPY_SDR_INFO, "Snapshot %s: %.3f s before and %.3f s after the trigger", dataPath.c_str(),
+            ((double)snap.trigger - snap.begin) / rate, ((double)snap.end - snap.trigger) / rate);
+    }
+}
@@ -0,0 +1,895 @@
+#pragma once
+
+#include <SoapySDR/Formats.hpp>
+
+#include <algorithm>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef SOAPY_SDR_CS12
+#define SOAPY_SDR_CS12 "CS12"
+#endif
+
+// Lossless delta + bit-packed CS16, counted in bytes
+#define BB60_FORMAT_CS16Z "CS16Z"
+#define BB60_COMPRESS_FRAME 256
+#define BB60_COMPRESS_GROUP 64
+#define BB60_COMPRESS_MAX_FRAME (2 + (2 * BB60_COMPRESS_FRAME / BB60_COMPRESS_GROUP) * (1 + 2 * BB60_COMPRESS_GROUP))
+
+// Derived real formats, one float per sample
+#define BB60_FORMAT_POWER "F32_POWER"   // |x|^2
+#define BB60_FORMAT_DB "F32_DB"         // 10 log10 |x|^2
+#define BB60_FORMAT_MAG "F32_MAG"       // |x|
+#define BB60_FORMAT_PHASE "F32_PHASE"   // arg(x) in radians
+#define BB60_FORMAT_FREQ "F32_FREQ"     // instantaneous frequency in Hz from the center
+
+/*******************************************************************
+ * Vector kernels used on the acquisition path
+ ******************************************************************/
+
+namespace SoapyBB60Kernels {
+
+/*!
+ * Bytes per element of a stream format.
+ * Compressed streams count bytes rather than samples.
+ */
+inline size_t formatSize(const std::string &format)
+{
+    if(format == SOAPY_SDR_CS16) return 2 * sizeof(int16_t);
+    if(format == SOAPY_SDR_CS12) return 3;
+    if(format == BB60_FORMAT_CS16Z) return 1;
+    if(format == SOAPY_SDR_F32) return sizeof(float);
+    if(format.compare(0, 4, "F32_") == 0) return sizeof(float);
+    return sizeof(std::complex<float>);
+}
+
+/*!
+ * Scale CF32 samples into interleaved int16 with saturation.
+ */
+inline void toInt16(const std::complex<float> *in, int16_t *out, const size_t n, const float scale)
+{
+    const float *src = (const float *)in;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    for(; i + 8 <= 2 * n; i += 8) {
+        const __m128 a = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i), hi), lo), s);
+        const __m128 b = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i + 4), hi), lo), s);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+#endif
+
+    for(; i < 2 * n; i++) {
+        const float v = std::max(-1.0f, std::min(1.0f, src[i]));
+        out[i] = (int16_t)std::lrint(v * scale);
+    }
+}
+
+/*!
+ * Pack interleaved 12-bit values (held in int16) into SoapySDR CS12.
+ * Each sample is the little-endian 24-bit word I | Q << 12.
+ */
+inline void packCS12(const int16_t *in, uint8_t *out, const size_t n)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Eight samples into 24 bytes: 24-bit samples per 32-bit lane, pairs of
+    // them as 48-bit words per 64-bit lane, then the words closed up
+    const __m128i lo12 = _mm_set1_epi32(0x00000fff);
+    const __m128i hi12 = _mm_set1_epi32(0x0fff0000);
+    const __m128i lo24 = _mm_set1_epi64x(0x0000000000ffffffLL);
+    const __m128i hi24 = _mm_set1_epi64x(0x0000ffffff000000LL);
+    const __m128i word0 = _mm_set_epi32(0, 0, 0x0000ffff, (int)0xffffffff);
+    const __m128i word1 = _mm_set_epi32(0, (int)0xffffffff, (int)0xffff0000, 0);
+    for(; i + 8 <= n; i += 8) {
+        __m128i r[2];
+        for(int k = 0; k < 2; k++) {
+            const __m128i x = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8 * k));
+            const __m128i s = _mm_or_si128(_mm_and_si128(x, lo12), _mm_srli_epi32(_mm_and_si128(x, hi12), 4));
+            const __m128i w = _mm_or_si128(_mm_and_si128(s, lo24), _mm_and_si128(_mm_srli_epi64(s, 8), hi24));
+            r[k] = _mm_or_si128(_mm_and_si128(w, word0), _mm_and_si128(_mm_srli_si128(w, 2), word1));
+        }
+        _mm_storeu_si128((__m128i *)out, _mm_or_si128(r[0], _mm_slli_si128(r[1], 12)));
+        _mm_storel_epi64((__m128i *)(out + 16), _mm_srli_si128(r[1], 4));
+        out += 24;
+    }
+#endif
+
+    // Two samples at a time as one 48-bit word
+    for(; i + 2 <= n; i += 2) {
+        const uint64_t w =
+            (uint64_t)(in[2 * i] & 0xfff) |
+            (uint64_t)(in[2 * i + 1] & 0xfff) << 12 |
+            (uint64_t)(in[2 * i + 2] & 0xfff) << 24 |
+            (uint64_t)(in[2 * i + 3] & 0xfff) << 36;
+        out[0] = (uint8_t)w;
+        out[1] = (uint8_t)(w >> 8);
+        out[2] = (uint8_t)(w >> 16);
+        out[3] = (uint8_t)(w >> 24);
+        out[4] = (uint8_t)(w >> 32);
+        out[5] = (uint8_t)(w >> 40);
+        out += 6;
+    }
+
+    for(; i < n; i++) {
+        const uint32_t w = (uint32_t)(in[2 * i] & 0xfff) | (uint32_t)(in[2 * i + 1] & 0xfff) << 12;
+        out[0] = (uint8_t)w;
+        out[1] = (uint8_t)(w >> 8);
+        out[2] = (uint8_t)(w >> 16);
+        out += 3;
+    }
+}
+
+/*!
+ * Unpack SoapySDR CS12 into sign-extended interleaved int16.
+ */
+inline void unpackCS12(const uint8_t *in, int16_t *out, const size_t n)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // The steps of packCS12 in reverse, then a sign extension per rail
+    const __m128i bytes12 = _mm_set_epi32(0, (int)0xffffffff, (int)0xffffffff, (int)0xffffffff);
+    const __m128i word0 = _mm_set_epi32(0, 0, 0x0000ffff, (int)0xffffffff);
+    const __m128i word1 = _mm_set_epi32(0x0000ffff, (int)0xffffffff, 0, 0);
+    const __m128i lo24 = _mm_set1_epi64x(0x0000000000ffffffLL);
+    const __m128i hi24 = _mm_set1_epi64x(0x00ffffff00000000LL);
+    const __m128i lo12 = _mm_set1_epi32(0x00000fff);
+    const __m128i mid12 = _mm_set1_epi32(0x00fff000);
+    for(; i + 8 <= n; i += 8) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)in);
+        const __m128i b = _mm_loadl_epi64((const __m128i *)(in + 16));
+        const __m128i r[2] = {_mm_and_si128(a, bytes12), _mm_or_si128(_mm_srli_si128(a, 12), _mm_slli_si128(b, 4))};
+        for(int k = 0; k < 2; k++) {
+            const __m128i w = _mm_or_si128(_mm_and_si128(r[k], word0), _mm_and_si128(_mm_slli_si128(r[k], 2), word1));
+            const __m128i s = _mm_or_si128(_mm_and_si128(w, lo24), _mm_and_si128(_mm_slli_epi64(w, 8), hi24));
+            const __m128i x = _mm_or_si128(_mm_and_si128(s, lo12), _mm_slli_epi32(_mm_and_si128(s, mid12), 4));
+            _mm_storeu_si128((__m128i *)(out + 2 * i + 8 * k), _mm_srai_epi16(_mm_slli_epi16(x, 4), 4));
+        }
+        in += 24;
+    }
+#endif
+
+    for(; i < n; i++) {
+        const uint32_t w = (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16;
+        out[2 * i] = (int16_t)((int16_t)(w << 4) >> 4);
+        out[2 * i + 1] = (int16_t)((int16_t)((w >> 12) << 4) >> 4);
+        in += 3;
+    }
+}
+
+/*!
+ * Lossless CS16 compression.
+ * A frame holds up to BB60_COMPRESS_FRAME samples:
+ *   uint16 sample count (little-endian), then for every group of
+ *   BB60_COMPRESS_GROUP interleaved values one width byte followed by
+ *   the zigzag encoded deltas (per I and Q rail) packed at that width.
+ * Groups are zero padded, so each group is exactly 1 + 8 * width bytes.
+ */
+inline size_t compressCS16(const int16_t *in, const size_t n, uint8_t *out)
+{
+    uint8_t *start = out;
+    uint16_t zz[BB60_COMPRESS_GROUP];
+
+    *out++ = (uint8_t)n;
+    *out++ = (uint8_t)(n >> 8);
+
+    int16_t prevI = 0, prevQ = 0;
+    for(size_t g = 0; g < 2 * n; g += BB60_COMPRESS_GROUP) {
+        const size_t len = std::min<size_t>(BB60_COMPRESS_GROUP, 2 * n - g);
+        uint16_t any = 0;
+
+#if defined(__SSE2__)
+        // A full group is eight registers, each delta taken against the sample one lane back
+        if(len == BB60_COMPRESS_GROUP) {
+            __m128i prev = _mm_set_epi16(prevQ, prevI, 0, 0, 0, 0, 0, 0);
+            __m128i acc = _mm_setzero_si128();
+            for(size_t k = 0; k < BB60_COMPRESS_GROUP; k += 8) {
+                const __m128i x = _mm_loadu_si128((const __m128i *)(in + g + k));
+                const __m128i d = _mm_sub_epi16(x, _mm_or_si128(_mm_slli_si128(x, 4), _mm_srli_si128(prev, 12)));
+                const __m128i z = _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+                _mm_storeu_si128((__m128i *)(zz + k), z);
+                acc = _mm_or_si128(acc, z);
+                prev = x;
+            }
+            acc = _mm_or_si128(acc, _mm_srli_si128(acc, 8));
+            acc = _mm_or_si128(acc, _mm_srli_si128(acc, 4));
+            acc = _mm_or_si128(acc, _mm_srli_si128(acc, 2));
+            any = (uint16_t)_mm_cvtsi128_si32(acc);
+            prevI = in[g + BB60_COMPRESS_GROUP - 2];
+            prevQ = in[g + BB60_COMPRESS_GROUP - 1];
+        } else
+#endif
+        for(size_t k = 0; k < BB60_COMPRESS_GROUP; k += 2) {
+            if(k >= len) {
+                zz[k] = zz[k + 1] = 0;
+                continue;
+            }
+            const int16_t dI = (int16_t)(in[g + k] - prevI);
+            const int16_t dQ = (int16_t)(in[g + k + 1] - prevQ);
+            prevI = in[g + k];
+            prevQ = in[g + k + 1];
+            zz[k] = (uint16_t)((uint16_t)dI << 1) ^ (uint16_t)(dI >> 15);
+            zz[k + 1] = (uint16_t)((uint16_t)dQ << 1) ^ (uint16_t)(dQ >> 15);
+            any |= zz[k] | zz[k + 1];
+        }
+
+        unsigned width = 0;
+        while(any >> width) width++;
+        *out++ = (uint8_t)width;
+
+        // 8 * width bytes per group, always whole 32-bit words
+        uint64_t acc = 0;
+        unsigned bits = 0;
+        for(size_t k = 0; k < BB60_COMPRESS_GROUP; k++) {
+            acc |= (uint64_t)zz[k] << bits;
+            bits += width;
+            if(bits >= 32) {
+                const uint32_t word = (uint32_t)acc;
+                std::memcpy(out, &word, sizeof(word));
+                out += sizeof(word);
+                acc >>= 32;
+                bits -= 32;
+            }
+        }
+    }
+
+    return out - start;
+}
+
+/*!
+ * Decompress one frame written by compressCS16.
+ * Returns the bytes consumed, n receives the sample count.
+ */
+inline size_t decompressCS16(const uint8_t *in, int16_t *out, size_t &n)
+{
+    const uint8_t *start = in;
+    uint16_t zz[BB60_COMPRESS_GROUP];
+
+    n = (size_t)in[0] | (size_t)in[1] << 8;
+    in += 2;
+
+    int16_t prevI = 0, prevQ = 0;
+    for(size_t g = 0; g < 2 * n; g += BB60_COMPRESS_GROUP) {
+        const size_t len = std::min<size_t>(BB60_COMPRESS_GROUP, 2 * n - g);
+        const unsigned width = *in++;
+        const uint64_t mask = (1ull << width) - 1;
+
+        uint64_t acc = 0;
+        unsigned bits = 0;
+        for(size_t k = 0; k < BB60_COMPRESS_GROUP; k++) {
+            if(bits < width) {
+                uint32_t word;
+                std::memcpy(&word, in, sizeof(word));
+                in += sizeof(word);
+                acc |= (uint64_t)word << bits;
+                bits += 32;
+            }
+            zz[k] = (uint16_t)(acc & mask);
+            acc >>= width;
+            bits -= width;
+        }
+
+#if defined(__SSE2__)
+        // Undo the zigzag, then a running sum per rail: within a register by
+        // shifted adds, across registers from the last sample of the previous one
+        if(len == BB60_COMPRESS_GROUP) {
+            __m128i prev = _mm_set_epi16(prevQ, prevI, 0, 0, 0, 0, 0, 0);
+            const __m128i one = _mm_set1_epi16(1);
+            for(size_t k = 0; k < BB60_COMPRESS_GROUP; k += 8) {
+                const __m128i z = _mm_loadu_si128((const __m128i *)(zz + k));
+                __m128i x = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, one)));
+                x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+                x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+                x = _mm_add_epi16(x, _mm_shuffle_epi32(prev, 0xff));
+                _mm_storeu_si128((__m128i *)(out + g + k), x);
+                prev = x;
+            }
+            prevI = out[g + BB60_COMPRESS_GROUP - 2];
+            prevQ = out[g + BB60_COMPRESS_GROUP - 1];
+            continue;
+        }
+#endif
+
+        for(size_t k = 0; k < len; k++) {
+            const uint16_t z = zz[k];
+            const int16_t d = (int16_t)((z >> 1) ^ (uint16_t)-(int16_t)(z & 1));
+            if(k % 2 == 0) {
+                prevI = (int16_t)(prevI + d);
+                out[g + k] = prevI;
+            } else {
+                prevQ = (int16_t)(prevQ + d);
+                out[g + k] = prevQ;
+            }
+        }
+    }
+
+    return in - start;
+}
+
+/*******************************************************************
+ * Derived formats
+ ******************************************************************/
+
+// Power floor of the dB format, -200 dB instead of -inf for a zero sample
+#define BB60_DB_FLOOR 1e-20f
+
+/*!
+ * 10 log10(x) for positive x, to within 1e-5 dB. The exponent comes from
+ * the float bits, the mantissa m is brought into [sqrt(1/2), sqrt(2)) and
+ * ln(m) = 2 atanh(u), u = (m - 1) / (m + 1), from four terms of its series.
+ */
+inline float fastDb(const float x)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    float e = (float)((int)((bits >> 23) & 0xff) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+    if(m > (float)M_SQRT2) {
+        m *= 0.5f;
+        e += 1.0f;
+    }
+    const float u = (m - 1.0f) / (m + 1.0f);
+    const float u2 = u * u;
+    const float ln = 2.0f * u * (1.0f + u2 * (1.0f / 3 + u2 * (1.0f / 5 + u2 * (1.0f / 7))));
+    return 3.01029996f * e + 4.34294482f * ln;
+}
+
+/*!
+ * atan2(y, x) to about 1e-5 rad, an odd polynomial for atan on [0, 1]
+ * (Abramowitz and Stegun 4.4.49) unfolded to the other octants.
+ */
+inline float fastAtan2(const float y, const float x)
+{
+    const float ax = std::fabs(x), ay = std::fabs(y);
+    const float z = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+    const float z2 = z * z;
+    float a = z * (0.9998660f + z2 * (-0.3302995f + z2 * (0.1801410f + z2 * (-0.0851330f + z2 * 0.0208351f))));
+    if(ay > ax) a = (float)M_PI_2 - a;
+    if(x < 0.0f) a = (float)M_PI - a;
+    return (y < 0.0f) ? -a : a;
+}
+
+#if defined(__SSE2__)
+inline __m128 fastDb(const __m128 x)
+{
+    const __m128i bits = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)), _mm_set1_epi32(127)));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+    const __m128 high = _mm_cmpgt_ps(m, _mm_set1_ps((float)M_SQRT2));
+    m = _mm_sub_ps(m, _mm_and_ps(high, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+    e = _mm_add_ps(e, _mm_and_ps(high, _mm_set1_ps(1.0f)));
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 u = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    const __m128 u2 = _mm_mul_ps(u, u);
+    __m128 poly = _mm_add_ps(_mm_set1_ps(1.0f / 5), _mm_mul_ps(u2, _mm_set1_ps(1.0f / 7)));
+    poly = _mm_add_ps(_mm_set1_ps(1.0f / 3), _mm_mul_ps(u2, poly));
+    poly = _mm_add_ps(one, _mm_mul_ps(u2, poly));
+    const __m128 ln = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.0f), u), poly);
+    return _mm_add_ps(_mm_mul_ps(_mm_set1_ps(3.01029996f), e), _mm_mul_ps(_mm_set1_ps(4.34294482f), ln));
+}
+
+inline __m128 fastAtan2(const __m128 y, const __m128 x)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 ax = _mm_andnot_ps(sign, x);
+    const __m128 ay = _mm_andnot_ps(sign, y);
+    const __m128 z = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f)));
+    const __m128 z2 = _mm_mul_ps(z, z);
+    __m128 poly = _mm_add_ps(_mm_set1_ps(-0.0851330f), _mm_mul_ps(z2, _mm_set1_ps(0.0208351f)));
+    poly = _mm_add_ps(_mm_set1_ps(0.1801410f), _mm_mul_ps(z2, poly));
+    poly = _mm_add_ps(_mm_set1_ps(-0.3302995f), _mm_mul_ps(z2, poly));
+    poly = _mm_add_ps(_mm_set1_ps(0.9998660f), _mm_mul_ps(z2, poly));
+    __m128 a = _mm_mul_ps(z, poly);
+
+    // Same unfolding as the scalar version, by masks
+    const __m128 steep = _mm_cmpgt_ps(ay, ax);
+    a = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps((float)M_PI_2), a)), _mm_andnot_ps(steep, a));
+    const __m128 left = _mm_cmplt_ps(x, _mm_setzero_ps());
+    a = _mm_or_ps(_mm_and_ps(left, _mm_sub_ps(_mm_set1_ps((float)M_PI), a)), _mm_andnot_ps(left, a));
+    const __m128 below = _mm_cmplt_ps(y, _mm_setzero_ps());
+    return _mm_xor_ps(a, _mm_and_ps(below, sign));
+}
+#endif
+
+/*!
+ * Carried between conversions of one stream. F32_FREQ needs the sample
+ * before the first one converted and the rate, as Hz per radian.
+ */
+struct ConvertState {
+    std::complex<float> last;
+    bool hasLast = false;
+    float freqScale = 0.0f;
+};
+
+/*!
+ * One derived value per sample, in one pass over the CF32 input.
+ */
+inline void deriveSamples(const std::string &format, const std::complex<float> *in, float *out, const size_t n,
+        ConvertState &state)
+{
+    const float *src = (const float *)in;
+    const int kind = (format == BB60_FORMAT_POWER) ? 0 : (format == BB60_FORMAT_DB) ? 1 :
+        (format == BB60_FORMAT_MAG) ? 2 : (format == BB60_FORMAT_PHASE) ? 3 : 4;
+    size_t i = 0;
+
+    // The phase step of the first sample is taken from the previous conversion
+    if(kind == 4 and n > 0) {
+        const std::complex<float> last = state.hasLast ? state.last : in[0];
+        const float re = in[0].real() * last.real() + in[0].imag() * last.imag();
+        const float im = in[0].imag() * last.real() - in[0].real() * last.imag();
+        out[0] = fastAtan2(im, re) * state.freqScale;
+        i = 1;
+    }
+
+#if defined(__SSE2__)
+    const __m128 floorv = _mm_set1_ps(BB60_DB_FLOOR);
+    const __m128 scale = _mm_set1_ps(state.freqScale);
+    for(; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_loadu_ps(src + 2 * i);
+        const __m128 b = _mm_loadu_ps(src + 2 * i + 4);
+        const __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 v;
+        if(kind <= 2) {
+            v = _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+            if(kind == 1) v = fastDb(_mm_max_ps(v, floorv));
+            if(kind == 2) v = _mm_sqrt_ps(v);
+        } else if(kind == 3) {
+            v = fastAtan2(im, re);
+        } else {
+            // x[k] conj(x[k - 1]) turns the phase step into an angle
+            const __m128 pa = _mm_loadu_ps(src + 2 * i - 2);
+            const __m128 pb = _mm_loadu_ps(src + 2 * i + 2);
+            const __m128 pre = _mm_shuffle_ps(pa, pb, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 pim = _mm_shuffle_ps(pa, pb, _MM_SHUFFLE(3, 1, 3, 1));
+            const __m128 dre = _mm_add_ps(_mm_mul_ps(re, pre), _mm_mul_ps(im, pim));
+            const __m128 dim = _mm_sub_ps(_mm_mul_ps(im, pre), _mm_mul_ps(re, pim));
+            v = _mm_mul_ps(fastAtan2(dim, dre), scale);
+        }
+        _mm_storeu_ps(out + i, v);
+    }
+#endif
+
+    for(; i < n; i++) {
+        const float re = src[2 * i], im = src[2 * i + 1];
+        const float power = re * re + im * im;
+        if(kind == 0) out[i] = power;
+        else if(kind == 1) out[i] = fastDb(std::max(power, BB60_DB_FLOOR));
+        else if(kind == 2) out[i] = std::sqrt(power);
+        else if(kind == 3) out[i] = fastAtan2(im, re);
+        else {
+            const float pre = src[2 * i - 2], pim = src[2 * i - 1];
+            out[i] = fastAtan2(im * pre - re * pim, re * pre + im * pim) * state.freqScale;
+        }
+    }
+
+    if(n > 0) {
+        state.last = in[n - 1];
+        state.hasLast = true;
+    }
+}
+
+/*!
+ * Convert native CF32 samples to a stream format.
+ * Compressed streams are framed separately, see compressCS16.
+ * The derived formats need a state, which is carried from one call to the next.
+ */
+inline void convertSamples(const std::string &format, const std::complex<float> *in, void *out, const size_t n,
+        ConvertState *state = nullptr)
+{
+    if(format == SOAPY_SDR_CF32) {
+        std::memcpy(out, in, n * sizeof(std::complex<float>));
+        return;
+    }
+
+    if(format == SOAPY_SDR_CS16) {
+        toInt16(in, (int16_t *)out, n, 32767.0f);
+        return;
+    }
+
+    if(format == SOAPY_SDR_CS12) {
+        int16_t tmp[2 * 256];
+        uint8_t *dst = (uint8_t *)out;
+        for(size_t i = 0; i < n; i += 256) {
+            const size_t len = std::min<size_t>(256, n - i);
+            toInt16(in + i, tmp, len, 2047.0f);
+            packCS12(tmp, dst + 3 * i, len);
+        }
+        return;
+    }
+
+    // Real part only, the whole signal in direct RF mode
+    if(format == SOAPY_SDR_F32) {
+        float *dst = (float *)out;
+        for(size_t i = 0; i < n; i++) dst[i] = in[i].real();
+        return;
+    }
+
+    if(state != nullptr) {
+        deriveSamples(format, in, (float *)out, n, *state);
+    }
+}
+
+/*!
+ * Front end correction applied to every acquired block:
+ * y = (x - dc) + balance * conj(x - dc)
+ */
+struct IQCorrection {
+    float dcI = 0.0f, dcQ = 0.0f;
+    float balanceRe = 0.0f, balanceIm = 0.0f;
+};
+
+/*!
+ * Block statistics gathered by correctIQ for the automatic estimators.
+ * sumI/sumQ are over the uncorrected input, the rest over the output.
+ */
+struct IQStats {
+    double sumI = 0.0, sumQ = 0.0;
+    double sumII = 0.0, sumQQ = 0.0, sumIQ = 0.0;
+};
+
+/*!
+ * Correct DC offset and IQ imbalance in place and gather the statistics
+ * for the estimators in the same pass. When power is not null the mean
+ * power of every chunk of output samples is written to it, as chunkPower.
+ */
+inline void correctIQ(std::complex<float> *data, const size_t n, const IQCorrection &corr,
+        IQStats &stats, const size_t chunk, float *power)
+{
+    float *p = (float *)data;
+    const float k1 = 1.0f + corr.balanceRe;
+    const float k2 = 1.0f - corr.balanceRe;
+    const float q = corr.balanceIm;
+
+    for(size_t start = 0; start < n; start += chunk) {
+        const size_t len = std::min(chunk, n - start);
+        float *c = p + 2 * start;
+        size_t i = 0;
+        float sumI = 0.0f, sumQ = 0.0f, sumII = 0.0f, sumQQ = 0.0f, sumIQ = 0.0f;
+
+#if defined(__SSE2__)
+        // Two interleaved samples per register, swapping I and Q gives the cross terms
+        const __m128 dc = _mm_setr_ps(corr.dcI, corr.dcQ, corr.dcI, corr.dcQ);
+        const __m128 k = _mm_setr_ps(k1, k2, k1, k2);
+        const __m128 kq = _mm_set1_ps(q);
+        __m128 accIn = _mm_setzero_ps();
+        __m128 accSq = _mm_setzero_ps();
+        __m128 accX = _mm_setzero_ps();
+        for(; i + 2 <= len; i += 2) {
+            const __m128 x = _mm_loadu_ps(c + 2 * i);
+            accIn = _mm_add_ps(accIn, x);
+            const __m128 v = _mm_sub_ps(x, dc);
+            const __m128 sw = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+            const __m128 y = _mm_add_ps(_mm_mul_ps(v, k), _mm_mul_ps(sw, kq));
+            _mm_storeu_ps(c + 2 * i, y);
+            accSq = _mm_add_ps(accSq, _mm_mul_ps(y, y));
+            accX = _mm_add_ps(accX, _mm_mul_ps(y, _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1))));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, accIn);
+        sumI = lanes[0] + lanes[2];
+        sumQ = lanes[1] + lanes[3];
+        _mm_storeu_ps(lanes, accSq);
+        sumII = lanes[0] + lanes[2];
+        sumQQ = lanes[1] + lanes[3];
+        _mm_storeu_ps(lanes, accX);
+        sumIQ = lanes[0] + lanes[2];
+#endif
+
+        for(; i < len; i++) {
+            const float a = c[2 * i] - corr.dcI;
+            const float b = c[2 * i + 1] - corr.dcQ;
+            sumI += c[2 * i];
+            sumQ += c[2 * i + 1];
+            const float yI = a * k1 + b * q;
+            const float yQ = a * q + b * k2;
+            c[2 * i] = yI;
+            c[2 * i + 1] = yQ;
+            sumII += yI * yI;
+            sumQQ += yQ * yQ;
+            sumIQ += yI * yQ;
+        }
+
+        stats.sumI += sumI;
+        stats.sumQ += sumQ;
+        stats.sumII += sumII;
+        stats.sumQQ += sumQQ;
+        stats.sumIQ += sumIQ;
+        if(power != nullptr) {
+            *power++ = (sumII + sumQQ) / len;
+        }
+    }
+}
+
+/*!
+ * Mean power (I^2 + Q^2) of consecutive chunks of samples.
+ * out must hold (n + chunk - 1) / chunk entries, the last chunk may be short.
+ */
+inline void chunkPower(const std::complex<float> *in, const size_t n, const size_t chunk, float *out)
+{
+    const float *src = (const float *)in;
+
+    for(size_t start = 0; start < n; start += chunk) {
+        const size_t len = std::min(chunk, n - start);
+        const float *p = src + 2 * start;
+        size_t i = 0;
+        float sum = 0.0f;
+
+#if defined(__SSE2__)
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        for(; i + 4 <= len; i += 4) {
+            const __m128 a = _mm_loadu_ps(p + 2 * i);
+            const __m128 b = _mm_loadu_ps(p + 2 * i + 4);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+
+        for(; i < len; i++) {
+            sum += p[2 * i] * p[2 * i] + p[2 * i + 1] * p[2 * i + 1];
+        }
+
+        *out++ = sum / len;
+    }
+}
+
+/*!
+ * Peak and total |x|^2 of n samples, and how many reach clip.
+ * A clip of 0 or below counts nothing.
+ */
+inline void blockLevels(const std::complex<float> *in, const size_t n, const float clip,
+        float &peak, double &sum, size_t &clips)
+{
+    const float *src = (const float *)in;
+    const float limit = (clip > 0.0f) ? clip : INFINITY;
+    size_t i = 0;
+    float top = 0.0f;
+    float total = 0.0f;
+    size_t count = 0;
+
+#if defined(__SSE2__)
+    // Four samples per step, I^2 + Q^2 by adding the shuffled halves
+    const __m128 lim = _mm_set1_ps(limit);
+    __m128 accMax = _mm_setzero_ps();
+    __m128 accSum = _mm_setzero_ps();
+    __m128i accClip = _mm_setzero_si128();
+    for(; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_loadu_ps(src + 2 * i);
+        const __m128 b = _mm_loadu_ps(src + 2 * i + 4);
+        const __m128 aa = _mm_mul_ps(a, a);
+        const __m128 bb = _mm_mul_ps(b, b);
+        const __m128 p = _mm_add_ps(_mm_shuffle_ps(aa, bb, _MM_SHUFFLE(2, 0, 2, 0)),
+                                    _mm_shuffle_ps(aa, bb, _MM_SHUFFLE(3, 1, 3, 1)));
+        accMax = _mm_max_ps(accMax, p);
+        accSum = _mm_add_ps(accSum, p);
+        // Compare masks are -1 per clipped lane
+        accClip = _mm_sub_epi32(accClip, _mm_castps_si128(_mm_cmpge_ps(p, lim)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, accMax);
+    top = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, accSum);
+    total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    int32_t clipLanes[4];
+    _mm_storeu_si128((__m128i *)clipLanes, accClip);
+    count = (size_t)clipLanes[0] + clipLanes[1] + clipLanes[2] + clipLanes[3];
+#endif
+
+    for(; i < n; i++) {
+        const float p = src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1];
+        top = std::max(top, p);
+        total += p;
+        if(p >= limit) count++;
+    }
+
+    peak = std::max(peak, top);
+    sum += total;
+    clips += count;
+}
+
+/*******************************************************************
+ * Power statistics
+ ******************************************************************/
+
+// Histogram bins split each octave of power by the top float mantissa bits, 32 per octave or about 0.094 dB
+#define BB60_HISTOGRAM_SHIFT 18
+
+/*!
+ * Bin |x|^2 of n samples into a log power histogram without a log per sample.
+ * Bin i starts at the float whose bits are those of floor plus i << BB60_HISTOGRAM_SHIFT.
+ * Powers outside the histogram land in the first or last bin. Adds the power
+ * to sum and raises peak to the largest power seen.
+ */
+inline void powerHistogram(const std::complex<float> *in, const size_t n, const float floor,
+        uint32_t *hist, const size_t numBins, double &sum, float &peak)
+{
+    const float *src = (const float *)in;
+    uint32_t floorBits, topBits;
+    std::memcpy(&floorBits, &floor, sizeof(floor));
+    topBits = floorBits + (uint32_t(numBins - 1) << BB60_HISTOGRAM_SHIFT);
+    float top;
+    std::memcpy(&top, &topBits, sizeof(top));
+    size_t i = 0;
+    float total = 0.0f;
+    float high = peak;
+
+#if defined(__SSE2__)
+    const __m128 floorv = _mm_set1_ps(floor);
+    const __m128 topv = _mm_set1_ps(top);
+    const __m128i base = _mm_set1_epi32(floorBits);
+    __m128 acc = _mm_setzero_ps();
+    __m128 maxv = _mm_set1_ps(high);
+    uint32_t idx[4];
+    for(; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_loadu_ps(src + 2 * i);
+        const __m128 b = _mm_loadu_ps(src + 2 * i + 4);
+        const __m128 a2 = _mm_mul_ps(a, a);
+        const __m128 b2 = _mm_mul_ps(b, b);
+        const __m128 power = _mm_add_ps(_mm_shuffle_ps(a2, b2, _MM_SHUFFLE(2, 0, 2, 0)),
+            _mm_shuffle_ps(a2, b2, _MM_SHUFFLE(3, 1, 3, 1)));
+        acc = _mm_add_ps(acc, power);
+        maxv = _mm_max_ps(maxv, power);
+
+        // Positive floats order like their bits, so the clamped bits minus floor's give the bin
+        const __m128 clamped = _mm_min_ps(_mm_max_ps(power, floorv), topv);
+        _mm_storeu_si128((__m128i *)idx, _mm_srli_epi32(
+            _mm_sub_epi32(_mm_castps_si128(clamped), base), BB60_HISTOGRAM_SHIFT));
+        hist[idx[0]]++;
+        hist[idx[1]]++;
+        hist[idx[2]]++;
+        hist[idx[3]]++;
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_storeu_ps(lanes, maxv);
+    high = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+
+    for(; i < n; i++) {
+        const float power = src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1];
+        total += power;
+        high = std::max(high, power);
+
+        const float clamped = std::min(std::max(power, floor), top);
+        uint32_t bits;
+        std::memcpy(&bits, &clamped, sizeof(bits));
+        hist[(bits - floorBits) >> BB60_HISTOGRAM_SHIFT]++;
+    }
+
+    sum += total;
+    peak = high;
+}
+
+/*******************************************************************
+ * Direct RF
+ ******************************************************************/
+
+/*!
+ * Widen real samples to complex with a zero imaginary part.
+ * in may alias the first n floats of out.
+ */
+inline void realToComplex(const float *in, std::complex<float> *out, const size_t n)
+{
+    for(size_t i = n; i-- > 0;) {
+        out[i] = std::complex<float>(in[i], 0.0f);
+    }
+}
+
+/*!
+ * Real samples at fs to complex baseband at fs/2, centered on fs/4.
+ * Mixing by -fs/4 only flips signs, and the halfband low pass then
+ * needs just its even taps for I while Q passes through the center
+ * tap as a pure delay. Gain is 2, so a real tone of amplitude A comes
+ * out as a complex tone of amplitude A.
+ */
+struct QuarterRateDecimator {
+    std::vector<float> taps;            // the even taps of the halfband filter
+    std::vector<float> even, odd;       // mixed inputs, filter history first
+    bool flip = false;                  // sign of the next even input
+
+    //! numTaps (a multiple of 2) even taps of a 2 * numTaps - 1 tap Blackman windowed halfband
+    void design(const size_t numTaps)
+    {
+        const size_t length = 2 * numTaps - 1;
+        const double center = numTaps - 1.0;
+        double sum = 0.0;
+
+        taps.resize(numTaps);
+        for(size_t j = 0; j < numTaps; j++) {
+            const double k = 2.0 * j;
+            const double x = (k - center) / 2.0;
+            const double w = 0.42 - 0.5 * std::cos(2 * M_PI * k / (length - 1))
+                + 0.08 * std::cos(4 * M_PI * k / (length - 1));
+            taps[j] = (float)(std::sin(M_PI * x) / (M_PI * x) * w);
+            sum += taps[j];
+        }
+        for(auto &tap : taps) tap = (float)(tap / sum);
+
+        reset();
+    }
+
+    void reset(void)
+    {
+        even.assign(taps.size() - 1, 0.0f);
+        odd.assign(taps.size() / 2, 0.0f);
+        flip = false;
+    }
+
+    //! Filter delay in input samples
+    size_t delay(void) const
+    {
+        return taps.size() - 1;
+    }
+
+    //! n real inputs, n even, to n / 2 complex outputs
+    void process(const float *in, const size_t n, std::complex<float> *out)
+    {
+        const size_t m = n / 2;
+        const size_t history = taps.size() - 1;
+        const size_t lag = odd.size();
+
+        even.resize(history + m);
+        odd.resize(lag + m);
+        for(size_t p = 0; p < m; p++) {
+            const float sign = (flip != ((p & 1) != 0)) ? -1.0f : 1.0f;
+            even[history + p] = sign * in[2 * p];
+            odd[lag + p] = -sign * in[2 * p + 1];
+        }
+        if(m & 1) flip = not flip;
+
+        float *dst = (float *)out;
+        const float *e = even.data() + history;
+        size_t i = 0;
+
+#if defined(__SSE2__)
+        for(; i + 4 <= m; i += 4) {
+            __m128 acc = _mm_setzero_ps();
+            for(size_t j = 0; j < taps.size(); j++) {
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps[j]), _mm_loadu_ps(e + i - j)));
+            }
+            const __m128 q = _mm_loadu_ps(odd.data() + i);
+            _mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(acc, q));
+            _mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(acc, q));
+        }
+#endif
+
+        for(; i < m; i++) {
+            float acc = 0.0f;
+            for(size_t j = 0; j < taps.size(); j++) {
+                acc += taps[j] * e[(long)i - (long)j];
+            }
+            dst[2 * i] = acc;
+            dst[2 * i + 1] = odd[i];
+        }
+
+        // Keep the newest inputs as history for the next call
+        std::copy(even.end() - history, even.end(), even.begin());
+        even.resize(history);
+        std::copy(odd.end() - lag, odd.end(), odd.begin());
+        odd.resize(lag);
+    }
+};
+
+}
@@ -0,0 +1,251 @@
+#include "Network.hpp"
+#include "Kernels.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace SoapyBB60Net {
+
+Url parseUrl(const std::string &url)
+{
+    Url u;
+
+    const size_t sep = url.find("://");
+    if(sep == std::string::npos) {
+        throw std::runtime_error("Invalid URL '" + url + "', expected tcp://host:port or udp://host:port");
+    }
+    u.scheme = url.substr(0, sep);
+    if(u.scheme != "tcp" and u.scheme != "udp") {
+        throw std::runtime_error("Invalid URL scheme '" + u.scheme + "', expected tcp or udp");
+    }
+
+    // [v6 address]:port or host:port
+    const std::string rest = url.substr(sep + 3);
+    const size_t colon = rest.rfind(':');
+    if(colon == std::string::npos or colon + 1 == rest.size()) {
+        throw std::runtime_error("Invalid URL '" + url + "', missing port");
+    }
+    u.host = rest.substr(0, colon);
+    u.port = rest.substr(colon + 1);
+    if(u.host.size() >= 2 and u.host.front() == '[' and u.host.back() == ']') {
+        u.host = u.host.substr(1, u.host.size() - 2);
+    }
+
+    return u;
+}
+
+std::vector<std::string> formats(void)
+{
+    return {SOAPY_SDR_CF32, SOAPY_SDR_CS16, SOAPY_SDR_CS12, BB60_FORMAT_CS16Z};
+}
+
+int formatCode(const std::string &format)
+{
+    const std::vector<std::string> all = formats();
+    for(size_t i = 0; i < all.size(); i++) {
+        if(all[i] == format) return (int)i;
+    }
+    return -1;
+}
+
+std::string formatName(const int code)
+{
+    const std::vector<std::string> all = formats();
+    return (code >= 0 and code < (int)all.size()) ? all[code] : "";
+}
+
+std::vector<std::string> split(const std::string &s, const char sep)
+{
+    std::vector<std::string> parts;
+    std::string part;
+    std::istringstream stream(s);
+
+    while(std::getline(stream, part, sep)) {
+        parts.push_back(part);
+    }
+
+    return parts;
+}
+
+std::string join(const std::vector<std::string> &parts, const char sep)
+{
+    std::string s;
+
+    for(size_t i = 0; i < parts.size(); i++) {
+        if(i != 0) s += sep;
+        s += parts[i];
+    }
+
+    return s;
+}
+
+std::string toString(const double value)
+{
+    std::ostringstream stream;
+    stream.precision(17);
+    stream << value;
+    return stream.str();
+}
+
+void fillHeader(SoapyBB60NetHeader &hdr, const int type, const size_t length)
+{
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BB60_NET_MAGIC;
+    hdr.version = BB60_NET_VERSION;
+    hdr.type = (uint8_t)type;
+    hdr.length = (uint32_t)length;
+}
+
+/*******************************************************************
+ * Sockets
+ ******************************************************************/
+
+static addrinfo *resolve(const Url &url, const bool passive)
+{
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = (url.scheme == "udp") ? SOCK_DGRAM : SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    addrinfo *res = nullptr;
+    const int ret = getaddrinfo(url.host.empty() ? nullptr : url.host.c_str(), url.port.c_str(), &hints, &res);
+    if(ret != 0) {
+        throw std::runtime_error("Unable to resolve " + url.host + ":" + url.port + ": " + gai_strerror(ret));
+    }
+
+    return res;
+}
+
+int listenTcp(const Url &url)
+{
+    addrinfo *res = resolve(url, true);
+
+    const int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    const int one = 1;
+    if(fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if(fd < 0 or bind(fd, res->ai_addr, res->ai_addrlen) != 0 or listen(fd, 4) != 0) {
+        const std::string err = std::strerror(errno);
+        if(fd >= 0) close(fd);
+        freeaddrinfo(res);
+        throw std::runtime_error("Unable to listen on " + url.host + ":" + url.port + ": " + err);
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+int connectTcp(const Url &url)
+{
+    addrinfo *res = resolve(url, false);
+
+    const int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if(fd < 0 or connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        const std::string err = std::strerror(errno);
+        if(fd >= 0) close(fd);
+        freeaddrinfo(res);
+        throw std::runtime_error("Unable to connect to " + url.host + ":" + url.port + ": " + err);
+    }
+    freeaddrinfo(res);
+
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+
+int openUdp(const Url &url, const bool bindLocal, sockaddr_storage &addr, socklen_t &addrLen)
+{
+    addrinfo *res = resolve(url, bindLocal);
+
+    const int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    std::memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    addrLen = res->ai_addrlen;
+
+    // Deep socket buffers absorb scheduling jitter at full rate
+    const int size = 32 << 20;
+    if(fd >= 0) setsockopt(fd, SOL_SOCKET, bindLocal ? SO_RCVBUF : SO_SNDBUF, &size, sizeof(size));
+
+    if(fd < 0 or (bindLocal and bind(fd, res->ai_addr, res->ai_addrlen) != 0)) {
+        const std::string err = std::strerror(errno);
+        if(fd >= 0) close(fd);
+        freeaddrinfo(res);
+        throw std::runtime_error("Unable to open UDP " + url.host + ":" + url.port + ": " + err);
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+bool waitReadable(const int fd, const long timeoutUs)
+{
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return poll(&pfd, 1, (int)((timeoutUs + 999) / 1000)) > 0;
+}
+
+bool sendAll(const int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+
+    while(len != 0) {
+        const ssize_t ret = send(fd, p, len, MSG_NOSIGNAL);
+        if(ret < 0 and errno == EINTR) continue;
+        if(ret <= 0) return false;
+        p += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+bool recvAll(const int fd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+
+    while(len != 0) {
+        const ssize_t ret = recv(fd, p, len, MSG_WAITALL);
+        if(ret < 0 and errno == EINTR) continue;
+        if(ret <= 0) return false;
+        p += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+bool sendMessage(const int fd, const int type, const std::string &payload)
+{
+    SoapyBB60NetHeader hdr;
+    fillHeader(hdr, type, payload.size());
+
+    return sendAll(fd, &hdr, sizeof(hdr)) and sendAll(fd, payload.data(), payload.size());
+}
+
+bool recvMessage(const int fd, SoapyBB60NetHeader &hdr, std::string &payload)
+{
+    if(not recvAll(fd, &hdr, sizeof(hdr))) return false;
+    if(hdr.magic != BB60_NET_MAGIC or hdr.version != BB60_NET_VERSION) return false;
+
+    // The length comes from the peer, never allocate more than a legal message
+    if(hdr.length > ((hdr.type == BB60_NET_DATA) ? BB60_NET_DATA_MAX : BB60_NET_CONTROL_MAX)) return false;
+
+    payload.resize(hdr.length);
+    return recvAll(fd, &payload[0], hdr.length);
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+/*******************************************************************
+ * IQ network protocol
+ *
+ * Every message is a SoapyBB60NetHeader followed by length payload bytes.
+ * TCP uses two connections per session: a control connection
+ * (text commands, tab separated, answered by REPLY messages) and a
+ * data connection carrying only DATA messages. UDP carries DATA only.
+ ******************************************************************/
+
+#define BB60_NET_MAGIC 0x30364242 // "BB60"
+#define BB60_NET_VERSION 1
+#define BB60_NET_UDP_MAX 65000    // header + payload per datagram
+#define BB60_NET_BATCH 8          // packets per sendmsg/sendmmsg
+#define BB60_NET_CONTROL_MAX (1 << 20) // payload bytes of a control or reply message
+#define BB60_NET_DATA_MAX (16 << 20)   // payload bytes of a TCP data message
+#define BB60_NET_HANDSHAKE_MS 1000     // a new connection must send hello or attach within this time
+
+enum SoapyBB60NetType {
+    BB60_NET_DATA = 0,
+    BB60_NET_CONTROL = 1,
+    BB60_NET_REPLY = 2
+};
+
+struct SoapyBB60NetHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;       // SoapyBB60NetType
+    uint8_t format;     // index into SoapyBB60Net::formats()
+    uint8_t reserved;
+    int32_t flags;      // SoapySDR stream flags
+    int32_t elems;      // elements in the payload, or a SoapySDR error code
+    uint32_t length;    // payload bytes
+    uint64_t seq;       // per stream packet sequence number
+    int64_t timeNs;
+} __attribute__((packed));
+
+namespace SoapyBB60Net {
+
+struct Url {
+    std::string scheme; // "tcp" or "udp"
+    std::string host;
+    std::string port;
+};
+
+Url parseUrl(const std::string &url);
+
+std::vector<std::string> formats(void);
+
+int formatCode(const std::string &format);
+
+std::string formatName(const int code);
+
+std::vector<std::string> split(const std::string &s, const char sep);
+
+std::string join(const std::vector<std::string> &parts, const char sep);
+
+std::string toString(const double value);
+
+void fillHeader(SoapyBB60NetHeader &hdr, const int type, const size_t length);
+
+int listenTcp(const Url &url);
+
+int connectTcp(const Url &url);
+
+int openUdp(const Url &url, const bool bind, sockaddr_storage &addr, socklen_t &addrLen);
+
+bool waitReadable(const int fd, const long timeoutUs);
+
+bool sendAll(const int fd, const void *buf, size_t len);
+
+bool recvAll(const int fd, void *buf, size_t len);
+
+bool sendMessage(const int fd, const int type, const std::string &payload);
+
+bool recvMessage(const int fd, SoapyBB60NetHeader &hdr, std::string &payload);
+
+}
@@ -0,0 +1,258 @@
+#include "SoapyBB60.hpp"
+#include "OccupancyFile.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BB60_OCC_DATA_OFFSET 4096
+#define BB60_OCC_GROW_BYTES (16 << 20) // the files grow by about this much at a time
+
+static_assert(sizeof(SoapyBB60OccupancyHeader) <= BB60_OCC_DATA_OFFSET, "Occupancy header does not fit its page");
+
+static size_t recordSize(const size_t numBins)
+{
+    return sizeof(SoapyBB60OccupancyRecord) + numBins * sizeof(SoapyBB60OccupancyBin);
+}
+
+static void unmapOccupancy(SoapyBB60Occupancy *o, const size_t recSize)
+{
+    if(o->header != nullptr) munmap(o->header, BB60_OCC_DATA_OFFSET + o->capacity * recSize);
+    if(o->index != nullptr) munmap(o->index, o->capacity * sizeof(int64_t));
+    o->header = nullptr;
+    o->data = nullptr;
+    o->index = nullptr;
+}
+
+// Size both files for capacity records and map them, errno is set on failure
+static bool mapOccupancy(SoapyBB60Occupancy *o, const size_t recSize, const size_t capacity)
+{
+    unmapOccupancy(o, recSize);
+    o->capacity = 0;
+
+    const size_t dataSize = BB60_OCC_DATA_OFFSET + capacity * recSize;
+    const size_t indexSize = capacity * sizeof(int64_t);
+    if(ftruncate(o->fd, dataSize) != 0 or ftruncate(o->indexFd, indexSize) != 0) {
+        return false;
+    }
+
+    void *data = mmap(nullptr, dataSize, PROT_READ | PROT_WRITE, MAP_SHARED, o->fd, 0);
+    if(data == MAP_FAILED) {
+        return false;
+    }
+    void *index = mmap(nullptr, indexSize, PROT_READ | PROT_WRITE, MAP_SHARED, o->indexFd, 0);
+    if(index == MAP_FAILED) {
+        const int err = errno;
+        munmap(data, dataSize);
+        errno = err;
+        return false;
+    }
+
+    o->header = (SoapyBB60OccupancyHeader *)data;
+    o->data = (char *)data + BB60_OCC_DATA_OFFSET;
+    o->index = (int64_t *)index;
+    o->capacity = capacity;
+    return true;
+}
+
+static void resetBucket(SoapyBB60Occupancy *o, const size_t numBins)
+{
+    o->scans = 0;
+    o->min.assign(numBins, std::numeric_limits<float>::max());
+    o->max.assign(numBins, -std::numeric_limits<float>::max());
+    o->sum.assign(numBins, 0.0);
+    o->above.assign(numBins, 0);
+}
+
+static int16_t toFixed(const double db)
+{
+    return (int16_t)std::lround(std::min(std::max(db * BB60_OCC_DB_SCALE, -32767.0), 32767.0));
+}
+
+/*******************************************************************
+ * Log setup on the panorama stream
+ ******************************************************************/
+
+void SoapyBB60::setupOccupancy(SoapyBB60Panorama *p, const SoapySDR::Kwargs &args)
+{
+    std::unique_ptr<SoapyBB60Occupancy> o(new SoapyBB60Occupancy);
+
+    o->path = args.at("occ_file");
+    try {
+        if(args.count("occ_bucket") != 0) o->bucketNs = std::llround(std::stod(args.at("occ_bucket")) * 1e9);
+        if(args.count("occ_threshold") != 0) o->threshold = std::stof(args.at("occ_threshold"));
+    } catch (const std::exception &) {
+        throw std::runtime_error("setupStream: occ_bucket and occ_threshold must be numbers");
+    }
+    if(o->bucketNs < 1000000) {
+        throw std::runtime_error("setupStream: occ_bucket must be at least 1 ms");
+    }
+
+    const std::string indexPath = o->path + ".idx";
+    o->fd = open(o->path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(o->fd >= 0) o->indexFd = open(indexPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if(o->fd < 0 or o->indexFd < 0) {
+        const std::string err = std::strerror(errno);
+        if(o->fd >= 0) close(o->fd);
+        throw std::runtime_error("setupStream: unable to open occupancy log " + o->path + ": " + err);
+    }
+
+    const size_t recSize = recordSize(p->numBins);
+    const size_t growRecords = std::max<size_t>(1, BB60_OCC_GROW_BYTES / recSize);
+
+    // Appending to a log only makes sense with the same span, bucket and threshold
+    struct stat st, indexSt;
+    std::string error;
+    size_t numRecords = 0, fileRecords = 0;
+    if(flock(o->fd, LOCK_EX | LOCK_NB) != 0) {
+        error = "is in use by another stream";
+    } else if(fstat(o->fd, &st) != 0 or fstat(o->indexFd, &indexSt) != 0) {
+        error = std::strerror(errno);
+    } else if(st.st_size != 0) {
+        SoapyBB60OccupancyHeader h;
+        if(pread(o->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) or h.magic != BB60_OCC_MAGIC
+                or h.version != BB60_OCC_VERSION or h.dataOffset != BB60_OCC_DATA_OFFSET) {
+            error = "is not an occupancy log";
+        } else if(h.numBins != p->numBins or h.recordSize != recSize or h.startHz != p->start or h.binHz != p->binHz
+                or h.bucketNs != o->bucketNs or (float)h.threshold != o->threshold) {
+            error = "was written with a different span, bin width, bucket or threshold";
+        } else {
+            numRecords = h.numRecords.load();
+            fileRecords = (st.st_size - BB60_OCC_DATA_OFFSET) / recSize;
+            if(numRecords > fileRecords) error = "is truncated";
+        }
+    }
+
+    if(error.empty() and not mapOccupancy(o.get(), recSize, std::max(fileRecords, numRecords + growRecords))) {
+        error = std::strerror(errno);
+    }
+    if(not error.empty()) {
+        unmapOccupancy(o.get(), recSize);
+        close(o->fd);
+        close(o->indexFd);
+        throw std::runtime_error("setupStream: occupancy log " + o->path + " " + error);
+    }
+
+    if(st.st_size == 0) {
+        SoapyBB60OccupancyHeader *h = o->header;
+        h->magic = BB60_OCC_MAGIC;
+        h->version = BB60_OCC_VERSION;
+        h->numBins = p->numBins;
+        h->recordSize = recSize;
+        h->dataOffset = BB60_OCC_DATA_OFFSET;
+        h->startHz = p->start;
+        h->binHz = p->binHz;
+        h->bucketNs = o->bucketNs;
+        h->threshold = o->threshold;
+        h->numRecords.store(0, std::memory_order_release);
+    } else if((size_t)indexSt.st_size < numRecords * sizeof(int64_t)) {
+        // The index only repeats the record times, so it can always be rebuilt
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Occupancy log %s: rebuilding the index", o->path.c_str());
+        for(size_t i = 0; i < numRecords; i++) {
+            o->index[i] = ((const SoapyBB60OccupancyRecord *)(o->data + i * recSize))->startNs;
+        }
+    }
+
+    resetBucket(o.get(), p->numBins);
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Occupancy log %s: %zu bins, %.3f s buckets, %zu records",
+            o->path.c_str(), p->numBins, o->bucketNs / 1e9, numRecords);
+
+    p->occupancy = std::move(o);
+}
+
+void SoapyBB60::closeOccupancy(SoapyBB60Panorama *p)
+{
+    SoapyBB60Occupancy *o = p->occupancy.get();
+
+    // Trim the spare room so the files end with the last record
+    const size_t recSize = o->header->recordSize;
+    const size_t numRecords = o->header->numRecords.load();
+    unmapOccupancy(o, recSize);
+    if(ftruncate(o->fd, BB60_OCC_DATA_OFFSET + numRecords * recSize) != 0
+            or ftruncate(o->indexFd, numRecords * sizeof(int64_t)) != 0) {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Occupancy log %s: %s", o->path.c_str(), std::strerror(errno));
+    }
+    close(o->fd);
+    close(o->indexFd);
+
+    p->occupancy.reset();
+}
+
+/*******************************************************************
+ * Reduction on the panorama FFT worker
+ ******************************************************************/
+
+void SoapyBB60::reduceOccupancy(SoapyBB60Panorama *p, const long long startNs)
+{
+    SoapyBB60Occupancy *o = p->occupancy.get();
+
+    // Buckets are aligned to the clock, so logs of different devices line up
+    const long long bucketStartNs = startNs - startNs % o->bucketNs;
+    if(o->scans != 0 and bucketStartNs != o->bucketStartNs) {
+        flushOccupancy(p);
+        o->partial = false;
+    }
+    if(o->scans == 0) {
+        o->bucketStartNs = bucketStartNs;
+        o->firstNs = startNs;
+    }
+
+    const float *x = p->building.data();
+    const float threshold = o->threshold;
+    for(size_t i = 0; i < p->numBins; i++) {
+        o->min[i] = std::min(o->min[i], x[i]);
+        o->max[i] = std::max(o->max[i], x[i]);
+        o->sum[i] += std::exp(x[i] * (float)(M_LN10 / 10.0));
+        o->above[i] += (x[i] > threshold);
+    }
+    o->lastNs = startNs;
+    o->scans++;
+}
+
+void SoapyBB60::flushOccupancy(SoapyBB60Panorama *p)
+{
+    SoapyBB60Occupancy *o = p->occupancy.get();
+    if(o->scans == 0) {
+        return;
+    }
+
+    const size_t recSize = o->header->recordSize;
+    const size_t n = o->header->numRecords.load(std::memory_order_relaxed);
+
+    // The index must stay sorted for the range search
+    if(n != 0 and o->bucketStartNs < o->index[n - 1]) {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Occupancy log %s: the clock went back, bucket at %lld ns dropped",
+                o->path.c_str(), o->bucketStartNs);
+    } else if(n == o->capacity and not mapOccupancy(o, recSize, o->capacity + std::max<size_t>(1, BB60_OCC_GROW_BYTES / recSize))) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Occupancy log %s: %s, bucket at %lld ns dropped",
+                o->path.c_str(), std::strerror(errno), o->bucketStartNs);
+    } else {
+        SoapyBB60OccupancyRecord *rec = (SoapyBB60OccupancyRecord *)(o->data + n * recSize);
+        rec->startNs = o->bucketStartNs;
+        rec->firstNs = o->firstNs;
+        rec->lastNs = o->lastNs;
+        rec->scans = o->scans;
+        rec->flags = o->partial ? BB60_OCC_PARTIAL : 0;
+
+        SoapyBB60OccupancyBin *bins = (SoapyBB60OccupancyBin *)(rec + 1);
+        for(size_t i = 0; i < p->numBins; i++) {
+            bins[i].min = toFixed(o->min[i]);
+            bins[i].max = toFixed(o->max[i]);
+            bins[i].mean = toFixed(10.0 * std::log10(o->sum[i] / o->scans + 1e-20));
+            bins[i].duty = (uint16_t)std::lround(o->above[i] * BB60_OCC_DUTY_SCALE / o->scans);
+        }
+        o->index[n] = o->bucketStartNs;
+
+        // Readers only look at records below numRecords
+        o->header->numRecords.store(n + 1, std::memory_order_release);
+    }
+
+    resetBucket(o, p->numBins);
+}
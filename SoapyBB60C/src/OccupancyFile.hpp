@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*******************************************************************
+ * Occupancy log layout
+ *
+ * A data file made of this header, padded to dataOffset, followed by
+ * fixed size records: a SoapyBB60OccupancyRecord and numBins
+ * SoapyBB60OccupancyBin entries, one per panorama bin. Each record
+ * reduces every scan that started in one bucket of bucketNs.
+ *
+ * Beside it, <file>.idx holds the startNs of every record as int64, so
+ * a time range is found with a binary search over a few pages.
+ *
+ * The writer fills a record and its index entry before it bumps
+ * numRecords, so anything below numRecords is complete.
+ ******************************************************************/
+
+#define BB60_OCC_MAGIC 0x4f434242 // "BBCO"
+#define BB60_OCC_VERSION 1
+#define BB60_OCC_PARTIAL 1        // record flag, the logger did not see the whole bucket
+#define BB60_OCC_DB_SCALE 100.0f  // levels are stored in 0.01 dB
+#define BB60_OCC_DUTY_SCALE 65535.0f
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Occupancy log needs lock-free atomics");
+
+struct SoapyBB60OccupancyHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numBins;
+    uint32_t recordSize;               // bytes per record
+    uint64_t dataOffset;               // bytes from the start of the file to the first record
+    double startHz;                    // frequency of bin 0
+    double binHz;
+    int64_t bucketNs;
+    double threshold;                  // dBm, level counted as occupied
+    std::atomic<uint64_t> numRecords;
+};
+
+struct SoapyBB60OccupancyRecord {
+    int64_t startNs;                   // bucket start, a multiple of bucketNs
+    int64_t firstNs;                   // start of the first scan in the bucket
+    int64_t lastNs;                    // start of the last scan in the bucket
+    uint32_t scans;
+    uint32_t flags;
+};
+
+struct SoapyBB60OccupancyBin {
+    int16_t min;                       // dBm * BB60_OCC_DB_SCALE
+    int16_t max;
+    int16_t mean;                      // of the power in mW, then in dBm
+    uint16_t duty;                     // scans above threshold, out of BB60_OCC_DUTY_SCALE
+};
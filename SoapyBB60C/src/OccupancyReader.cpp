@@ -0,0 +1,215 @@
+#include "SoapyBB60Occupancy.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SoapyBB60OccupancyReader::SoapyBB60OccupancyReader(const std::string &path)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("Unable to open occupancy log " + path + ": " + std::strerror(errno));
+    }
+
+    // Without the index the records are searched directly
+    indexFd = open((path + ".idx").c_str(), O_RDONLY);
+
+    if(not map()) {
+        const std::string err = std::strerror(errno);
+        close(fd);
+        if(indexFd >= 0) close(indexFd);
+        throw std::runtime_error("Unable to map occupancy log " + path + ": " + err);
+    }
+
+    if(dataSize < sizeof(SoapyBB60OccupancyHeader) or header->magic != BB60_OCC_MAGIC
+            or header->version != BB60_OCC_VERSION or header->recordSize != sizeof(SoapyBB60OccupancyRecord)
+                + header->numBins * sizeof(SoapyBB60OccupancyBin)) {
+        munmap(data, dataSize);
+        if(index != nullptr) munmap((void *)index, indexSize);
+        close(fd);
+        if(indexFd >= 0) close(indexFd);
+        throw std::runtime_error(path + " is not a BB60 occupancy log");
+    }
+
+    // Levels are 16 bit, so every power the mean needs is a table lookup
+    power.resize(65536);
+    for(size_t i = 0; i < power.size(); i++) {
+        power[i] = (float)std::pow(10.0, (int16_t)i / BB60_OCC_DB_SCALE / 10.0);
+    }
+
+    refresh();
+}
+
+SoapyBB60OccupancyReader::~SoapyBB60OccupancyReader(void)
+{
+    munmap(data, dataSize);
+    if(index != nullptr) munmap((void *)index, indexSize);
+    close(fd);
+    if(indexFd >= 0) close(indexFd);
+}
+
+bool SoapyBB60OccupancyReader::map(void)
+{
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        return false;
+    }
+    void *nextData = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(nextData == MAP_FAILED) {
+        return false;
+    }
+    if(data != nullptr) munmap(data, dataSize);
+    data = nextData;
+    dataSize = st.st_size;
+    header = (const SoapyBB60OccupancyHeader *)data;
+
+    if(index != nullptr) munmap((void *)index, indexSize);
+    index = nullptr;
+    indexSize = 0;
+    if(indexFd >= 0 and fstat(indexFd, &st) == 0 and st.st_size != 0) {
+        void *nextIndex = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, indexFd, 0);
+        if(nextIndex != MAP_FAILED) {
+            index = (const int64_t *)nextIndex;
+            indexSize = st.st_size;
+        }
+    }
+
+    return true;
+}
+
+size_t SoapyBB60OccupancyReader::refresh(void)
+{
+    const size_t n = header->numRecords.load(std::memory_order_acquire);
+
+    // The writer grows the files ahead of the records, map again once they pass the mapping
+    const size_t mapped = (dataSize - header->dataOffset) / header->recordSize;
+    if(n > mapped or (indexFd >= 0 and n * sizeof(int64_t) > indexSize)) {
+        map();
+    }
+    numRecords = std::min<size_t>(n, (dataSize - header->dataOffset) / header->recordSize);
+
+    return numRecords;
+}
+
+size_t SoapyBB60OccupancyReader::getNumRecords(void) const
+{
+    return numRecords;
+}
+
+size_t SoapyBB60OccupancyReader::getNumBins(void) const
+{
+    return header->numBins;
+}
+
+double SoapyBB60OccupancyReader::getStartFrequency(void) const
+{
+    return header->startHz;
+}
+
+double SoapyBB60OccupancyReader::getBinWidth(void) const
+{
+    return header->binHz;
+}
+
+long long SoapyBB60OccupancyReader::getBucketNs(void) const
+{
+    return header->bucketNs;
+}
+
+double SoapyBB60OccupancyReader::getThreshold(void) const
+{
+    return header->threshold;
+}
+
+const SoapyBB60OccupancyRecord &SoapyBB60OccupancyReader::getRecord(const size_t i) const
+{
+    return *(const SoapyBB60OccupancyRecord *)((const char *)data + header->dataOffset + i * header->recordSize);
+}
+
+long long SoapyBB60OccupancyReader::startOf(const size_t i) const
+{
+    return ((i + 1) * sizeof(int64_t) <= indexSize) ? index[i] : getRecord(i).startNs;
+}
+
+size_t SoapyBB60OccupancyReader::find(const long long timeNs) const
+{
+    size_t lo = 0, hi = numRecords;
+    while(lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if(startOf(mid) < timeNs) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool SoapyBB60OccupancyReader::queryRecords(
+        const size_t first,
+        const size_t last,
+        const size_t firstBin,
+        const size_t numBins,
+        SoapyBB60OccupancySpan &span) const
+{
+    const size_t stop = std::min(last, numRecords);
+    const size_t bins = (firstBin < header->numBins) ? std::min(numBins, header->numBins - firstBin) : 0;
+
+    span = SoapyBB60OccupancySpan();
+    if(first >= stop or bins == 0) {
+        return false;
+    }
+
+    std::vector<int> min(bins, std::numeric_limits<int>::max());
+    std::vector<int> max(bins, std::numeric_limits<int>::min());
+    std::vector<double> sum(bins, 0.0);
+    std::vector<double> duty(bins, 0.0);
+
+    for(size_t r = first; r < stop; r++) {
+        const SoapyBB60OccupancyRecord &rec = getRecord(r);
+        const SoapyBB60OccupancyBin *b = (const SoapyBB60OccupancyBin *)(&rec + 1) + firstBin;
+        const double scans = rec.scans;
+        for(size_t i = 0; i < bins; i++) {
+            min[i] = std::min<int>(min[i], b[i].min);
+            max[i] = std::max<int>(max[i], b[i].max);
+            sum[i] += scans * power[(uint16_t)b[i].mean];
+            duty[i] += scans * b[i].duty;
+        }
+        span.scans += rec.scans;
+    }
+
+    span.startNs = getRecord(first).startNs;
+    span.stopNs = getRecord(stop - 1).startNs + header->bucketNs;
+    span.numRecords = stop - first;
+    span.min.resize(bins);
+    span.max.resize(bins);
+    span.mean.resize(bins);
+    span.duty.resize(bins);
+    const double scans = std::max<double>(span.scans, 1.0);
+    for(size_t i = 0; i < bins; i++) {
+        span.min[i] = min[i] / BB60_OCC_DB_SCALE;
+        span.max[i] = max[i] / BB60_OCC_DB_SCALE;
+        span.mean[i] = (float)(10.0 * std::log10(sum[i] / scans + 1e-20));
+        span.duty[i] = (float)(duty[i] / BB60_OCC_DUTY_SCALE / scans);
+    }
+
+    return true;
+}
+
+bool SoapyBB60OccupancyReader::query(
+        const long long startNs,
+        const long long stopNs,
+        const size_t firstBin,
+        const size_t numBins,
+        SoapyBB60OccupancySpan &span) const
+{
+    return queryRecords(find(startNs), find(stopNs), firstBin, numBins, span);
+}
@@ -0,0 +1,265 @@
+#include "SoapyBB60.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <chrono>
+#include <cmath>
+
+// Steps in flight between the capture thread and the FFT worker
+#define BB60_PANORAMA_STEPS 3
+
+void SoapyBB60::setupPanorama(SoapyBB60Stream *s, const SoapySDR::Kwargs &args)
+{
+    std::unique_ptr<SoapyBB60Panorama> p(new SoapyBB60Panorama);
+
+    try {
+        p->start = std::stod(args.at("pano_start"));
+        p->stop = std::stod(args.at("pano_stop"));
+        if(args.count("pano_fft") != 0) p->fftSize = std::stoul(args.at("pano_fft"));
+    } catch (const std::exception &) {
+        throw std::runtime_error("setupStream: pano_start, pano_stop and pano_fft must be numbers");
+    }
+
+    if(p->stop <= p->start or p->start < BB60_MIN_FREQ or p->stop > BB60_MAX_FREQ) {
+        throw std::runtime_error("setupStream: panorama span must be within the BB60 frequency range");
+    }
+    p->fft.plan(p->fftSize);
+
+    // Only the flat part of the IQ filter is kept from each step. The plan
+    // fixes the bins, so the scanner keeps this rate and bandwidth until closed
+    const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+    p->decimation = c->decimation;
+    p->bandwidth = std::min(bb60Decimation.at(c->decimation), c->bandwidth);
+    const double rate = BB60_CLOCK / p->decimation;
+    p->binHz = rate / p->fftSize;
+    p->keep = std::min<size_t>((size_t)(p->bandwidth / p->binHz), p->fftSize) & ~size_t(1);
+    if(p->keep == 0) {
+        throw std::runtime_error("setupStream: panorama bandwidth is narrower than one bin");
+    }
+
+    p->numBins = (size_t)std::ceil((p->stop - p->start) / p->binHz);
+    const size_t numSteps = (p->numBins + p->keep - 1) / p->keep;
+    for(size_t k = 0; k < numSteps; k++) {
+        p->centers.push_back(p->start + (k * p->keep + p->keep / 2) * p->binHz);
+    }
+
+    // Hann window, normalized so a bin centered tone reads its power
+    p->window.resize(p->fftSize);
+    double sum = 0.0;
+    for(size_t i = 0; i < p->fftSize; i++) {
+        p->window[i] = 0.5f - 0.5f * (float)std::cos(2.0 * M_PI * i / p->fftSize);
+        sum += p->window[i];
+    }
+    p->scale = (float)(1.0 / (sum * sum));
+    p->work.resize(p->fftSize);
+
+    p->building.assign(p->numBins, -200.0f);
+    p->ready.assign(p->numBins, -200.0f);
+    p->output.assign(p->numBins, -200.0f);
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Panorama %.6f - %.6f MHz: %zu steps, %zu bins of %.1f Hz",
+            p->start / 1e6, p->stop / 1e6, numSteps, p->numBins, p->binHz);
+
+    // Opened last, nothing below can fail and leave the log open
+    if(args.count("occ_file") != 0) {
+        setupOccupancy(p.get(), args);
+    }
+
+    s->panorama = std::move(p);
+}
+
+void SoapyBB60::startPanorama(SoapyBB60Stream *s)
+{
+    SoapyBB60Panorama *p = s->panorama.get();
+
+    p->full.clear();
+    p->empty.clear();
+    for(size_t i = 0; i < BB60_PANORAMA_STEPS; i++) {
+        p->empty.emplace_back(new SoapyBB60PanoramaStep);
+        p->empty.back()->data.resize(p->fftSize);
+    }
+    p->scans = 0;
+    p->delivered = 0;
+    p->status = bbNoError;
+
+    const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+    bbConfigureIQDataType(deviceId, bbDataType32fc);
+    configureLevels(*c);
+    bbStatus status = bbConfigureIQ(deviceId, p->decimation, p->bandwidth);
+    if(status != bbNoError) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureIQ: %s", bbGetErrorString(status));
+    }
+
+    p->running = true;
+    p->captureThread = std::thread(&SoapyBB60::panoramaCaptureLoop, this, p);
+    p->fftThread = std::thread(&SoapyBB60::panoramaFftLoop, this, s);
+}
+
+void SoapyBB60::stopPanorama(SoapyBB60Stream *s)
+{
+    SoapyBB60Panorama *p = s->panorama.get();
+
+    p->running = false;
+    p->cond.notify_all();
+    if(p->captureThread.joinable()) p->captureThread.join();
+    if(p->fftThread.joinable()) p->fftThread.join();
+
+    // The bucket in progress is logged as far as it got
+    if(p->occupancy) {
+        p->occupancy->partial = true;
+        flushOccupancy(p);
+    }
+
+    bbAbort(deviceId);
+
+    // Leave the device where the user tuned it
+    bbConfigureIQCenter(deviceId, getConfig()->centerFrequency);
+}
+
+void SoapyBB60::panoramaCaptureLoop(SoapyBB60Panorama *p)
+{
+    tuneThread(acqCpus, acqPriority, "Panorama capture");
+
+    size_t k = 0;
+
+    while(p->running) {
+        std::unique_ptr<SoapyBB60PanoramaStep> step;
+        {
+            std::unique_lock<std::mutex> lock(p->mutex);
+            p->cond.wait(lock, [p]{ return not p->empty.empty() or not p->running; });
+            if(not p->running) break;
+            step = std::move(p->empty.front());
+            p->empty.pop_front();
+        }
+
+        // Retuning means re-initiating, bbInitiate ends the previous acquisition
+        bbConfigureIQCenter(deviceId, p->centers[k]);
+        bbStatus status = bbInitiate(deviceId, BB_STREAMING, BB_STREAM_IQ);
+
+        bbIQPacket pkt;
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.iqData = step->data.data();
+        pkt.iqCount = step->data.size();
+        pkt.purge = BB_TRUE;
+        if(status >= bbNoError) {
+            status = bbGetIQ(deviceId, &pkt);
+        }
+        if(status < bbNoError) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "Panorama step %.6f MHz: %s", p->centers[k] / 1e6, bbGetErrorString(status));
+            p->status = status;
+            p->running = false;
+            p->cond.notify_all();
+            break;
+        }
+
+        step->index = k;
+        step->timeNs = (long long)pkt.sec * 1000000000LL + pkt.nano;
+        {
+            std::lock_guard<std::mutex> lock(p->mutex);
+            p->full.push_back(std::move(step));
+        }
+        p->cond.notify_all();
+
+        k = (k + 1) % p->centers.size();
+    }
+}
+
+void SoapyBB60::panoramaFftLoop(SoapyBB60Stream *s)
+{
+    SoapyBB60Panorama *p = s->panorama.get();
+
+    tuneThread(workerCpus, workerPriority, "Panorama FFT");
+
+    while(true) {
+        std::unique_ptr<SoapyBB60PanoramaStep> step;
+        {
+            std::unique_lock<std::mutex> lock(p->mutex);
+            p->cond.wait(lock, [p]{ return not p->full.empty() or not p->running; });
+            if(p->full.empty()) break;
+            step = std::move(p->full.front());
+            p->full.pop_front();
+        }
+
+        for(size_t i = 0; i < p->fftSize; i++) {
+            p->work[i] = step->data[i] * p->window[i];
+        }
+        p->fft.forward(p->work.data());
+
+        // Bins -keep/2 .. keep/2-1 around the step center, the samples are amplitude corrected so this is dBm
+        const size_t first = step->index * p->keep;
+        const size_t count = std::min(p->keep, p->numBins - first);
+        for(size_t j = 0; j < count; j++) {
+            const std::complex<float> &x = p->work[(p->fftSize + j - p->keep / 2) % p->fftSize];
+            p->building[first + j] = 10.0f * std::log10(std::norm(x) * p->scale + 1e-20f);
+        }
+
+        if(step->index == 0) {
+            p->buildingStartNs = step->timeNs;
+        }
+
+        const bool last = (step->index + 1 == p->centers.size());
+        if(last and p->occupancy) {
+            reduceOccupancy(p, p->buildingStartNs);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(p->mutex);
+            if(last) {
+                p->ready.swap(p->building);
+                p->readyStartNs = p->buildingStartNs;
+                p->scans++;
+            }
+            p->empty.push_back(std::move(step));
+        }
+        p->cond.notify_all();
+
+        if(last) {
+            // Per scan timing: start of the scan in the read, end of it here
+            SoapyBB60Event event;
+            event.ret = 0;
+            event.flags = SOAPY_SDR_HAS_TIME | SOAPY_SDR_END_BURST;
+            event.timeNs = p->readyStartNs;
+            event.chanMask = p->centers.size();
+            postEvent(s, event);
+        }
+    }
+}
+
+int SoapyBB60::readPanorama(
+        SoapyBB60Stream *s,
+        void * const *buffs,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    SoapyBB60Panorama *p = s->panorama.get();
+
+    flags = SOAPY_SDR_HAS_TIME;
+
+    // A new scan is taken only once the previous one was read out completely
+    if(s->offset == 0) {
+        std::unique_lock<std::mutex> lock(p->mutex);
+        p->cond.wait_for(lock, std::chrono::microseconds(timeoutUs),
+            [p]{ return p->scans != p->delivered or not p->running; });
+        if(p->scans == p->delivered) {
+            return (p->status != bbNoError) ? SOAPY_SDR_STREAM_ERROR : SOAPY_SDR_TIMEOUT;
+        }
+        p->output.swap(p->ready);
+        p->outputStartNs = p->readyStartNs;
+        p->delivered = p->scans;
+        flags |= SOAPY_SDR_USER_FLAG0;
+    }
+
+    const size_t n = std::min(numElems, p->numBins - s->offset);
+    std::memcpy(buffs[0], p->output.data() + s->offset, n * sizeof(float));
+    s->offset += n;
+    timeNs = p->outputStartNs;
+
+    if(s->offset == p->numBins) {
+        flags |= SOAPY_SDR_END_BURST;
+        s->offset = 0;
+    }
+
+    return n;
+}
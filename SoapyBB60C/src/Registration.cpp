@@ -1,9 +1,20 @@
 #include "SoapyBB60.hpp"
+#include "SoapyBB60Remote.hpp"
 
 #include <SoapySDR/Registry.hpp>
 
 static SoapySDR::KwargsList findBB60(const SoapySDR::Kwargs &args)
 {
+    // Client mode, the server is wherever the user points
+    if(args.count("connect") != 0) {
+        SoapySDR::Kwargs deviceInfo;
+
+        deviceInfo["connect"] = args.at("connect");
+        deviceInfo["label"] = "BB60C [" + args.at("connect") + "]";
+
+        return SoapySDR::KwargsList(1, deviceInfo);
+    }
+
     int serials[BB_MAX_DEVICES];
     int count = -1;
     bbStatus status = bbGetSerialNumberList(serials, &count);
@@ -28,6 +39,10 @@ static SoapySDR::KwargsList findBB60(const SoapySDR::Kwargs &args)
 
 static SoapySDR::Device *makeBB60(const SoapySDR::Kwargs &args)
 {
+    if(args.count("connect") != 0) {
+        return new SoapyBB60Remote(args);
+    }
+
     return new SoapyBB60(args);
 }
 
@@ -0,0 +1,501 @@
+#include "SoapyBB60Remote.hpp"
+#include "Kernels.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <stdexcept>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+SoapyBB60Remote::SoapyBB60Remote(const SoapySDR::Kwargs &args)
+{
+    url = args.at("connect");
+    const SoapyBB60Net::Url u = SoapyBB60Net::parseUrl(url);
+
+    if(u.scheme == "udp") {
+        // Receive only, bind to the address the server sends to
+        sockaddr_storage addr;
+        socklen_t addrLen;
+        udp = true;
+        dataFd = SoapyBB60Net::openUdp(u, true, addr, addrLen);
+        SoapySDR_logf(SOAPY_SDR_INFO, "Receiving BB60 IQ on %s", url.c_str());
+        return;
+    }
+
+    // Control connection first, then attach a data connection to the session
+    ctrlFd = SoapyBB60Net::connectTcp(u);
+    const std::string session = call({"hello"});
+
+    dataFd = SoapyBB60Net::connectTcp(u);
+    SoapyBB60NetHeader hdr;
+    std::string reply;
+    if(not SoapyBB60Net::sendMessage(dataFd, BB60_NET_CONTROL, "attach\t" + session)
+            or not SoapyBB60Net::recvMessage(dataFd, hdr, reply) or reply != "OK") {
+        close(ctrlFd);
+        close(dataFd);
+        throw std::runtime_error("Unable to attach data connection to " + url);
+    }
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Connected to BB60 server %s, session %s", url.c_str(), session.c_str());
+}
+
+SoapyBB60Remote::~SoapyBB60Remote(void)
+{
+    if(ctrlFd >= 0) close(ctrlFd);
+    if(dataFd >= 0) close(dataFd);
+}
+
+std::string SoapyBB60Remote::call(const std::vector<std::string> &cmd) const
+{
+    if(udp) {
+        throw std::runtime_error(cmd[0] + ": device control is not available over UDP");
+    }
+
+    std::lock_guard<std::mutex> lock(ctrlMutex);
+
+    SoapyBB60NetHeader hdr;
+    std::string reply;
+    if(not SoapyBB60Net::sendMessage(ctrlFd, BB60_NET_CONTROL, SoapyBB60Net::join(cmd, '\t'))
+            or not SoapyBB60Net::recvMessage(ctrlFd, hdr, reply)) {
+        throw std::runtime_error(cmd[0] + ": connection to " + url + " lost");
+    }
+
+    const size_t tab = reply.find('\t');
+    const std::string status = reply.substr(0, tab);
+    const std::string value = (tab == std::string::npos) ? "" : reply.substr(tab + 1);
+    if(status != "OK") {
+        throw std::runtime_error(cmd[0] + ": " + value);
+    }
+
+    return value;
+}
+
+std::vector<double> SoapyBB60Remote::callList(const std::vector<std::string> &cmd) const
+{
+    std::vector<double> values;
+
+    for(auto &ii : SoapyBB60Net::split(call(cmd), '\t')) {
+        values.push_back(std::stod(ii));
+    }
+
+    return values;
+}
+
+/*******************************************************************
+ * Identification API
+ ******************************************************************/
+
+std::string SoapyBB60Remote::getDriverKey(void) const
+{
+    return "BB60";
+}
+
+std::string SoapyBB60Remote::getHardwareKey(void) const
+{
+    return "BB60";
+}
+
+SoapySDR::Kwargs SoapyBB60Remote::getHardwareInfo(void) const
+{
+    SoapySDR::Kwargs args;
+
+    args["connect"] = url;
+    if(udp) {
+        return args;
+    }
+
+    for(auto &ii : SoapyBB60Net::split(call({"getHardwareInfo"}), '\t')) {
+        const size_t eq = ii.find('=');
+        if(eq != std::string::npos) args[ii.substr(0, eq)] = ii.substr(eq + 1);
+    }
+
+    return args;
+}
+
+/*******************************************************************
+ * Channels API
+ ******************************************************************/
+
+size_t SoapyBB60Remote::getNumChannels(const int dir) const
+{
+    return (dir == SOAPY_SDR_RX) ? 1 : 0;
+}
+
+/*******************************************************************
+ * Stream API
+ ******************************************************************/
+
+std::vector<std::string> SoapyBB60Remote::getStreamFormats(const int direction, const size_t channel) const
+{
+    return SoapyBB60Net::formats();
+}
+
+std::string SoapyBB60Remote::getNativeStreamFormat(const int direction, const size_t channel, double &fullScale) const
+{
+    fullScale = 1.0;
+
+    return SOAPY_SDR_CF32;
+}
+
+SoapySDR::Stream *SoapyBB60Remote::setupStream(
+        const int direction,
+        const std::string &format,
+        const std::vector<size_t> &channels,
+        const SoapySDR::Kwargs &args)
+{
+    if(channels.size() > 1 or (channels.size() > 0 and channels.at(0) != 0)) {
+        throw std::runtime_error("setupStream invalid channel selection");
+    }
+
+    if(SoapyBB60Net::formatCode(format) < 0) {
+        throw std::runtime_error("setupStream: Invalid format '" + format + "'");
+    }
+
+    if(streamSetup) {
+        throw std::runtime_error("setupStream: only one stream per remote connection");
+    }
+
+    if(udp) {
+        // Whatever the server sends, at most one datagram per read
+        mtu = (BB60_NET_UDP_MAX - sizeof(SoapyBB60NetHeader)) / SoapyBB60Kernels::formatSize(format);
+        spill.resize(BB60_NET_UDP_MAX);
+    } else {
+        std::vector<std::string> cmd = {"setupStream", format};
+        for(auto &ii : args) cmd.push_back(ii.first + "=" + ii.second);
+        mtu = std::stoul(call(cmd));
+    }
+
+    this->format = format;
+    elemSize = SoapyBB60Kernels::formatSize(format);
+    streamSetup = true;
+    seqValid = false;
+    pending.clear();
+    pendingOffset = 0;
+
+    return (SoapySDR::Stream *)this;
+}
+
+void SoapyBB60Remote::closeStream(SoapySDR::Stream *stream)
+{
+    if(not udp) {
+        call({"closeStream"});
+    }
+    streamSetup = false;
+}
+
+size_t SoapyBB60Remote::getStreamMTU(SoapySDR::Stream *stream) const
+{
+    return mtu;
+}
+
+int SoapyBB60Remote::activateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs, const size_t numElems)
+{
+    if(flags != 0) {
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    if(udp) {
+        return 0;
+    }
+
+    rate = getSampleRate(SOAPY_SDR_RX, 0);
+    return std::stoi(call({"activateStream"}));
+}
+
+int SoapyBB60Remote::deactivateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs)
+{
+    if(flags != 0) {
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    if(udp) {
+        return 0;
+    }
+
+    return std::stoi(call({"deactivateStream"}));
+}
+
+int SoapyBB60Remote::readPending(void * const *buffs, const size_t numElems, int &flags, long long &timeNs)
+{
+    const size_t n = std::min(numElems * elemSize, pending.size() - pendingOffset);
+    std::memcpy(buffs[0], pending.data() + pendingOffset, n);
+    pendingOffset += n;
+
+    flags = pendingHdr.flags;
+    timeNs = pendingHdr.timeNs;
+
+    if(pendingOffset < pending.size()) {
+        // End of burst belongs to the last piece, start of burst to the first
+        flags &= ~SOAPY_SDR_END_BURST;
+        pendingHdr.flags &= ~SOAPY_SDR_USER_FLAG0;
+        if(rate > 0) {
+            pendingHdr.timeNs += (long long)((n / elemSize) * 1e9 / rate);
+        } else {
+            pendingHdr.flags &= ~SOAPY_SDR_HAS_TIME;
+        }
+    } else {
+        pending.clear();
+        pendingOffset = 0;
+    }
+
+    return n / elemSize;
+}
+
+int SoapyBB60Remote::readStream(
+        SoapySDR::Stream *stream,
+        void * const *buffs,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    if(pendingOffset < pending.size()) {
+        return readPending(buffs, numElems, flags, timeNs);
+    }
+
+    if(not SoapyBB60Net::waitReadable(dataFd, timeoutUs)) {
+        return SOAPY_SDR_TIMEOUT;
+    }
+
+    // Payload goes straight into the caller's buffer, anything beyond it is kept for the next read
+    const size_t cap = numElems * elemSize;
+    SoapyBB60NetHeader hdr;
+    size_t payload = 0;
+
+    if(udp) {
+        iovec iov[3];
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = buffs[0];
+        iov[1].iov_len = cap;
+        iov[2].iov_base = spill.data();
+        iov[2].iov_len = spill.size();
+
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 3;
+
+        const ssize_t ret = recvmsg(dataFd, &msg, 0);
+        if(ret < (ssize_t)sizeof(hdr) or hdr.magic != BB60_NET_MAGIC) {
+            return SOAPY_SDR_CORRUPTION;
+        }
+        payload = ret - sizeof(hdr);
+        pending.assign(spill.begin(), spill.begin() + (payload > cap ? payload - cap : 0));
+    } else {
+        if(not SoapyBB60Net::recvAll(dataFd, &hdr, sizeof(hdr)) or hdr.magic != BB60_NET_MAGIC
+                or hdr.length > BB60_NET_DATA_MAX) {
+            return SOAPY_SDR_STREAM_ERROR;
+        }
+        payload = hdr.length;
+        pending.resize(payload > cap ? payload - cap : 0);
+        if(not SoapyBB60Net::recvAll(dataFd, buffs[0], std::min(cap, payload))
+                or not SoapyBB60Net::recvAll(dataFd, pending.data(), pending.size())) {
+            return SOAPY_SDR_STREAM_ERROR;
+        }
+    }
+    pendingOffset = 0;
+
+    const size_t direct = std::min(cap, payload);
+    const bool gap = seqValid and hdr.seq != nextSeq;
+    nextSeq = hdr.seq + 1;
+    seqValid = true;
+
+    // Server side events such as overflow carry no payload
+    if(hdr.elems < 0) {
+        pending.clear();
+        return hdr.elems;
+    }
+
+    if(hdr.format != SoapyBB60Net::formatCode(format)) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "readStream: server sends %s, stream is %s",
+            SoapyBB60Net::formatName(hdr.format).c_str(), format.c_str());
+        pending.clear();
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    // Compressed frames can not be split across reads
+    if(format == BB60_FORMAT_CS16Z and payload > cap) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "readStream: CS16Z reads need at least %zu bytes", payload);
+        pending.clear();
+        return SOAPY_SDR_STREAM_ERROR;
+    }
+
+    pendingHdr = hdr;
+
+    // Lost datagrams, report the gap and return this packet on the next read
+    if(gap) {
+        pending.insert(pending.begin(), (char *)buffs[0], (char *)buffs[0] + direct);
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    flags = hdr.flags;
+    timeNs = hdr.timeNs;
+
+    if(not pending.empty()) {
+        flags &= ~SOAPY_SDR_END_BURST;
+        pendingHdr.flags &= ~SOAPY_SDR_USER_FLAG0;
+        if(rate > 0) {
+            pendingHdr.timeNs += (long long)((direct / elemSize) * 1e9 / rate);
+        } else {
+            pendingHdr.flags &= ~SOAPY_SDR_HAS_TIME;
+        }
+    }
+
+    return direct / elemSize;
+}
+
+/*******************************************************************
+ * Antenna API
+ ******************************************************************/
+
+std::vector<std::string> SoapyBB60Remote::listAntennas(const int direction, const size_t channel) const
+{
+    return {"RX"};
+}
+
+std::string SoapyBB60Remote::getAntenna(const int direction, const size_t channel) const
+{
+    return "RX";
+}
+
+/*******************************************************************
+ * Gain API
+ ******************************************************************/
+
+std::vector<std::string> SoapyBB60Remote::listGains(const int direction, const size_t channel) const
+{
+    return SoapyBB60Net::split(call({"listGains"}), '\t');
+}
+
+void SoapyBB60Remote::setGain(const int direction, const size_t channel, const std::string &name, const double value)
+{
+    call({"setGain", name, SoapyBB60Net::toString(value)});
+}
+
+void SoapyBB60Remote::setGain(const int direction, const size_t channel, const double value)
+{
+    call({"setGain", SoapyBB60Net::toString(value)});
+}
+
+double SoapyBB60Remote::getGain(const int direction, const size_t channel) const
+{
+    return std::stod(call({"getGain"}));
+}
+
+double SoapyBB60Remote::getGain(const int direction, const size_t channel, const std::string &name) const
+{
+    return std::stod(call({"getGain", name}));
+}
+
+SoapySDR::Range SoapyBB60Remote::getGainRange(const int direction, const size_t channel, const std::string &name) const
+{
+    const std::vector<double> range = callList({"getGainRange", name});
+    return SoapySDR::Range(range.at(0), range.at(1));
+}
+
+/*******************************************************************
+ * Frequency API
+ ******************************************************************/
+
+void SoapyBB60Remote::setFrequency(
+        const int direction,
+        const size_t channel,
+        const std::string &name,
+        const double frequency,
+        const SoapySDR::Kwargs &args)
+{
+    call({"setFrequency", name, SoapyBB60Net::toString(frequency)});
+}
+
+double SoapyBB60Remote::getFrequency(const int direction, const size_t channel, const std::string &name) const
+{
+    return std::stod(call({"getFrequency", name}));
+}
+
+std::vector<std::string> SoapyBB60Remote::listFrequencies(const int direction, const size_t channel) const
+{
+    return {"RF"};
+}
+
+SoapySDR::RangeList SoapyBB60Remote::getFrequencyRange(
+        const int direction,
+        const size_t channel,
+        const std::string &name) const
+{
+    SoapySDR::RangeList results;
+    const std::vector<double> range = callList({"getFrequencyRange", name});
+
+    for(size_t i = 0; i + 1 < range.size(); i += 2) {
+        results.push_back(SoapySDR::Range(range[i], range[i + 1]));
+    }
+
+    return results;
+}
+
+/*******************************************************************
+ * Sample Rate API
+ ******************************************************************/
+
+void SoapyBB60Remote::setSampleRate(const int direction, const size_t channel, const double rate)
+{
+    call({"setSampleRate", SoapyBB60Net::toString(rate)});
+}
+
+double SoapyBB60Remote::getSampleRate(const int direction, const size_t channel) const
+{
+    return std::stod(call({"getSampleRate"}));
+}
+
+std::vector<double> SoapyBB60Remote::listSampleRates(const int direction, const size_t channel) const
+{
+    return callList({"listSampleRates"});
+}
+
+/*******************************************************************
+ * Bandwidth API
+ ******************************************************************/
+
+void SoapyBB60Remote::setBandwidth(const int direction, const size_t channel, const double bw)
+{
+    call({"setBandwidth", SoapyBB60Net::toString(bw)});
+}
+
+double SoapyBB60Remote::getBandwidth(const int direction, const size_t channel) const
+{
+    return std::stod(call({"getBandwidth"}));
+}
+
+std::vector<double> SoapyBB60Remote::listBandwidths(const int direction, const size_t channel) const
+{
+    return callList({"listBandwidths"});
+}
+
+/*******************************************************************
+ * Sensor API
+ ******************************************************************/
+
+std::vector<std::string> SoapyBB60Remote::listSensors(void) const
+{
+    return SoapyBB60Net::split(call({"listSensors"}), '\t');
+}
+
+std::string SoapyBB60Remote::readSensor(const std::string &key) const
+{
+    return call({"readSensor", key});
+}
+
+/*******************************************************************
+ * Settings API
+ ******************************************************************/
+
+void SoapyBB60Remote::writeSetting(const std::string &key, const std::string &value)
+{
+    call({"writeSetting", key, value});
+}
+
+std::string SoapyBB60Remote::readSetting(const std::string &key) const
+{
+    return call({"readSetting", key});
+}
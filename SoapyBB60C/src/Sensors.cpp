@@ -7,6 +7,12 @@ std::vector<std::string> SoapyBB60::listSensors(void) const
     sensors.push_back("TEMP");
     sensors.push_back("VOLT");
     sensors.push_back("CURR");
+    sensors.push_back("RECOVERY_TIME");
+    sensors.push_back("RECOVERIES");
+    sensors.push_back("PEAK");
+    sensors.push_back("RMS");
+    sensors.push_back("CLIPS");
+    sensors.push_back("OVERLOADS");
 
     return sensors;
 }
@@ -48,11 +54,100 @@ SoapySDR::ArgInfo SoapyBB60::getSensorInfo(const std::string &key) const
         return info;
     }
 
+    if(key == "RECOVERY_TIME") {
+        info.key = key;
+        info.value = "0";
+        info.name = "Recovery time";
+        info.description = "Time from the last USB error until streaming resumed";
+        info.units = "ms";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+
+        return info;
+    }
+
+    if(key == "RECOVERIES") {
+        info.key = key;
+        info.value = "0";
+        info.name = "Recoveries";
+        info.description = "Times the device was reopened after a USB error";
+        info.type = SoapySDR::ArgInfo::INT;
+
+        return info;
+    }
+
+    if(key == "PEAK") {
+        info.key = key;
+        info.value = "-200";
+        info.name = "Peak level";
+        info.description = "Highest sample power at the input over the last 100 ms";
+        info.units = "dBm";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+
+        return info;
+    }
+
+    if(key == "RMS") {
+        info.key = key;
+        info.value = "-200";
+        info.name = "RMS level";
+        info.description = "Mean sample power at the input over the last 100 ms";
+        info.units = "dBm";
+        info.type = SoapySDR::ArgInfo::FLOAT;
+
+        return info;
+    }
+
+    if(key == "CLIPS") {
+        info.key = key;
+        info.value = "0";
+        info.name = "Clipped samples";
+        info.description = "Samples that reached the reference level since the device was opened";
+        info.type = SoapySDR::ArgInfo::INT;
+
+        return info;
+    }
+
+    if(key == "OVERLOADS") {
+        info.key = key;
+        info.value = "0";
+        info.name = "Overloaded blocks";
+        info.description = "Blocks with an ADC overflow or clipped samples since the device was opened";
+        info.type = SoapySDR::ArgInfo::INT;
+
+        return info;
+    }
+
     throw std::runtime_error("Unknown sensor: " + key);
 }
 
 std::string SoapyBB60::readSensor(const std::string &key) const
 {
+    // Kept by the driver, readable while the device is being reopened
+    if(key == "RECOVERY_TIME") {
+        return std::to_string(recoveryUs / 1e3);
+    }
+
+    if(key == "RECOVERIES") {
+        return std::to_string(recoveryCount);
+    }
+
+    // Measured by the acquisition thread
+    if(key == "PEAK") {
+        return std::to_string(peakDb);
+    }
+
+    if(key == "RMS") {
+        return std::to_string(rmsDb);
+    }
+
+    if(key == "CLIPS") {
+        return std::to_string(clipCount);
+    }
+
+    if(key == "OVERLOADS") {
+        return std::to_string(overloadCount);
+    }
+
     float temp, volt, curr;
     bbGetDeviceDiagnostics(deviceId, &temp, &volt, &curr);
 
@@ -0,0 +1,566 @@
+#include "SoapyBB60.hpp"
+#include "Kernels.hpp"
+#include "Network.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*******************************************************************
+ * Network server
+ ******************************************************************/
+
+// Settings and stream args that name or write files on the server, local only
+static void checkRemoteKey(const std::string &key)
+{
+    static const char *localKeys[] = {"trace_dump", "snapshot", "snapshot_dir", "filter_file", "occ_file"};
+    for(const char *local : localKeys) {
+        if(key == local) throw std::runtime_error("'" + key + "' can not be used over the network");
+    }
+}
+
+// Whole samples or whole CS16Z frames per packet, at most limit bytes
+static size_t packetBytes(const std::string &format, const size_t mtuBytes, const size_t limit)
+{
+    const size_t bytes = std::min(mtuBytes, limit);
+    return bytes - bytes % ((format == BB60_FORMAT_CS16Z) ? BB60_COMPRESS_MAX_FRAME : SoapyBB60Kernels::formatSize(format));
+}
+
+void SoapyBB60::startServer(const std::string &url, const std::string &format)
+{
+    const SoapyBB60Net::Url u = SoapyBB60Net::parseUrl(url);
+
+    if(SoapyBB60Net::formatCode(format) < 0) {
+        throw std::runtime_error("serve_format: Invalid format '" + format + "'");
+    }
+
+    serverRunning = true;
+
+    if(u.scheme == "udp") {
+        // Push only, the stream runs for the lifetime of the device
+        serverThread = std::thread(&SoapyBB60::udpServerLoop, this, url, format);
+    } else {
+        serverFd = SoapyBB60Net::listenTcp(u);
+        serverThread = std::thread(&SoapyBB60::serverLoop, this);
+    }
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Serving IQ on %s", url.c_str());
+}
+
+void SoapyBB60::stopServer(void)
+{
+    if(not serverRunning) {
+        return;
+    }
+
+    serverRunning = false;
+    if(serverThread.joinable()) {
+        serverThread.join();
+    }
+
+    if(serverFd >= 0) {
+        close(serverFd);
+        serverFd = -1;
+    }
+}
+
+// An accepted connection still waiting for its first message
+struct SoapyBB60Pending {
+    int fd;
+    std::chrono::steady_clock::time_point deadline;
+    std::string buffer;
+};
+
+void SoapyBB60::serverLoop(void)
+{
+    // Polled with the listen socket and read as bytes arrive, so a slow client never holds up another
+    std::vector<SoapyBB60Pending> pending;
+
+    while(serverRunning) {
+        // Reap finished sessions
+        {
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            for(auto it = sessions.begin(); it != sessions.end();) {
+                if((*it)->running) {
+                    ++it;
+                    continue;
+                }
+                (*it)->ctrlThread.join();
+                it = sessions.erase(it);
+            }
+        }
+
+        std::vector<pollfd> fds(1 + pending.size());
+        fds[0].fd = serverFd;
+        for(size_t i = 0; i < pending.size(); i++) fds[1 + i].fd = pending[i].fd;
+        for(auto &pfd : fds) {
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+        }
+        if(poll(fds.data(), fds.size(), 200) < 0) {
+            continue;
+        }
+
+        // Backwards, so erasing keeps the earlier entries in step with fds
+        const auto now = std::chrono::steady_clock::now();
+        for(size_t i = pending.size(); i-- > 0;) {
+            SoapyBB60Pending &p = pending[i];
+            bool done = now >= p.deadline;
+
+            // The first message says whether this is a new control connection or a data connection
+            SoapyBB60NetHeader hdr;
+            size_t need = sizeof(hdr);
+            if(p.buffer.size() >= sizeof(hdr)) {
+                std::memcpy(&hdr, p.buffer.data(), sizeof(hdr));
+                need += hdr.length;
+            }
+
+            // Never past the first message, whatever follows belongs to the session
+            if(not done and fds[1 + i].revents != 0) {
+                char buf[4096];
+                const ssize_t ret = recv(p.fd, buf, std::min(sizeof(buf), need - p.buffer.size()), MSG_DONTWAIT);
+                if(ret > 0) p.buffer.append(buf, ret);
+                done = (ret == 0) or (ret < 0 and errno != EAGAIN and errno != EINTR);
+            }
+            if(not done and p.buffer.size() >= sizeof(hdr)) {
+                std::memcpy(&hdr, p.buffer.data(), sizeof(hdr));
+                if(hdr.magic != BB60_NET_MAGIC or hdr.version != BB60_NET_VERSION
+                        or hdr.type != BB60_NET_CONTROL or hdr.length > BB60_NET_CONTROL_MAX) {
+                    done = true;
+                } else if(p.buffer.size() == sizeof(hdr) + hdr.length) {
+                    serverHandshake(p.fd, p.buffer.substr(sizeof(hdr)));
+                    pending.erase(pending.begin() + i);
+                    continue;
+                }
+            }
+            if(done) {
+                close(p.fd);
+                pending.erase(pending.begin() + i);
+            }
+        }
+
+        if(fds[0].revents == 0) {
+            continue;
+        }
+        const int fd = accept(serverFd, nullptr, nullptr);
+        if(fd < 0) {
+            continue;
+        }
+        pending.push_back({fd, now + std::chrono::milliseconds(BB60_NET_HANDSHAKE_MS), std::string()});
+    }
+
+    for(auto &p : pending) close(p.fd);
+
+    // Shut every session down with the server
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    for(auto &session : sessions) {
+        session->running = false;
+        session->ctrlThread.join();
+    }
+    sessions.clear();
+}
+
+void SoapyBB60::serverHandshake(const int fd, const std::string &payload)
+{
+    const std::vector<std::string> cmd = SoapyBB60Net::split(payload, '\t');
+    std::lock_guard<std::mutex> lock(sessionMutex);
+
+    if(cmd.size() == 1 and cmd[0] == "hello") {
+        SoapyBB60Session *session = new SoapyBB60Session;
+        session->id = nextSessionId++;
+        session->ctrlFd = fd;
+        sessions.emplace_back(session);
+        SoapyBB60Net::sendMessage(fd, BB60_NET_REPLY, "OK\t" + std::to_string(session->id));
+        session->ctrlThread = std::thread(&SoapyBB60::sessionLoop, this, session);
+        SoapySDR_logf(SOAPY_SDR_INFO, "Network session %u connected", session->id);
+        return;
+    }
+
+    if(cmd.size() == 2 and cmd[0] == "attach") {
+        SoapyBB60Session *session = nullptr;
+        for(auto &ii : sessions) {
+            if(std::to_string(ii->id) == cmd[1] and ii->dataFd < 0) session = ii.get();
+        }
+        if(session != nullptr) {
+            session->dataFd = fd;
+            SoapyBB60Net::sendMessage(fd, BB60_NET_REPLY, "OK");
+            return;
+        }
+    }
+
+    SoapyBB60Net::sendMessage(fd, BB60_NET_REPLY, "ERR\tExpected hello or attach");
+    close(fd);
+}
+
+void SoapyBB60::sessionLoop(SoapyBB60Session *session)
+{
+    while(serverRunning and session->running) {
+        if(not SoapyBB60Net::waitReadable(session->ctrlFd, 200000)) {
+            continue;
+        }
+
+        SoapyBB60NetHeader hdr;
+        std::string payload;
+        if(not SoapyBB60Net::recvMessage(session->ctrlFd, hdr, payload)) {
+            break;
+        }
+
+        std::string reply;
+        try {
+            reply = "OK\t" + sessionCommand(session, SoapyBB60Net::split(payload, '\t'));
+        } catch (const std::exception &ex) {
+            reply = std::string("ERR\t") + ex.what();
+        }
+        if(reply.size() > BB60_NET_CONTROL_MAX) {
+            reply = "ERR\tReply too long";
+        }
+
+        if(not SoapyBB60Net::sendMessage(session->ctrlFd, BB60_NET_REPLY, reply)) {
+            break;
+        }
+    }
+
+    stopSessionData(session);
+    if(session->stream != nullptr) {
+        closeStream((SoapySDR::Stream *)session->stream);
+        session->stream = nullptr;
+    }
+
+    close(session->ctrlFd);
+    if(session->dataFd >= 0) {
+        close(session->dataFd);
+    }
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Network session %u closed", session->id);
+    session->running = false;
+}
+
+void SoapyBB60::stopSessionData(SoapyBB60Session *session)
+{
+    session->streaming = false;
+    if(session->dataThread.joinable()) {
+        session->dataThread.join();
+    }
+}
+
+std::string SoapyBB60::sessionCommand(SoapyBB60Session *session, const std::vector<std::string> &cmd)
+{
+    if(cmd.empty()) {
+        throw std::runtime_error("Empty command");
+    }
+
+    const std::string &name = cmd[0];
+    const size_t argc = cmd.size() - 1;
+    std::vector<std::string> result;
+
+    // Stream control, one stream per session
+    if(name == "setupStream" and argc >= 1) {
+        if(session->stream != nullptr) {
+            throw std::runtime_error("Stream already set up");
+        }
+        // Data headers carry the format as a code, the F32 records and formats have none
+        if(SoapyBB60Net::formatCode(cmd[1]) < 0) {
+            throw std::runtime_error("Invalid format '" + cmd[1] + "', the network carries CF32, CS16, CS12 and CS16Z");
+        }
+        SoapySDR::Kwargs args;
+        for(size_t i = 2; i < cmd.size(); i++) {
+            const size_t eq = cmd[i].find('=');
+            if(eq != std::string::npos) args[cmd[i].substr(0, eq)] = cmd[i].substr(eq + 1);
+        }
+        for(auto &arg : args) checkRemoteKey(arg.first);
+        // Sessions send one buffer per read, a demod bank returns one per channel
+        if(args.count("demod") != 0) {
+            throw std::runtime_error("'demod' can not be used over the network");
+        }
+        session->stream = (SoapyBB60Stream *)setupStream(SOAPY_SDR_RX, cmd[1], std::vector<size_t>(), args);
+        return std::to_string(getStreamMTU((SoapySDR::Stream *)session->stream));
+    }
+
+    if(name == "closeStream" and session->stream != nullptr) {
+        stopSessionData(session);
+        closeStream((SoapySDR::Stream *)session->stream);
+        session->stream = nullptr;
+        return "";
+    }
+
+    if(name == "activateStream" and session->stream != nullptr) {
+        if(session->dataFd < 0) {
+            throw std::runtime_error("No data connection attached");
+        }
+        const int ret = activateStream((SoapySDR::Stream *)session->stream);
+        if(ret == 0 and not session->streaming) {
+            // Reap a data thread that ended on a stream error
+            stopSessionData(session);
+            session->streaming = true;
+            session->dataThread = std::thread(&SoapyBB60::sessionDataLoop, this, session);
+        }
+        return std::to_string(ret);
+    }
+
+    if(name == "deactivateStream" and session->stream != nullptr) {
+        stopSessionData(session);
+        return std::to_string(deactivateStream((SoapySDR::Stream *)session->stream));
+    }
+
+    // Device control
+    if(name == "getHardwareInfo") {
+        for(auto &ii : getHardwareInfo()) result.push_back(ii.first + "=" + ii.second);
+        return SoapyBB60Net::join(result, '\t');
+    }
+
+    if(name == "setFrequency" and argc == 2) {
+        setFrequency(SOAPY_SDR_RX, 0, cmd[1], std::stod(cmd[2]));
+        return "";
+    }
+
+    if(name == "getFrequencyRange" and argc == 1) {
+        for(auto &ii : getFrequencyRange(SOAPY_SDR_RX, 0, cmd[1])) {
+            result.push_back(SoapyBB60Net::toString(ii.minimum()));
+            result.push_back(SoapyBB60Net::toString(ii.maximum()));
+        }
+        return SoapyBB60Net::join(result, '\t');
+    }
+
+    if(name == "getFrequency" and argc == 1) {
+        return SoapyBB60Net::toString(getFrequency(SOAPY_SDR_RX, 0, cmd[1]));
+    }
+
+    if(name == "setSampleRate" and argc == 1) {
+        setSampleRate(SOAPY_SDR_RX, 0, std::stod(cmd[1]));
+        return "";
+    }
+
+    if(name == "listSampleRates") {
+        for(auto &ii : listSampleRates(SOAPY_SDR_RX, 0)) result.push_back(SoapyBB60Net::toString(ii));
+        return SoapyBB60Net::join(result, '\t');
+    }
+
+    if(name == "getSampleRate") {
+        return SoapyBB60Net::toString(getSampleRate(SOAPY_SDR_RX, 0));
+    }
+
+    if(name == "setBandwidth" and argc == 1) {
+        setBandwidth(SOAPY_SDR_RX, 0, std::stod(cmd[1]));
+        return "";
+    }
+
+    if(name == "listBandwidths") {
+        for(auto &ii : listBandwidths(SOAPY_SDR_RX, 0)) result.push_back(SoapyBB60Net::toString(ii));
+        return SoapyBB60Net::join(result, '\t');
+    }
+
+    if(name == "getBandwidth") {
+        return SoapyBB60Net::toString(getBandwidth(SOAPY_SDR_RX, 0));
+    }
+
+    if(name == "listGains") {
+        return SoapyBB60Net::join(listGains(SOAPY_SDR_RX, 0), '\t');
+    }
+
+    if(name == "getGainRange" and argc == 1) {
+        const SoapySDR::Range range = getGainRange(SOAPY_SDR_RX, 0, cmd[1]);
+        return SoapyBB60Net::toString(range.minimum()) + "\t" + SoapyBB60Net::toString(range.maximum());
+    }
+
+    if(name == "setGain" and argc == 1) {
+        setGain(SOAPY_SDR_RX, 0, std::stod(cmd[1]));
+        return "";
+    }
+
+    if(name == "setGain" and argc == 2) {
+        setGain(SOAPY_SDR_RX, 0, cmd[1], std::stod(cmd[2]));
+        return "";
+    }
+
+    if(name == "getGain" and argc == 0) {
+        return SoapyBB60Net::toString(getGain(SOAPY_SDR_RX, 0));
+    }
+
+    if(name == "getGain" and argc == 1) {
+        return SoapyBB60Net::toString(getGain(SOAPY_SDR_RX, 0, cmd[1]));
+    }
+
+    if(name == "writeSetting" and argc == 2) {
+        checkRemoteKey(cmd[1]);
+        writeSetting(cmd[1], cmd[2]);
+        return "";
+    }
+
+    if(name == "readSetting" and argc == 1) {
+        checkRemoteKey(cmd[1]);
+        return readSetting(cmd[1]);
+    }
+
+    if(name == "listSensors") {
+        return SoapyBB60Net::join(listSensors(), '\t');
+    }
+
+    if(name == "readSensor" and argc == 1) {
+        return readSensor(cmd[1]);
+    }
+
+    throw std::runtime_error("Unknown command '" + name + "'");
+}
+
+/*******************************************************************
+ * Network data path
+ ******************************************************************/
+
+size_t SoapyBB60::fillPackets(SoapyBB60Stream *s, const size_t maxBytes, unsigned long long &seq,
+        std::vector<std::vector<char>> &payloads, std::vector<SoapyBB60NetHeader> &headers, bool &failed)
+{
+    const size_t elemSize = SoapyBB60Kernels::formatSize(s->format);
+    const int code = SoapyBB60Net::formatCode(s->format);
+    size_t count = 0;
+
+    for(; count < payloads.size(); count++) {
+        void *buffs[] = {payloads[count].data()};
+        int flags = 0;
+        long long timeNs = 0;
+
+        // Wait for the first packet only, then batch whatever is already buffered
+        const int ret = readStream((SoapySDR::Stream *)s, buffs, maxBytes / elemSize, flags, timeNs,
+            (count == 0) ? 100000 : 0);
+        if(ret == SOAPY_SDR_TIMEOUT) {
+            break;
+        }
+
+        SoapyBB60NetHeader &hdr = headers[count];
+        SoapyBB60Net::fillHeader(hdr, BB60_NET_DATA, (ret > 0) ? ret * elemSize : 0);
+        hdr.format = (uint8_t)code;
+        hdr.flags = flags;
+        hdr.elems = ret;
+        hdr.seq = seq++;
+        hdr.timeNs = timeNs;
+
+        // An error such as a lost device comes back at once, report it in one packet only
+        if(ret < 0 and ret != SOAPY_SDR_OVERFLOW) {
+            failed = true;
+            return count + 1;
+        }
+    }
+
+    return count;
+}
+
+void SoapyBB60::sessionDataLoop(SoapyBB60Session *session)
+{
+    tuneThread(workerCpus, workerPriority, "Network");
+
+    const size_t mtu = packetBytes(session->stream->format, getStreamMTU((SoapySDR::Stream *)session->stream)
+        * SoapyBB60Kernels::formatSize(session->stream->format), BB60_NET_DATA_MAX);
+    std::vector<std::vector<char>> payloads(BB60_NET_BATCH, std::vector<char>(mtu));
+    std::vector<SoapyBB60NetHeader> headers(BB60_NET_BATCH);
+    iovec iov[2 * BB60_NET_BATCH];
+
+    // After an error the client has its packet and may activate the stream again
+    bool failed = false;
+    while(session->streaming and session->running and not failed) {
+        const size_t count = fillPackets(session->stream, mtu, session->seq, payloads, headers, failed);
+
+        // Header and payload of every packet go out in one gathered write
+        for(size_t i = 0; i < count; i++) {
+            iov[2 * i].iov_base = &headers[i];
+            iov[2 * i].iov_len = sizeof(SoapyBB60NetHeader);
+            iov[2 * i + 1].iov_base = payloads[i].data();
+            iov[2 * i + 1].iov_len = headers[i].length;
+        }
+        if(count == 0) {
+            continue;
+        }
+
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2 * count;
+
+        ssize_t sent = sendmsg(session->dataFd, &msg, MSG_NOSIGNAL);
+        if(sent < 0 and errno != EINTR) {
+            break;
+        }
+
+        // Finish a short write iovec by iovec
+        size_t skip = (sent > 0) ? sent : 0;
+        for(size_t i = 0; i < 2 * count and session->running; i++) {
+            if(skip >= iov[i].iov_len) {
+                skip -= iov[i].iov_len;
+                continue;
+            }
+            if(not SoapyBB60Net::sendAll(session->dataFd, (char *)iov[i].iov_base + skip, iov[i].iov_len - skip)) {
+                session->running = false;
+            }
+            skip = 0;
+        }
+    }
+
+    session->streaming = false;
+}
+
+void SoapyBB60::udpServerLoop(const std::string &url, const std::string &format)
+{
+    tuneThread(workerCpus, workerPriority, "Network");
+
+    sockaddr_storage dest;
+    socklen_t destLen = 0;
+    int fd = -1;
+
+    try {
+        fd = SoapyBB60Net::openUdp(SoapyBB60Net::parseUrl(url), false, dest, destLen);
+    } catch (const std::exception &ex) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "serve: %s", ex.what());
+        return;
+    }
+
+    SoapySDR::Stream *stream = setupStream(SOAPY_SDR_RX, format);
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+    activateStream(stream);
+
+    const size_t maxBytes = packetBytes(format, getStreamMTU(stream) * SoapyBB60Kernels::formatSize(format),
+        BB60_NET_UDP_MAX - sizeof(SoapyBB60NetHeader));
+
+    std::vector<std::vector<char>> payloads(BB60_NET_BATCH, std::vector<char>(maxBytes));
+    std::vector<SoapyBB60NetHeader> headers(BB60_NET_BATCH);
+    iovec iov[2 * BB60_NET_BATCH];
+    mmsghdr msgs[BB60_NET_BATCH];
+    unsigned long long seq = 0;
+
+    while(serverRunning) {
+        bool failed = false;
+        const size_t count = fillPackets(s, maxBytes, seq, payloads, headers, failed);
+
+        std::memset(msgs, 0, sizeof(msgs));
+        for(size_t i = 0; i < count; i++) {
+            iov[2 * i].iov_base = &headers[i];
+            iov[2 * i].iov_len = sizeof(SoapyBB60NetHeader);
+            iov[2 * i + 1].iov_base = payloads[i].data();
+            iov[2 * i + 1].iov_len = headers[i].length;
+            msgs[i].msg_hdr.msg_name = &dest;
+            msgs[i].msg_hdr.msg_namelen = destLen;
+            msgs[i].msg_hdr.msg_iov = &iov[2 * i];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        // Datagrams that do not fit are lost, the receiver sees the sequence gap
+        for(size_t sent = 0; sent < count;) {
+            const int ret = sendmmsg(fd, msgs + sent, count - sent, 0);
+            if(ret <= 0) break;
+            sent += ret;
+        }
+
+        // Nobody can re-arm a UDP stream, so retry the device at a slow pace
+        if(failed) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    deactivateStream(stream);
+    closeStream(stream);
+    close(fd);
+}
@@ -1,6 +1,5 @@
 #include "SoapyBB60.hpp"
-
-#define BB60_CLOCK 40e6
+#include "Trace.hpp"
 
 std::map<std::string, unsigned int> port1_config = {
     {"DEFAULT", 0},
@@ -23,20 +22,17 @@ std::map<std::string, unsigned int> port2_config = {
     {"IN_TRIGGER_FALLING_EDGE", BB_PORT2_IN_TRIGGER_FALLING_EDGE},
 };
 
+std::map<std::string, int> rf_mode_config = {
+    {"IQ", BB60_RF_IQ},
+    {"DIRECT_RF", BB60_RF_DIRECT},
+    {"DIRECT_RF_IQ", BB60_RF_DIRECT_IQ},
+};
+
 SoapyBB60::SoapyBB60(const SoapySDR::Kwargs &args)
 {
     deviceId = -1;
 
-    centerFrequency = 100e6;
-    decimation = 1;
-    bandwidth = BB60_CLOCK/decimation;
-    sampleRate = 0;
-
-    rfGain = 0;
-    attenLevel = 0;
-    refLevel = -30;
-
-    streamActive = false;
+    config = std::make_shared<const SoapyBB60Config>();
 
     bool serial_specified = false;
     bbStatus status;
@@ -90,24 +86,58 @@ SoapyBB60::SoapyBB60(const SoapySDR::Kwargs &args)
         }
         serial = serials[deviceId];
     }
-    if(bbOpenDeviceBySerialNumber(&deviceId, serial) != bbNoError) {
+    int handle = -1;
+    if(bbOpenDeviceBySerialNumber(&handle, serial) != bbNoError) {
         throw std::runtime_error("Unable to open BB60 device " + std::to_string(deviceId) +
             "with S/N " + std::to_string(serial));
     }
+    deviceId = handle;
 
-    bbConfigureIQ(deviceId, decimation, bandwidth);
-    bbConfigureIQCenter(deviceId, centerFrequency);
+    bbConfigureIQ(deviceId, config->decimation, config->bandwidth);
+    bbConfigureIQCenter(deviceId, config->centerFrequency);
 
     for(const auto &info : this->getSettingInfo()) {
         const auto it = args.find(info.key);
         if(it != args.end()) this->writeSetting(it->first, it->second);
     }
+
+    // Memory and thread tuning may also come from the device args, for the shm, serve and history outputs
+    setupTuning(args);
+
+    if(args.count("history") != 0) {
+        double seconds = 0.0;
+        try {
+            seconds = std::stod(args.at("history"));
+        } catch (const std::exception &) {
+            throw std::runtime_error("history is not a number of seconds");
+        }
+        startHistory(seconds);
+    }
+
+    if(args.count("shm") != 0) {
+        startShm(args.at("shm"), args);
+    }
+
+    if(args.count("serve") != 0) {
+        startServer(args.at("serve"), args.count("serve_format") ? args.at("serve_format") : "CS16");
+    }
 }
 
 SoapyBB60::~SoapyBB60(void)
 {
-    bbAbort(deviceId);
-    bbCloseDevice(deviceId);
+    stopServer();
+    stopShm();
+
+    // Streams the user left open are closed as usual, stopping their threads and closing their files
+    historyStream = nullptr;
+    while(not streams.empty()) {
+        closeStream((SoapySDR::Stream *)streams.back());
+    }
+    stopAcquisition();
+    stopHistory();
+    freePool();
+
+    if(deviceOpen) bbCloseDevice(deviceId);
 }
 
 /*******************************************************************
@@ -172,17 +202,102 @@ std::string SoapyBB60::getAntenna(const int direction, const size_t channel) con
     return "RX";
 }
 
+/*******************************************************************
+ * Frontend corrections API
+ ******************************************************************/
+
+bool SoapyBB60::hasDCOffsetMode(const int direction, const size_t channel) const
+{
+    return true;
+}
+
+void SoapyBB60::setDCOffsetMode(const int direction, const size_t channel, const bool automatic)
+{
+    std::lock_guard<std::mutex> lock(corrMutex);
+    dcAuto = automatic;
+}
+
+bool SoapyBB60::getDCOffsetMode(const int direction, const size_t channel) const
+{
+    std::lock_guard<std::mutex> lock(corrMutex);
+    return dcAuto;
+}
+
+bool SoapyBB60::hasDCOffset(const int direction, const size_t channel) const
+{
+    return true;
+}
+
+void SoapyBB60::setDCOffset(const int direction, const size_t channel, const std::complex<double> &offset)
+{
+    // Also the starting point for the automatic estimate
+    std::lock_guard<std::mutex> lock(corrMutex);
+    dcOffset = offset;
+}
+
+std::complex<double> SoapyBB60::getDCOffset(const int direction, const size_t channel) const
+{
+    std::lock_guard<std::mutex> lock(corrMutex);
+    return dcOffset;
+}
+
+bool SoapyBB60::hasIQBalance(const int direction, const size_t channel) const
+{
+    return true;
+}
+
+void SoapyBB60::setIQBalance(const int direction, const size_t channel, const std::complex<double> &balance)
+{
+    // Applied as y = x + balance * conj(x)
+    std::lock_guard<std::mutex> lock(corrMutex);
+    iqBalance = balance;
+}
+
+std::complex<double> SoapyBB60::getIQBalance(const int direction, const size_t channel) const
+{
+    std::lock_guard<std::mutex> lock(corrMutex);
+    return iqBalance;
+}
+
+#ifdef SOAPY_SDR_API_HAS_IQ_BALANCE_MODE
+bool SoapyBB60::hasIQBalanceMode(const int direction, const size_t channel) const
+{
+    return true;
+}
+
+void SoapyBB60::setIQBalanceMode(const int direction, const size_t channel, const bool automatic)
+{
+    std::lock_guard<std::mutex> lock(corrMutex);
+    iqAuto = automatic;
+}
+
+bool SoapyBB60::getIQBalanceMode(const int direction, const size_t channel) const
+{
+    std::lock_guard<std::mutex> lock(corrMutex);
+    return iqAuto;
+}
+#endif
+
 /*******************************************************************
  * Gain API
  ******************************************************************/
 
 void SoapyBB60::setRefMode(const bool useRef)
 {
-    refMode = useRef;
-    double atten = -attenLevel;
-    int gain = rfGain;
+    BB60_TRACE_SCOPE("setRefMode");
+    std::lock_guard<std::mutex> lock(configMutex);
 
-    if(useRef) {
+    SoapyBB60Config next = *getConfig();
+    next.refMode = useRef;
+    updateStream(next);
+}
+
+void SoapyBB60::configureLevels(const SoapyBB60Config &c)
+{
+    double atten = -c.attenLevel;
+    int gain = c.rfGain;
+
+    if(c.refMode) {
         gain = BB_AUTO_GAIN;
         atten = BB_AUTO_ATTEN;
     }
@@ -194,12 +309,10 @@ void SoapyBB60::setRefMode(const bool useRef)
         SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureGain: %s", bbGetErrorString(status));
     }
 
-    status = bbConfigureLevel(deviceId, refLevel, atten);
+    status = bbConfigureLevel(deviceId, c.refLevel, atten);
     if(status != bbNoError) {
         SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureLevel: %s", bbGetErrorString(status));
     }
-
-    updateStream();
 }
 
 std::vector<std::string> SoapyBB60::listGains(const int direction, const size_t channel) const
@@ -239,26 +352,28 @@ void SoapyBB60::setGain(const int direction, const size_t channel, const double
 
 void SoapyBB60::setGain(const int direction, const size_t channel, const std::string &name, const double value)
 {
-    bool useref = true;
+    std::lock_guard<std::mutex> lock(configMutex);
+
+    SoapyBB60Config next = *getConfig();
     if(name == "RF") {
-        rfGain = value;
-        useref = false;
+        next.rfGain = value;
+        next.refMode = false;
     } else if(name == "ATT") {
-        attenLevel = value;
-        useref = false;
+        next.attenLevel = value;
+        next.refMode = false;
     } else if(name == "REF") {
-        refLevel = value;
-        useref = true;
+        next.refLevel = value;
+        next.refMode = true;
     } else {
         throw std::runtime_error(std::string("Unknown GAIN ")+name);
     }
 
-    setRefMode(useref);
+    updateStream(next);
 }
 
 double SoapyBB60::getGain(const int direction, const size_t channel) const
 {
-    if(refMode) {
+    if(getConfig()->refMode) {
         return getGain(direction, channel, "REF");
     } else {
         return getGain(direction, channel, "RF");
@@ -267,14 +382,16 @@ double SoapyBB60::getGain(const int direction, const size_t channel) const
 
 double SoapyBB60::getGain(const int direction, const size_t channel, const std::string &name) const
 {
+    const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+
     if(name=="RF") {
-        if(refMode) return 0.;
-        else return rfGain;
+        if(c->refMode) return 0.;
+        else return c->rfGain;
     } else if(name=="ATT") {
-        if(refMode) return -BB_MAX_ATTENUATION;
-        else return attenLevel;
+        if(c->refMode) return -BB_MAX_ATTENUATION;
+        else return c->attenLevel;
     } else if(name=="REF") {
-        if(refMode) return refLevel;
+        if(c->refMode) return c->refLevel;
         else  return -120.;
     }
 
@@ -295,21 +412,19 @@ void SoapyBB60::setFrequency(
         const SoapySDR::Kwargs &args)
 {
     if(name == "RF") {
-        centerFrequency = (double)frequency;
-
-        bbStatus status = bbConfigureIQCenter(deviceId, centerFrequency);
-        if(status != bbNoError) {
-            SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureIQCenter: %s", bbGetErrorString(status));
-        }
+        BB60_TRACE_SCOPE("setFrequency");
+        std::lock_guard<std::mutex> lock(configMutex);
 
-        updateStream();
+        SoapyBB60Config next = *getConfig();
+        next.centerFrequency = frequency;
+        updateStream(next);
     }
 }
 
 double SoapyBB60::getFrequency(const int direction, const size_t channel, const std::string &name) const
 {
     if(name == "RF") {
-        return (double)centerFrequency;
+        return getConfig()->frequency();
     }
 
     return 0;
@@ -352,30 +467,35 @@ SoapySDR::ArgInfoList SoapyBB60::getFrequencyArgsInfo(const int direction, const
 
 void SoapyBB60::setSampleRate(const int direction, const size_t channel, const double rate)
 {
-    if(sampleRate != rate) {
+    std::lock_guard<std::mutex> lock(configMutex);
+
+    SoapyBB60Config next = *getConfig();
+    if(next.sampleRate != rate) {
         auto revii = bb60Decimation.rbegin();
         int dec = revii->first;
         double bw = bb60Decimation.at(dec);
 
         while(revii != bb60Decimation.rend()) {
             if((BB60_CLOCK/revii->first) >= rate) {
-                decimation = revii->first;
+                next.decimation = revii->first;
                 bw = revii->second;
                 break;
             }
             revii++;
         }
 
-        sampleRate = rate;
+        next.sampleRate = rate;
         std::stringstream sstream;
-        sstream << "BB60 set decimation " << decimation << " BW " << bw/1e6 << "MHz SR: " << BB60_CLOCK/decimation/1e6 << "MHz";
+        sstream << "BB60 set decimation " << next.decimation << " BW " << bw/1e6 << "MHz SR: " << BB60_CLOCK/next.decimation/1e6 << "MHz";
         SoapySDR_log(SOAPY_SDR_INFO, sstream.str().c_str());
+
+        updateStream(next);
     }
 }
 
 double SoapyBB60::getSampleRate(const int direction, const size_t channel) const
 {
-    return BB60_CLOCK/decimation;
+    return getConfig()->rate();
 }
 
 std::vector<double> SoapyBB60::listSampleRates(const int direction, const size_t channel) const
@@ -391,12 +511,18 @@ std::vector<double> SoapyBB60::listSampleRates(const int direction, const size_t
 
 void SoapyBB60::setBandwidth(const int direction, const size_t channel, const double bw)
 {
-    bandwidth = bw;
+    std::lock_guard<std::mutex> lock(configMutex);
+
+    SoapyBB60Config next = *getConfig();
+    next.bandwidth = bw;
+    updateStream(next);
 }
 
 double SoapyBB60::getBandwidth(const int direction, const size_t channel) const
 {
-    return std::min(bb60Decimation.at(decimation), bandwidth);
+    const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+
+    return std::min(bb60Decimation.at(c->decimation), c->bandwidth);
 }
 
 std::vector<double> SoapyBB60::listBandwidths(const int direction, const size_t channel) const
@@ -423,14 +549,30 @@ double SoapyBB60::getMasterClockRate(void) const
  * Utility
  ******************************************************************/
 
+std::shared_ptr<const SoapyBB60Config> SoapyBB60::getConfig(void) const
+{
+    return std::atomic_load(&config);
+}
+
+void SoapyBB60::updateStream(const SoapyBB60Config &next)
+{
+    BB60_TRACE_SCOPE("updateStream");
+
+    // The acquisition thread picks this up before its next bbGetIQ,
+    // an idle device applies it when the acquisition starts
+    std::atomic_store(&config, std::make_shared<const SoapyBB60Config>(next));
+    configGen.fetch_add(1, std::memory_order_release);
+}
+
 void SoapyBB60::configIO(void) const
 {
     if(!streamActive) {
-        bbStatus status = bbConfigureIO(deviceId, port1, port2);
+        const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+        bbStatus status = bbConfigureIO(deviceId, c->port1, c->port2);
         if(status != bbNoError) {
             SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureIO: %s", bbGetErrorString(status));
         } else {
-            SoapySDR_logf(SOAPY_SDR_INFO, "ConfigureIO: %d %d", port1, port2);
+            SoapySDR_logf(SOAPY_SDR_INFO, "ConfigureIO: %d %d", c->port1, c->port2);
         }
     } else {
         SoapySDR_logf(SOAPY_SDR_WARNING, "Can't configureIO while streaming");
@@ -469,23 +611,173 @@ SoapySDR::ArgInfoList SoapyBB60::getSettingInfo(void) const
 
     setArgs.push_back(arg);
 
+    arg.key = "rf_mode";
+    arg.value = "IQ";
+    arg.name = "RF Mode";
+    arg.description = "IQ through the IF chain, or direct RF sampling (BB60C only) as real samples or converted to baseband";
+    arg.type = SoapySDR::ArgInfo::STRING;
+    arg.options = {"IQ", "DIRECT_RF", "DIRECT_RF_IQ"};
+
+    setArgs.push_back(arg);
+
+    arg = SoapySDR::ArgInfo();
+    arg.key = "filter_taps";
+    arg.value = "";
+    arg.name = "Filter Taps";
+    arg.description = "Comma separated real taps of a user FIR filter applied to every stream, empty for none";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(arg);
+
+    arg.key = "filter_file";
+    arg.value = "";
+    arg.name = "Filter File";
+    arg.description = "Load the user filter from a text file, one real or 'real imag' tap per line";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(arg);
+
+    arg.key = "filter_decimation";
+    arg.value = "1";
+    arg.name = "Filter Decimation";
+    arg.description = "Keep every Nth output of the user filter";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    setArgs.push_back(arg);
+
+    arg = SoapySDR::ArgInfo();
+    arg.key = "agc_headroom";
+    arg.value = "10";
+    arg.name = "AGC Headroom";
+    arg.description = "Distance the AGC keeps between the peak input level and the reference level";
+    arg.units = "dB";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+    arg.range = SoapySDR::Range(0, 60);
+
+    setArgs.push_back(arg);
+
+    arg.key = "agc_hysteresis";
+    arg.value = "3";
+    arg.name = "AGC Hysteresis";
+    arg.description = "Drift of the headroom the AGC tolerates before changing the reference level";
+
+    setArgs.push_back(arg);
+
+    arg = SoapySDR::ArgInfo();
+    arg.key = "snapshot";
+    arg.value = "";
+    arg.name = "Snapshot";
+    arg.description = "Write the history around this time in ns, or around now when empty, to a SigMF recording. Reads back the last file written";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(arg);
+
+    arg.key = "snapshot_pre";
+    arg.value = "1";
+    arg.name = "Snapshot Pre-trigger";
+    arg.description = "History written before the trigger";
+    arg.units = "s";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    setArgs.push_back(arg);
+
+    arg.key = "snapshot_post";
+    arg.value = "1";
+    arg.name = "Snapshot Post-trigger";
+    arg.description = "Samples written after the trigger";
+
+    setArgs.push_back(arg);
+
+    arg = SoapySDR::ArgInfo();
+    arg.key = "snapshot_dir";
+    arg.value = ".";
+    arg.name = "Snapshot Directory";
+    arg.description = "Where snapshots are written";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(arg);
+
+#ifdef BB60_TRACE
+    arg = SoapySDR::ArgInfo();
+    arg.key = "trace_dump";
+    arg.value = "";
+    arg.name = "Trace Dump";
+    arg.description = "Write the recorded trace points to this path as Chrome trace JSON";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(arg);
+#endif
+
     return setArgs;
 }
 
 void SoapyBB60::writeSetting(const std::string &key, const std::string &value)
 {
     if(key == "port1" && port1_config.count(value) > 0) {
-        port1 = port1_config[value];
+        {
+            std::lock_guard<std::mutex> lock(configMutex);
+            SoapyBB60Config next = *getConfig();
+            next.port1 = port1_config[value];
+            updateStream(next);
+        }
         configIO();
         return;
     }
 
     if(key == "port2" && port2_config.count(value) > 0) {
-        port2 = port2_config[value];
+        {
+            std::lock_guard<std::mutex> lock(configMutex);
+            SoapyBB60Config next = *getConfig();
+            next.port2 = port2_config[value];
+            updateStream(next);
+        }
         configIO();
         return;
     }
 
+    if(key == "rf_mode" && rf_mode_config.count(value) > 0) {
+        int type = BB_DEVICE_NONE;
+        bbGetDeviceType(deviceId, &type);
+        if(rf_mode_config[value] != BB60_RF_IQ and type != BB_DEVICE_BB60C) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "rf_mode %s: direct RF sampling needs a BB60C", value.c_str());
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(configMutex);
+        SoapyBB60Config next = *getConfig();
+        next.rfMode = rf_mode_config[value];
+        updateStream(next);
+        return;
+    }
+
+    if(key.compare(0, 7, "filter_") == 0) {
+        writeFilterSetting(key, value);
+        return;
+    }
+
+    if(key.compare(0, 4, "agc_") == 0) {
+        writeAgcSetting(key, value);
+        return;
+    }
+
+    if(key.compare(0, 8, "snapshot") == 0) {
+        writeSnapshotSetting(key, value);
+        return;
+    }
+
+    if(key == "trace_dump") {
+#ifdef BB60_TRACE
+        if(SoapyBB60Trace::dump(value)) {
+            SoapySDR_logf(SOAPY_SDR_INFO, "Trace written to %s", value.c_str());
+        } else {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "trace_dump: cannot write %s", value.c_str());
+        }
+#else
+        SoapySDR_log(SOAPY_SDR_WARNING, "trace_dump: built without ENABLE_TRACE");
+#endif
+        return;
+    }
+
     SoapySDR_logf(SOAPY_SDR_WARNING, "Invalid setting '%s'=='%s'", key.c_str(),value.c_str());
 }
 
@@ -494,7 +786,7 @@ std::string SoapyBB60::readSetting(const std::string &key) const
     if(key == "port1") {
         std::string ret = "UNKNOWN";
         for(auto &ii: port1_config) {
-            if(ii.second == port1) {
+            if(ii.second == getConfig()->port1) {
                 ret = ii.first;
                 break;
             }
@@ -505,7 +797,7 @@ std::string SoapyBB60::readSetting(const std::string &key) const
     if(key == "port2") {
         std::string ret = "UNKNOWN";
         for(auto &ii: port2_config) {
-            if(ii.second == port2) {
+            if(ii.second == getConfig()->port2) {
                 ret = ii.first;
                 break;
             }
@@ -513,6 +805,26 @@ std::string SoapyBB60::readSetting(const std::string &key) const
         return ret;
     }
 
+    if(key == "rf_mode") {
+        for(auto &ii: rf_mode_config) {
+            if(ii.second == getConfig()->rfMode) {
+                return ii.first;
+            }
+        }
+    }
+
+    if(key.compare(0, 7, "filter_") == 0) {
+        return readFilterSetting(key);
+    }
+
+    if(key.compare(0, 4, "agc_") == 0) {
+        return readAgcSetting(key);
+    }
+
+    if(key.compare(0, 8, "snapshot") == 0) {
+        return readSnapshotSetting(key);
+    }
+
     SoapySDR_logf(SOAPY_SDR_WARNING, "Unknown setting '%s'", key.c_str());
 
     return "";
@@ -0,0 +1,162 @@
+#include "SoapyBB60.hpp"
+#include "ShmRing.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <cerrno>
+#include <climits>
+
+#include <fcntl.h>
+#include <grp.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static size_t alignUp(const size_t n, const size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+void SoapyBB60::startShm(const std::string &name, const SoapySDR::Kwargs &args)
+{
+    shmName = (name.empty() or name[0] != '/') ? "/" + name : name;
+
+    // The internal stream keeps the acquisition running and sizes the blocks
+    SoapySDR::Kwargs streamArgs;
+    if(args.count("shm_bufflen") != 0) streamArgs["bufflen"] = args.at("shm_bufflen");
+    shmStream = (SoapyBB60Stream *)setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, std::vector<size_t>(), streamArgs);
+
+    const size_t numSlots = args.count("shm_blocks") ? std::stoul(args.at("shm_blocks")) : 256;
+    if(numSlots < 2) {
+        closeStream((SoapySDR::Stream *)shmStream);
+        throw std::runtime_error("shm_blocks must be at least 2");
+    }
+
+    // Page aligned sample buffers, the whole object rounded to huge pages
+    const size_t slotOffset = alignUp(sizeof(SoapyBB60ShmHeader), 64);
+    const size_t dataOffset = alignUp(slotOffset + numSlots * sizeof(SoapyBB60ShmSlot), 4096);
+    const size_t dataStride = alignUp(bufferLength * sizeof(std::complex<float>), 4096);
+    shmSize = alignUp(dataOffset + numSlots * dataStride, 2 << 20);
+
+    // Readers run as the same user, or as members of shm_group
+    gid_t group = (gid_t)-1;
+    if(args.count("shm_group") != 0) {
+        const struct group *gr = getgrnam(args.at("shm_group").c_str());
+        if(gr == nullptr) {
+            stopShm();
+            throw std::runtime_error("Unknown shm_group " + args.at("shm_group"));
+        }
+        group = gr->gr_gid;
+    }
+
+    // Never take over a ring that exists, it may belong to another device
+    shmFd = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(shmFd < 0 and errno == EEXIST) {
+        stopShm();
+        throw std::runtime_error("Shared memory ring " + shmName + " already exists, remove /dev/shm" + shmName + " if it is stale");
+    }
+    if(shmFd < 0 or ftruncate(shmFd, shmSize) != 0
+            or (group != (gid_t)-1 and (fchown(shmFd, (uid_t)-1, group) != 0 or fchmod(shmFd, 0660) != 0))) {
+        const std::string err = std::strerror(errno);
+        stopShm();
+        throw std::runtime_error("Unable to create shared memory ring " + shmName + ": " + err);
+    }
+
+    void *base = mmap(nullptr, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, shmFd, 0);
+    if(base == MAP_FAILED) {
+        const std::string err = std::strerror(errno);
+        stopShm();
+        throw std::runtime_error("Unable to map shared memory ring " + shmName + ": " + err);
+    }
+    // Best effort, honoured when /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it
+    madvise(base, shmSize, MADV_HUGEPAGE);
+
+    SoapyBB60ShmHeader *header = (SoapyBB60ShmHeader *)base;
+    header->magic = BB60_SHM_MAGIC;
+    header->version = BB60_SHM_VERSION;
+    header->numSlots = numSlots;
+    header->slotLength = bufferLength;
+    header->slotOffset = slotOffset;
+    header->dataOffset = dataOffset;
+    header->dataStride = dataStride;
+    header->head = 0;
+    header->wake = 0;
+    header->waiters = 0;
+    header->alive = 1;
+
+    SoapyBB60ShmSlot *slots = (SoapyBB60ShmSlot *)((char *)base + slotOffset);
+    for(size_t i = 0; i < numSlots; i++) {
+        slots[i].seq = BB60_SHM_WRITING;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shmMutex);
+        shmHeader = header;
+    }
+
+    activateStream((SoapySDR::Stream *)shmStream);
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Writing IQ to shared memory %s (%zu blocks of %zu samples)",
+            shmName.c_str(), numSlots, bufferLength);
+}
+
+void SoapyBB60::stopShm(void)
+{
+    if(shmStream != nullptr) {
+        closeStream((SoapySDR::Stream *)shmStream);
+        shmStream = nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(shmMutex);
+
+    if(shmHeader != nullptr) {
+        // Wake sleeping readers so they notice the device is gone
+        shmHeader->alive = 0;
+        shmHeader->wake++;
+        syscall(SYS_futex, (uint32_t *)&shmHeader->wake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        munmap(shmHeader, shmSize);
+        shmHeader = nullptr;
+    }
+
+    if(shmFd >= 0) {
+        close(shmFd);
+        shm_unlink(shmName.c_str());
+        shmFd = -1;
+    }
+}
+
+void SoapyBB60::publishShm(const SoapyBB60Block *block)
+{
+    std::lock_guard<std::mutex> lock(shmMutex);
+
+    SoapyBB60ShmHeader *header = shmHeader;
+    if(header == nullptr) {
+        return;
+    }
+
+    const uint64_t seq = header->head.load(std::memory_order_relaxed);
+    SoapyBB60ShmSlot &slot = ((SoapyBB60ShmSlot *)((char *)header + header->slotOffset))[seq % header->numSlots];
+    char *data = (char *)header + header->dataOffset + (seq % header->numSlots) * header->dataStride;
+
+    // Readers still on the old contents see the slot change under them
+    slot.seq.store(BB60_SHM_WRITING, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const size_t numElems = std::min<size_t>(block->numElems, header->slotLength);
+    std::memcpy(data, block->data, numElems * sizeof(std::complex<float>));
+    slot.timeNs = block->timeNs;
+    slot.numElems = numElems;
+    slot.flags = SOAPY_SDR_HAS_TIME | (block->sampleLoss ? BB60_SHM_SAMPLE_LOSS : 0);
+    slot.frequency = block->frequency;
+    slot.sampleRate = block->sampleRate;
+
+    slot.seq.store(seq, std::memory_order_release);
+    header->head.store(seq + 1, std::memory_order_release);
+
+    header->wake++;
+    if(header->waiters.load() != 0) {
+        syscall(SYS_futex, (uint32_t *)&header->wake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
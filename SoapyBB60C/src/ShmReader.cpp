@@ -0,0 +1,124 @@
+#include "SoapyBB60Shm.hpp"
+
+#include <SoapySDR/Errors.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+SoapyBB60ShmReader::SoapyBB60ShmReader(const std::string &name)
+{
+    const std::string path = (name.empty() or name[0] != '/') ? "/" + name : name;
+
+    // Readers write the wait bookkeeping in the header, so map read-write
+    fd = shm_open(path.c_str(), O_RDWR, 0);
+    struct stat st;
+    if(fd < 0 or fstat(fd, &st) != 0 or (size_t)st.st_size < sizeof(SoapyBB60ShmHeader)) {
+        const std::string err = std::strerror(errno);
+        if(fd >= 0) close(fd);
+        throw std::runtime_error("Unable to open shared memory ring " + path + ": " + err);
+    }
+    size = st.st_size;
+
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Unable to map shared memory ring " + path);
+    }
+
+    header = (SoapyBB60ShmHeader *)base;
+    if(header->magic != BB60_SHM_MAGIC or header->version != BB60_SHM_VERSION) {
+        munmap(base, size);
+        close(fd);
+        throw std::runtime_error(path + " is not a BB60 shared memory ring");
+    }
+    slots = (SoapyBB60ShmSlot *)((char *)base + header->slotOffset);
+
+    // Start at the newest block
+    cursor = header->head.load(std::memory_order_acquire);
+}
+
+SoapyBB60ShmReader::~SoapyBB60ShmReader(void)
+{
+    munmap(base, size);
+    close(fd);
+}
+
+size_t SoapyBB60ShmReader::getBlockLength(void) const
+{
+    return header->slotLength;
+}
+
+size_t SoapyBB60ShmReader::getNumBlocks(void) const
+{
+    return header->numSlots;
+}
+
+int SoapyBB60ShmReader::acquire(SoapyBB60ShmBlock &block, const long timeoutUs)
+{
+    uint64_t head = header->head.load(std::memory_order_acquire);
+
+    if(head == cursor) {
+        if(not header->alive.load()) {
+            return SOAPY_SDR_STREAM_ERROR;
+        }
+
+        // Sleep on the futex word until the writer publishes
+        header->waiters.fetch_add(1);
+        const uint32_t wake = header->wake.load();
+        head = header->head.load(std::memory_order_acquire);
+        if(head == cursor) {
+            timespec ts;
+            ts.tv_sec = timeoutUs / 1000000;
+            ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+            syscall(SYS_futex, (uint32_t *)&header->wake, FUTEX_WAIT, wake, &ts, nullptr, 0);
+            head = header->head.load(std::memory_order_acquire);
+        }
+        header->waiters.fetch_sub(1);
+
+        if(head == cursor) {
+            return SOAPY_SDR_TIMEOUT;
+        }
+    }
+
+    // Lapped, skip to the oldest slot the writer is not about to refill
+    if(head - cursor >= header->numSlots) {
+        cursor = head - header->numSlots + 1;
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    const SoapyBB60ShmSlot &slot = slots[cursor % header->numSlots];
+    if(slot.seq.load(std::memory_order_acquire) != cursor) {
+        cursor = header->head.load(std::memory_order_acquire) - header->numSlots + 1;
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    block.data = (const std::complex<float> *)((const char *)base + header->dataOffset
+            + (cursor % header->numSlots) * header->dataStride);
+    block.numElems = slot.numElems;
+    block.seq = cursor;
+    block.timeNs = slot.timeNs;
+    block.flags = slot.flags;
+    block.frequency = slot.frequency;
+    block.sampleRate = slot.sampleRate;
+    cursor++;
+
+    // The descriptor may have been refilled while it was copied
+    return release(block) ? 0 : SOAPY_SDR_OVERFLOW;
+}
+
+bool SoapyBB60ShmReader::release(const SoapyBB60ShmBlock &block) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    return slots[block.seq % header->numSlots].seq.load(std::memory_order_relaxed) == block.seq;
+}
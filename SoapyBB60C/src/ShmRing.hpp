@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*******************************************************************
+ * Shared memory ring layout
+ *
+ * The device writes every acquired block into a POSIX shared memory
+ * object (/dev/shm/<name>) made of this header, numSlots slot
+ * descriptors and numSlots sample buffers of slotLength CF32 samples.
+ *
+ * Each slot is a seqlock: the writer sets seq to BB60_SHM_WRITING,
+ * fills the slot, then stores the block sequence number. A reader that
+ * sees the same sequence number before and after touching the samples
+ * knows they were not overwritten underneath it.
+ ******************************************************************/
+
+#define BB60_SHM_MAGIC 0x4d534242 // "BBSM"
+#define BB60_SHM_VERSION 1
+#define BB60_SHM_WRITING (~0ULL)
+#define BB60_SHM_SAMPLE_LOSS (1 << 30) // slot flag, the device dropped samples before this block
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 and ATOMIC_INT_LOCK_FREE == 2,
+        "Shared memory ring needs lock-free atomics");
+
+struct SoapyBB60ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numSlots;
+    uint32_t slotLength;               // CF32 samples per slot
+    uint64_t slotOffset;               // bytes from the start of the object to the slot descriptors
+    uint64_t dataOffset;               // bytes from the start of the object to the first sample buffer
+    uint64_t dataStride;               // bytes between sample buffers
+    std::atomic<uint64_t> head;        // sequence number of the next block to publish
+    std::atomic<uint32_t> wake;        // futex word, bumped on every publish
+    std::atomic<uint32_t> waiters;     // readers sleeping on wake
+    std::atomic<uint32_t> alive;       // cleared when the device closes
+};
+
+struct SoapyBB60ShmSlot {
+    std::atomic<uint64_t> seq;         // block sequence number, or BB60_SHM_WRITING
+    int64_t timeNs;
+    uint32_t numElems;
+    int32_t flags;                     // SoapySDR stream flags
+    double frequency;                  // center frequency the block was tuned to
+    double sampleRate;
+} __attribute__((aligned(64)));
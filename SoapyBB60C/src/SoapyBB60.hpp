@@ -3,6 +3,7 @@
 #include <SoapySDR/Device.hpp>
 #include <SoapySDR/Logger.h>
 #include <SoapySDR/Types.h>
+#include <SoapySDR/Version.h>
 
 #include <stdexcept>
 #include <thread>
@@ -12,11 +13,479 @@
 #include <string>
 #include <cstring>
 #include <algorithm>
-#include <atomic>
+#include <complex>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
 
 #include <bb_api.h>
 
-class SoapyBB60: public SoapySDR::Device {
+#include "Fft.hpp"
+#include "FastFilter.hpp"
+#include "Kernels.hpp"
+#include "SoapyBB60Async.hpp"
+
+#define BB60_CLOCK 40e6
+
+// Direct RF sampling of the BB60C, real samples at twice the IQ clock
+#define BB60_DIRECT_RF_RATE 80e6
+#define BB60_HALFBAND_TAPS 48
+
+// rf_mode setting
+#define BB60_RF_IQ 0                    // IF chain, tuned IQ
+#define BB60_RF_DIRECT 1                // real samples from the direct RF path
+#define BB60_RF_DIRECT_IQ 2             // direct RF converted to baseband around a quarter of its rate
+
+// Samples per power estimate used for squelch gating
+#define BB60_POWER_CHUNK 64
+
+// Per block smoothing of the automatic DC and IQ balance estimates
+#define BB60_CORRECTION_ALPHA 0.05
+
+// Reopen attempts after a USB error, doubling from the first delay up to the last
+#define BB60_RECOVERY_MIN_MS 100
+#define BB60_RECOVERY_MAX_MS 5000
+
+// Longest user filter the filter_taps and filter_file settings accept
+#define BB60_FILTER_MAX_TAPS 65536
+
+// Overload detection and AGC: samples within this of the reference level count as clipped,
+// levels are gathered over windows of this many seconds, and the AGC lowers the reference
+// level only after this many quiet windows in a row
+#define BB60_CLIP_MARGIN_DB 0.5
+#define BB60_LEVEL_WINDOW 0.1
+#define BB60_AGC_DECAY_WINDOWS 10
+
+// The history device arg is in seconds at this rate, and up to this many port 2
+// triggers are taken from each packet
+#define BB60_HISTORY_RATE 40e6
+#define BB60_MAX_TRIGGERS 64
+
+/*!
+ * Device configuration. Setters publish a new immutable snapshot, getters
+ * read the latest one and the acquisition thread applies the difference
+ * to the hardware between two bbGetIQ calls.
+ */
+struct SoapyBB60Config {
+    double centerFrequency = 100e6;
+    double sampleRate = 0.0;            // as requested, the actual rate follows decimation
+    int decimation = 1;
+    double bandwidth = BB60_CLOCK;
+    bool refMode = true;
+    double refLevel = -30.0;
+    double attenLevel = 0.0;
+    int rfGain = 0;
+    unsigned int port1 = 0;
+    unsigned int port2 = 0;
+    int rfMode = BB60_RF_IQ;
+    std::shared_ptr<const std::vector<std::complex<float>>> filterTaps; // user filter, shared between snapshots
+    int filterDecimation = 1;
+    bool agc = false;                   // the acquisition thread steers refLevel, see SoapyBB60Levels
+    double agcHeadroom = 10.0;          // dB from the peak up to the reference level
+    double agcHysteresis = 3.0;         // dB the headroom may drift before the AGC acts
+
+    //! Sample rate of the captured samples, before the user filter
+    double captureRate(void) const
+    {
+        if(rfMode == BB60_RF_DIRECT) return BB60_DIRECT_RF_RATE;
+        if(rfMode == BB60_RF_DIRECT_IQ) return BB60_DIRECT_RF_RATE / 2;
+        return BB60_CLOCK / decimation;
+    }
+
+    //! Sample rate of the blocks this configuration produces
+    double rate(void) const
+    {
+        return filterTaps ? captureRate() / filterDecimation : captureRate();
+    }
+
+    //! Frequency at the center of those blocks
+    double frequency(void) const
+    {
+        if(rfMode == BB60_RF_DIRECT) return 0.0;
+        if(rfMode == BB60_RF_DIRECT_IQ) return BB60_DIRECT_RF_RATE / 4;
+        return centerFrequency;
+    }
+
+    unsigned int streamFlags(void) const
+    {
+        return (rfMode == BB60_RF_IQ) ? BB_STREAM_IQ : BB_DIRECT_RF;
+    }
+};
+
+/*!
+ * One block of acquired samples, shared by every stream.
+ * refs counts the ring slot that publishes the block plus each
+ * stream currently reading from it; the block is only refilled
+ * by the acquisition thread once refs drops back to zero.
+ */
+struct SoapyBB60Block {
+    std::complex<float> *data = nullptr; // capacity samples, in the pool arena or heap
+    size_t capacity = 0;
+    std::vector<std::complex<float>> heap; // backing for the discard block
+    size_t numElems = 0;
+    unsigned long long seq = 0;
+    unsigned long long firstSample = 0; // samples published before this block, blocks may be short
+    long long timeNs = 0;
+    double sampleRate = 0.0;            // configuration the block was captured with
+    double frequency = 0.0;
+    unsigned long long epoch = 0;       // counts configuration changes applied while streaming
+    bool sampleLoss = false;
+    bool resumed = false;               // first block after the device was reopened, samples before it were lost
+    bool overload = false;              // the ADC overflowed or samples came within BB60_CLIP_MARGIN_DB of the reference level
+    size_t clips = 0;                   // samples that did
+    std::vector<float> power;           // mean power per BB60_POWER_CHUNK samples, when squelch is in use
+    bool hasPower = false;
+    std::atomic<unsigned> refs{0};
+};
+
+/*!
+ * Out-of-band stream event, reported through readStreamStatus.
+ */
+struct SoapyBB60Event {
+    int ret = 0;
+    int flags = 0;
+    long long timeNs = 0;
+    size_t chanMask = 0;
+};
+
+/*!
+ * Input levels over the current window, kept by the acquisition thread
+ * for the overload sensors and the AGC. Windows restart with each epoch,
+ * so levels measured at another reference level never mix.
+ */
+struct SoapyBB60Levels {
+    unsigned long long epoch = 0;
+    double samples = 0.0;               // in the current window
+    float peak = 0.0f;                  // mW
+    double sum = 0.0;
+    bool overload = false;
+    int quietWindows = 0;               // windows in a row with more headroom than needed
+    float quietPeak = 0.0f;             // loudest of them
+    unsigned long long agcGen = 0;      // configuration generation of the last AGC change
+};
+
+/*!
+ * Contiguous run of samples in the history ring, with one rate and
+ * frequency. Gaps and settings changes start a new segment.
+ */
+struct SoapyBB60HistorySegment {
+    unsigned long long start = 0;       // history sample index
+    long long timeNs = 0;               // of the first sample, 0 if unknown
+    double sampleRate = 0.0;
+    double frequency = 0.0;
+};
+
+/*!
+ * Window of the history ring to write to disk. A snapshot never crosses
+ * a segment boundary, so the file holds one rate and frequency.
+ */
+struct SoapyBB60Snapshot {
+    unsigned long long begin = 0;       // history sample indices
+    unsigned long long trigger = 0;
+    unsigned long long end = 0;
+    SoapyBB60HistorySegment segment;
+    std::string path;                   // without the .sigmf-data extension
+};
+
+/*!
+ * Energy squelch state for a gated stream.
+ * Positions are absolute sample indexes (block seq * block length + offset).
+ */
+struct SoapyBB60Squelch {
+    enum State { CLOSED, OPEN, TAIL };
+
+    bool enabled = false;
+    float threshold = 0.0f;             // linear power
+    size_t hangtime = 0;                // quiet samples tolerated before closing
+    size_t preroll = 0;                 // samples returned before the trigger
+    size_t postroll = 0;                // samples returned after closing
+
+    State state = CLOSED;
+    unsigned long long burstId = 0;
+    unsigned long long scanPos = 0;     // next chunk to judge, positions count from SoapyBB60Block::firstSample
+    unsigned long long emitPos = 0;     // next sample to return
+    unsigned long long startPos = 0;    // first sample of the current burst
+    unsigned long long endPos = 0;      // one past the last sample, once closing
+    long long startNs = 0;
+    size_t quiet = 0;
+    size_t tail = 0;
+    unsigned long long epoch = 0;       // configuration of the last sample returned
+    bool epochKnown = false;
+    std::deque<SoapyBB60Block *> window; // consecutive blocks held for pre-roll and emission
+};
+
+/*!
+ * One capture of the panoramic scanner, handed from the capture
+ * thread to the FFT worker.
+ */
+struct SoapyBB60PanoramaStep {
+    size_t index = 0;
+    long long timeNs = 0;
+    std::vector<std::complex<float>> data;
+};
+
+struct SoapyBB60OccupancyHeader;
+
+/*!
+ * Occupancy log of a panorama stream. Every complete scan is reduced into
+ * the bucket it started in, and the bucket is appended to the log once a
+ * scan starts in a later one. See OccupancyFile.hpp for the layout.
+ */
+struct SoapyBB60Occupancy {
+    std::string path;
+    long long bucketNs = 60000000000LL;
+    float threshold = -90.0f;           // dBm
+
+    // Bucket being reduced
+    long long bucketStartNs = 0;
+    long long firstNs = 0;
+    long long lastNs = 0;
+    uint32_t scans = 0;
+    bool partial = true;                // the logger started inside the bucket
+    std::vector<float> min, max;        // dBm
+    std::vector<double> sum;            // mW
+    std::vector<uint32_t> above;
+
+    // Data file and index, both mapped for capacity records
+    int fd = -1;
+    int indexFd = -1;
+    SoapyBB60OccupancyHeader *header = nullptr;
+    char *data = nullptr;
+    int64_t *index = nullptr;
+    size_t capacity = 0;
+};
+
+/*!
+ * Panoramic scanner state. The span is covered by steps of keep bins,
+ * the part of each FFT inside the IQ filter passband; output bin i is
+ * at start + i * binHz.
+ */
+struct SoapyBB60Panorama {
+    double start = 0.0;
+    double stop = 0.0;
+    size_t fftSize = 1024;
+    int decimation = 1;                 // IQ setup the steps were planned for
+    double bandwidth = 0.0;
+    double binHz = 0.0;
+    size_t keep = 0;
+    size_t numBins = 0;
+    std::vector<double> centers;        // step center frequencies
+    std::vector<float> window;
+    float scale = 1.0f;                 // window power normalization
+    SoapyBB60Fft fft;
+    std::vector<std::complex<float>> work;
+
+    // Capture thread to FFT worker, the capture of step n+1 overlaps the FFT of step n
+    std::deque<std::unique_ptr<SoapyBB60PanoramaStep>> full, empty;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    std::vector<float> building;        // scan being stitched by the worker
+    std::vector<float> ready;           // last complete scan
+    std::vector<float> output;          // scan being returned by readStream
+    long long buildingStartNs = 0;
+    long long readyStartNs = 0;
+    long long outputStartNs = 0;
+    unsigned long long scans = 0;       // complete scans
+    unsigned long long delivered = 0;   // scans returned by readStream
+
+    std::thread captureThread;
+    std::thread fftThread;
+    std::atomic<bool> running{false};
+    std::atomic<int> status{bbNoError};
+
+    std::unique_ptr<SoapyBB60Occupancy> occupancy;
+};
+
+/*!
+ * Power statistics on the shared acquisition. Every record holds the mean
+ * power, peak power and peak to average ratio of its window, then the CCDF
+ * (probability of exceeding the mean by each step in dB) and the APD
+ * (probability of exceeding each absolute level in dBm).
+ */
+struct SoapyBB60Stats {
+    double interval = 0.1;              // seconds per record
+    double ccdfMax = 20.0;              // dB above the mean
+    double ccdfStep = 0.1;
+    double apdMin = -120.0;             // dBm
+    double apdMax = 0.0;
+    double apdStep = 1.0;
+    float floor = 1e-15f;               // mW, start of the histogram
+
+    // Record being accumulated
+    double planRate = 0.0;
+    unsigned long long samplesPerRecord = 1;
+    unsigned long long count = 0;
+    std::vector<uint32_t> hist;
+    double sum = 0.0;
+    float peak = 0.0f;
+    long long recordNs = 0;
+    bool changed = false;               // the record starts at a settings change
+
+    // Record being read out
+    std::vector<float> output;
+    long long outputNs = 0;
+    size_t outOffset = 0;
+};
+
+/*!
+ * Channel power measurement on the shared acquisition. Every record holds,
+ * per channel, the mean integrated power in dBm and the percentage of FFTs
+ * whose channel power was above the threshold.
+ */
+struct SoapyBB60Channels {
+    std::vector<double> offsets;        // channel centers relative to the tuned frequency
+    std::vector<double> widths;
+    size_t fftSize = 1024;
+    double interval = 0.01;             // seconds per record
+    double threshold = 1e-9;            // occupancy threshold in mW
+    std::vector<float> window;
+    double scale = 1.0;                 // FFT power to mW, equivalent noise bandwidth corrected
+    SoapyBB60Fft fft;
+    std::vector<std::complex<float>> work;
+
+    // Bin ranges follow the sample rate of the blocks being measured
+    double planRate = 0.0;
+    std::vector<long> firstBin, lastBin;
+    size_t framesPerRecord = 1;
+
+    // Record being accumulated
+    size_t fill = 0;                    // samples in work
+    size_t frames = 0;
+    std::vector<double> powerSum;
+    std::vector<size_t> busy;
+    long long recordNs = 0;
+    bool changed = false;               // the record starts at a settings change
+
+    std::vector<float> output;          // record being returned by readStream
+    size_t outOffset = 0;
+    long long outputNs = 0;
+};
+
+/*!
+ * One channel of the demodulator bank. The channel is cut out of the
+ * shared input FFT around bin, filtered by response and brought back to
+ * the time domain at the bank's output rate.
+ */
+struct SoapyBB60DemodChannel {
+    double frequency = 0.0;             // carrier, absolute
+    int mode = BB_DEMOD_FM;             // BB_DEMOD_AM, BB_DEMOD_FM, BB_DEMOD_USB or BB_DEMOD_LSB
+    double bandwidth = 0.0;
+
+    // Planned for the current sample rate and center frequency
+    bool inBand = false;
+    long bin = 0;
+    std::vector<std::complex<float>> response; // filter over the output FFT, in FFT order
+    std::complex<double> rot, rotStep;  // frame to frame phase of the bin shift
+    std::complex<double> nco, ncoStep;  // removes the offset between carrier and bin
+    std::vector<std::complex<float>> work;
+    std::complex<float> prev;           // FM discriminator history
+    float dc = 0.0f;                    // AM carrier level
+
+    std::vector<float> audio;           // demodulated, not yet read
+    std::vector<float> held;            // unread audio from before a settings change, read first
+};
+
+/*!
+ * Demodulator bank, a fast convolution channelizer: one overlap-save FFT
+ * of the input per frame is shared by every channel, each of which then
+ * only needs a small inverse FFT. Channels of a frame are spread over a
+ * pool of workers and the reading thread.
+ */
+struct SoapyBB60Demod {
+    std::vector<SoapyBB60DemodChannel> channels;
+    size_t fftSize = 65536;
+    double minRate = 32000.0;           // lowest acceptable output rate
+    size_t numThreads = 0;
+
+    // Planned for the current sample rate
+    double planRate = 0.0;
+    double planFrequency = 0.0;
+    size_t outSize = 0;                 // inverse FFT size, output samples per frame before overlap
+    double outRate = 0.0;
+    SoapyBB60Fft fft;
+    SoapyBB60Fft outFft;
+
+    // Input frames, the first quarter is the tail of the previous frame
+    std::vector<std::complex<float>> input;
+    std::vector<std::complex<float>> spectrum;
+    size_t fill = 0;
+    long long frameNs = 0;
+    size_t audioOffset = 0;             // samples of every channel's audio already read
+    long long audioNs = 0;              // time of the next sample to read
+    long long heldNs = 0;               // time of the next held sample
+    double heldRate = 0.0;
+    bool changed = false;               // the next audio after the held audio starts at a settings change
+
+    // Worker pool, channels are claimed from next until all are done
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::condition_variable doneCond;
+    unsigned long long frame = 0;
+    std::atomic<size_t> next{0};
+    size_t done = 0;
+    bool running = false;
+};
+
+/*!
+ * Per-consumer stream state returned by setupStream.
+ * Each stream has its own format and read cursor into the block ring.
+ */
+struct SoapyBB60Stream {
+    std::string format;
+    bool active = false;
+    unsigned long long cursor = 0;      // sequence number of the next block to read
+    SoapyBB60Block *block = nullptr;    // partially consumed block (readStream)
+    size_t offset = 0;                  // read offset into block
+    bool overflow = false;              // report overflow on the next read
+    bool finite = false;                // burst armed by activateStream END_BURST or a timed stop
+    size_t burstRemaining = 0;          // samples left in a finite burst
+    bool timedStart = false;            // skip samples before startNs
+    long long startNs = 0;
+    bool timedStop = false;             // end the burst at stopNs
+    long long stopNs = 0;
+    std::vector<SoapyBB60Block *> held; // blocks acquired through direct access or handed to callback
+    SoapyBB60Async::Callback callback;  // async delivery from the acquisition thread
+    size_t maxInFlight = 0;
+    int notifyFd = -1;                  // eventfd, readable while notifyThreshold samples wait
+    size_t notifyThreshold = 0;
+    bool notifySignaled = false;        // notifyFd state, guarded by ringMutex
+    size_t partial = 0;                 // samples left in block after the last read, guarded by ringMutex
+    bool epochKnown = false;            // epoch of the samples read so far, unknown until the first block
+    unsigned long long epoch = 0;
+    SoapyBB60Kernels::ConvertState convert; // carried by the derived F32_ formats
+    SoapyBB60Squelch squelch;
+    std::unique_ptr<SoapyBB60Panorama> panorama;
+    std::unique_ptr<SoapyBB60Channels> channels;
+    std::unique_ptr<SoapyBB60Demod> demod;
+    std::unique_ptr<SoapyBB60Stats> stats;
+
+    std::deque<SoapyBB60Event> events;
+    std::mutex eventMutex;
+    std::condition_variable eventCond;
+};
+
+struct SoapyBB60NetHeader;
+struct SoapyBB60ShmHeader;
+
+/*!
+ * Remote client of the built-in network server.
+ */
+struct SoapyBB60Session {
+    unsigned id = 0;
+    int ctrlFd = -1;
+    int dataFd = -1;
+    SoapyBB60Stream *stream = nullptr;
+    unsigned long long seq = 0;
+    std::thread ctrlThread;
+    std::thread dataThread;
+    std::atomic<bool> running{true};
+    std::atomic<bool> streaming{false};
+};
+
+class SoapyBB60: public SoapySDR::Device, public SoapyBB60Async {
 public:
     SoapyBB60(const SoapySDR::Kwargs &args);
 
@@ -54,8 +523,6 @@ public:
 
     void closeStream(SoapySDR::Stream *stream);
 
-    bool updateStream();
-
     int activateStream(
             SoapySDR::Stream *stream,
             const int flags = 0,
@@ -72,6 +539,41 @@ public:
             long long &timeNs,
             const long timeoutUs = 100000);
 
+    int readStreamStatus(
+            SoapySDR::Stream *stream,
+            size_t &chanMask,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs = 100000);
+
+    size_t getStreamMTU(SoapySDR::Stream *stream) const;
+
+    /*******************************************************************
+     * Direct buffer access API
+     ******************************************************************/
+
+    size_t getNumDirectAccessBuffers(SoapySDR::Stream *stream);
+
+    int getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs);
+
+    int acquireReadBuffer(
+            SoapySDR::Stream *stream,
+            size_t &handle,
+            const void **buffs,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs = 100000);
+
+    void releaseReadBuffer(SoapySDR::Stream *stream, const size_t handle);
+
+    /*******************************************************************
+     * Async streaming API
+     ******************************************************************/
+
+    int setStreamCallback(SoapySDR::Stream *stream, const Callback &callback, const size_t maxInFlight);
+
+    int getStreamFd(SoapySDR::Stream *stream);
+
     /*******************************************************************
      * Antenna API
      ******************************************************************/
@@ -80,6 +582,36 @@ public:
 
     std::string getAntenna(const int direction, const size_t channel) const;
 
+    /*******************************************************************
+     * Frontend corrections API
+     ******************************************************************/
+
+    bool hasDCOffsetMode(const int direction, const size_t channel) const;
+
+    void setDCOffsetMode(const int direction, const size_t channel, const bool automatic);
+
+    bool getDCOffsetMode(const int direction, const size_t channel) const;
+
+    bool hasDCOffset(const int direction, const size_t channel) const;
+
+    void setDCOffset(const int direction, const size_t channel, const std::complex<double> &offset);
+
+    std::complex<double> getDCOffset(const int direction, const size_t channel) const;
+
+    bool hasIQBalance(const int direction, const size_t channel) const;
+
+    void setIQBalance(const int direction, const size_t channel, const std::complex<double> &balance);
+
+    std::complex<double> getIQBalance(const int direction, const size_t channel) const;
+
+#ifdef SOAPY_SDR_API_HAS_IQ_BALANCE_MODE
+    bool hasIQBalanceMode(const int direction, const size_t channel) const;
+
+    void setIQBalanceMode(const int direction, const size_t channel, const bool automatic);
+
+    bool getIQBalanceMode(const int direction, const size_t channel) const;
+#endif
+
     /*******************************************************************
      * Gain API
      ******************************************************************/
@@ -96,6 +628,12 @@ public:
 
     double getGain(const int direction, const size_t channel, const std::string &name) const;
 
+    bool hasGainMode(const int direction, const size_t channel) const;
+
+    void setGainMode(const int direction, const size_t channel, const bool automatic);
+
+    bool getGainMode(const int direction, const size_t channel) const;
+
     SoapySDR::Range getGainRange(const int direction, const size_t channel, const std::string &name) const;
 
     /*******************************************************************
@@ -170,19 +708,397 @@ public:
     std::string readSetting(const std::string &key) const;
 
 private:
-    int deviceId;
+    /*******************************************************************
+     * Acquisition
+     ******************************************************************/
+
+    void startAcquisition(void);
+
+    void stopAcquisition(void);
+
+    void acquisitionLoop(void);
+
+    bbStatus reopenDevice(void);
+
+    bool recoverDevice(void);
+
+    SoapyBB60Block *getFreeBlock(void);
+
+    void releaseBlock(SoapyBB60Block *block);
+
+    int waitForBlock(SoapyBB60Stream *s, SoapyBB60Block *&block, const long timeoutUs);
+
+    void postEvent(SoapyBB60Stream *s, const SoapyBB60Event &event);
+
+    bool checkEpoch(SoapyBB60Stream *s, const SoapyBB60Block *block, const size_t offset);
+
+    int armStream(SoapyBB60Stream *s, const int flags, const long long timeNs, const size_t numElems);
+
+    void deliverAsync(void);
+
+    void updateNotify(SoapyBB60Stream *s);
+
+    int readStreamData(
+            SoapyBB60Stream *s,
+            void * const *buffs,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs);
+
+    /*******************************************************************
+     * Configuration
+     ******************************************************************/
+
+    std::shared_ptr<const SoapyBB60Config> getConfig(void) const;
+
+    void updateStream(const SoapyBB60Config &next);
+
+    bool applyConfig(const bool initial);
+
+    void configureLevels(const SoapyBB60Config &c);
+
+    bool correctBlock(SoapyBB60Block *block);
+
+    /*******************************************************************
+     * Overload detection and AGC
+     ******************************************************************/
+
+    void writeAgcSetting(const std::string &key, const std::string &value);
+
+    std::string readAgcSetting(const std::string &key) const;
+
+    void measureLevels(SoapyBB60Block *block, const bool adcOverflow);
+
+    void runAgc(const float peak, const bool overload);
+
+    /*******************************************************************
+     * User filter
+     ******************************************************************/
+
+    void writeFilterSetting(const std::string &key, const std::string &value);
+
+    std::string readFilterSetting(const std::string &key) const;
+
+    void designFilter(void);
+
+    void filterBlock(SoapyBB60Block *block);
+
+    /*******************************************************************
+     * Memory and thread tuning
+     ******************************************************************/
+
+    void setupTuning(const SoapySDR::Kwargs &args);
+
+    void allocatePool(void);
+
+    void freePool(void);
+
+    void *mapMemory(size_t &size);
+
+    void tuneThread(const std::vector<int> &cpus, const int priority, const char *name);
+
+    int readSamples(
+            SoapyBB60Stream *s,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs,
+            const std::function<void(const std::complex<float> *, size_t)> &sink);
+
+    int readCompressed(
+            SoapyBB60Stream *s,
+            void * const *buffs,
+            const size_t numBytes,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs);
+
+    /*******************************************************************
+     * Squelch
+     ******************************************************************/
+
+    void setupSquelch(SoapyBB60Stream *s, const SoapySDR::Kwargs &args);
+
+    void resetSquelch(SoapyBB60Stream *s);
+
+    void trimSquelch(SoapyBB60Stream *s);
+
+    int readSquelch(
+            SoapyBB60Stream *s,
+            void * const *buffs,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs);
+
+    /*******************************************************************
+     * Panoramic scanner
+     ******************************************************************/
+
+    void setupPanorama(SoapyBB60Stream *s, const SoapySDR::Kwargs &args);
+
+    void startPanorama(SoapyBB60Stream *s);
+
+    void stopPanorama(SoapyBB60Stream *s);
+
+    void panoramaCaptureLoop(SoapyBB60Panorama *p);
+
+    void panoramaFftLoop(SoapyBB60Stream *s);
+
+    int readPanorama(
+            SoapyBB60Stream *s,
+            void * const *buffs,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs);
+
+    /*******************************************************************
+     * Occupancy log
+     ******************************************************************/
+
+    void setupOccupancy(SoapyBB60Panorama *p, const SoapySDR::Kwargs &args);
+
+    void reduceOccupancy(SoapyBB60Panorama *p, const long long startNs);
+
+    void flushOccupancy(SoapyBB60Panorama *p);
+
+    void closeOccupancy(SoapyBB60Panorama *p);
+
+    /*******************************************************************
+     * Channel power
+     ******************************************************************/
+
+    void setupChannels(SoapyBB60Stream *s, const SoapySDR::Kwargs &args);
+
+    void resetChannels(SoapyBB60Stream *s);
+
+    void planChannels(SoapyBB60Channels *c, const double rate);
+
+    void measureChannels(SoapyBB60Channels *c);
+
+    int readChannels(
+            SoapyBB60Stream *s,
+            void * const *buffs,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs);
+
+    /*******************************************************************
+     * Power statistics
+     ******************************************************************/
+
+    void setupStats(SoapyBB60Stream *s, const SoapySDR::Kwargs &args);
+
+    void resetStats(SoapyBB60Stream *s);
+
+    void finishStats(SoapyBB60Stats *st);
+
+    int readStats(
+            SoapyBB60Stream *s,
+            void * const *buffs,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs);
+
+    /*******************************************************************
+     * Demodulator bank
+     ******************************************************************/
+
+    void setupDemod(SoapyBB60Stream *s, const std::vector<size_t> &channels, const SoapySDR::Kwargs &args);
+
+    void resetDemod(SoapyBB60Stream *s);
+
+    size_t demodOutSize(const SoapyBB60Demod *d, const double rate) const;
+
+    void planDemod(SoapyBB60Demod *d, const double rate, const double frequency);
+
+    void startDemod(SoapyBB60Demod *d);
+
+    void stopDemod(SoapyBB60Demod *d);
+
+    void demodWorkerLoop(SoapyBB60Demod *d);
+
+    void demodWork(SoapyBB60Demod *d);
+
+    void demodChannel(SoapyBB60Demod *d, SoapyBB60DemodChannel &ch);
+
+    void demodFrame(SoapyBB60Demod *d);
+
+    int readDemod(
+            SoapyBB60Stream *s,
+            void * const *buffs,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs);
+
+    /*******************************************************************
+     * Network server
+     ******************************************************************/
+
+    void startServer(const std::string &url, const std::string &format);
+
+    void stopServer(void);
+
+    void serverLoop(void);
+
+    void serverHandshake(const int fd, const std::string &payload);
+
+    void udpServerLoop(const std::string &url, const std::string &format);
+
+    void sessionLoop(SoapyBB60Session *session);
+
+    void sessionDataLoop(SoapyBB60Session *session);
+
+    void stopSessionData(SoapyBB60Session *session);
+
+    std::string sessionCommand(SoapyBB60Session *session, const std::vector<std::string> &cmd);
+
+    size_t fillPackets(SoapyBB60Stream *s, const size_t maxBytes, unsigned long long &seq,
+            std::vector<std::vector<char>> &payloads, std::vector<SoapyBB60NetHeader> &headers, bool &failed);
+
+    /*******************************************************************
+     * Shared memory ring
+     ******************************************************************/
+
+    void startShm(const std::string &name, const SoapySDR::Kwargs &args);
+
+    void stopShm(void);
+
+    void publishShm(const SoapyBB60Block *block);
+
+    /*******************************************************************
+     * History ring and snapshots
+     ******************************************************************/
+
+    void startHistory(const double seconds);
+
+    void stopHistory(void);
+
+    void feedHistory(const SoapyBB60Block *block, const bbIQPacket &pkt);
+
+    bool requestSnapshot(const unsigned long long trigger, const SoapyBB60HistorySegment &segment);
+
+    void writeSnapshotSetting(const std::string &key, const std::string &value);
+
+    std::string readSnapshotSetting(const std::string &key) const;
+
+    void snapshotLoop(void);
+
+    void writeSnapshot(SoapyBB60Snapshot &snap);
+
+    std::atomic<int> deviceId{-1};        // replaced when the acquisition thread reopens the device
     int serial;
+    bool deviceOpen = true;               // false after a failed recovery, the next activation retries
+    bool resumePending = false;           // the next published block follows a recovery
+    std::atomic<long long> recoveryUs{0}; // duration of the last recovery
+    std::atomic<unsigned long long> recoveryCount{0};
 
-    // Cached settings
-    double sampleRate, centerFrequency, bandwidth;
-    int decimation;
-    bool streamActive;
-    int rfGain;
-    double refLevel;
-    double attenLevel;
-    bool refMode = true;
-    unsigned int port1 = 0;
-    unsigned int port2 = 0;
+    // Published configuration, only read through getConfig
+    std::shared_ptr<const SoapyBB60Config> config;
+    std::atomic<unsigned long long> configGen{0}; // bumped after every publish
+    mutable std::mutex configMutex;       // serializes setters, the sample path only try-locks it for the AGC
+    SoapyBB60Config acqConfig;            // what the hardware is running, owned by the acquisition thread
+    unsigned long long acqGen = 0;
+    unsigned long long acqEpoch = 0;      // configuration changes applied since the acquisition started
+    std::atomic<bool> streamActive{false};
+    std::vector<float> rfScratch;         // direct RF input to the decimator
+    SoapyBB60Kernels::QuarterRateDecimator rfDecimator;
+
+    // Shared acquisition state, one producer fanned out to every stream
+    size_t bufferLength = 8192;
+    size_t numBuffers = 128;
+    std::vector<std::unique_ptr<SoapyBB60Block>> pool; // numBuffers + 2 blocks, fixed until the last stream closes
+    SoapyBB60Block discardBlock;          // filled when every pool block is held, never published
+    std::vector<SoapyBB60Block *> ring;   // published blocks indexed by seq % ring.size()
+    unsigned long long ringHead = 0;      // sequence number of the next block to publish
+    unsigned long long ringTail = 0;      // sequence number of the oldest block still published
+    unsigned long long ringSamples = 0;   // samples in all blocks published so far
+    std::vector<SoapyBB60Stream *> streams;
+    size_t activeStreams = 0;
+    bool panoramaActive = false;          // a scanner owns the tuner, IQ streams cannot start
+    std::mutex streamMutex;               // guards streams and activation
+    std::mutex ringMutex;                 // guards pool, ring, ringHead, ringTail and ringSamples
+    std::condition_variable ringCond;
+    std::thread acqThread;
+    std::atomic<bool> acqRunning{false};
+    std::atomic<int> acqStatus{bbNoError};
+    std::atomic<int> squelchStreams{0};   // streams that need per-block power
+    std::vector<SoapyBB60Stream *> asyncStreams; // active streams with a callback
+    std::mutex asyncMutex;                // guards asyncStreams, held while callbacks run
+    std::vector<SoapyBB60Stream *> notifyStreams; // active streams with a notify fd, guarded by ringMutex
+
+    // Pool memory and thread placement, from the first stream's args
+    void *arenaBase = nullptr;
+    size_t arenaSize = 0;
+    bool useHugepages = false;
+    bool lockMemory = false;
+    int numaNode = -1;
+    std::vector<int> acqCpus;
+    int acqPriority = 0;
+    std::vector<int> workerCpus;
+    int workerPriority = 0;
+
+    // Front end corrections, applied to each block before it is published
+    bool dcAuto = false;
+    bool iqAuto = false;
+    std::complex<double> dcOffset;
+    std::complex<double> iqBalance;
+    mutable std::mutex corrMutex;         // guards the corrections against the acquisition thread
+
+    // User filter, run by the acquisition thread on corrected blocks
+    SoapyBB60FastFilter userFilter;
+    unsigned long long filterAnchorIndex = 0; // filter input index of the last timestamped block
+    long long filterAnchorNs = 0;
+    std::string filterPath;               // file of the loaded taps, guarded by configMutex
+
+    // Input levels, measured by the acquisition thread and read by the sensors
+    SoapyBB60Levels levels;
+    std::atomic<float> peakDb{-200.0f};   // of the last complete window
+    std::atomic<float> rmsDb{-200.0f};
+    std::atomic<unsigned long long> clipCount{0};
+    std::atomic<unsigned long long> overloadCount{0}; // blocks flagged as overloaded
+
+    // Network server
+    int serverFd = -1;
+    std::thread serverThread;
+    std::atomic<bool> serverRunning{false};
+    std::vector<std::unique_ptr<SoapyBB60Session>> sessions;
+    std::mutex sessionMutex;
+    unsigned nextSessionId = 1;
+
+    // Shared memory ring, written by the acquisition thread
+    std::string shmName;
+    int shmFd = -1;
+    size_t shmSize = 0;
+    SoapyBB60ShmHeader *shmHeader = nullptr;
+    SoapyBB60Stream *shmStream = nullptr; // keeps the acquisition running
+    std::mutex shmMutex;                  // guards shmHeader against the acquisition thread
+
+    // History ring, written by the acquisition thread and dumped by the snapshot thread
+    std::complex<float> *historyData = nullptr;
+    size_t historySize = 0;               // bytes mapped
+    size_t historyLength = 0;             // samples held
+    std::atomic<unsigned long long> historyHead{0}; // samples written since the start
+    std::atomic<unsigned long long> historyWriting{0}; // end of the copy in progress, published before it starts
+    SoapyBB60Stream *historyStream = nullptr; // keeps the acquisition running
+    std::vector<int> historyTriggers;     // port 2 trigger positions of the last packet
+    unsigned long long historyEpoch = 0;  // of the last block written, acquisition thread only
+    bool historyBreak = true;             // the next block starts a new segment
+    std::deque<SoapyBB60HistorySegment> historySegments;
+    std::deque<SoapyBB60Snapshot> snapshots; // waiting to be written, the front one is being written
+    double snapshotPre = 1.0;             // seconds before and after the trigger
+    double snapshotPost = 1.0;
+    std::string snapshotDir = ".";
+    std::string lastSnapshot;             // path of the last file written
+    bool historyRunning = false;
+    mutable std::mutex historyMutex;      // guards the segments, snapshots and snapshot settings
+    std::condition_variable historyCond;
+    std::thread snapshotThread;
     const std::map<int, double> bb60Decimation = {
         {8192, 4e3},
         {4096, 8e3},
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <SoapySDR/Device.hpp>
+
+#include <complex>
+#include <cstddef>
+#include <functional>
+
+/*!
+ * One block handed to an async stream callback.
+ * data points into the driver's block pool and stays valid until the
+ * block is returned with releaseReadBuffer(stream, handle).
+ */
+struct SoapyBB60AsyncBlock {
+    size_t handle = 0;
+    const std::complex<float> *data = nullptr;
+    size_t numElems = 0;
+    int flags = 0;
+    long long timeNs = 0;
+    double sampleRate = 0.0;
+    double frequency = 0.0;
+};
+
+/*!
+ * Event driven streaming for a locally opened BB60, reached with
+ * dynamic_cast<SoapyBB60Async *>(device). Remote devices do not implement it.
+ *
+ * With a callback, the acquisition thread calls it with each new block of
+ * the stream, in order, as soon as it is captured. ret is the number of
+ * samples, or SOAPY_SDR_OVERFLOW with an empty block when blocks were skipped.
+ * The callback must be quick and may only call releaseReadBuffer on the device.
+ */
+class SoapyBB60Async {
+public:
+    typedef std::function<void(SoapySDR::Stream *stream, int ret, const SoapyBB60AsyncBlock &block)> Callback;
+
+    virtual ~SoapyBB60Async(void) {}
+
+    /*!
+     * Deliver an inactive CF32 stream through callback instead of readStream,
+     * an empty callback goes back to readStream. At most maxInFlight blocks are
+     * handed out and not yet released; further blocks wait in the ring and are
+     * delivered with the next captured block, or skipped with an overflow once
+     * the ring laps them. maxInFlight may be at most half of the ring.
+     */
+    virtual int setStreamCallback(SoapySDR::Stream *stream, const Callback &callback, const size_t maxInFlight = 8) = 0;
+
+    /*!
+     * Pollable eventfd of a stream set up with the notify_samples stream arg, -1 otherwise.
+     * It is readable while at least notify_samples captured samples wait to be read,
+     * or while the next read would report an overflow or an error. readStream with
+     * a zero timeout never blocks, so one thread can serve many streams with epoll.
+     * The fd is owned by the stream and closed by closeStream.
+     */
+    virtual int getStreamFd(SoapySDR::Stream *stream) = 0;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "OccupancyFile.hpp"
+
+#include <string>
+#include <vector>
+
+/*!
+ * A range of records combined per bin.
+ * Min and max are the extremes over the range; mean and duty are
+ * weighted by the scans each record holds.
+ */
+struct SoapyBB60OccupancySpan {
+    long long startNs = 0;             // start of the first bucket
+    long long stopNs = 0;              // end of the last bucket
+    size_t numRecords = 0;
+    unsigned long long scans = 0;
+    std::vector<float> min;            // dBm, one per bin
+    std::vector<float> max;
+    std::vector<float> mean;
+    std::vector<float> duty;           // fraction of scans above the threshold
+};
+
+/*!
+ * Reader for the occupancy log of a panorama stream set up with occ_file.
+ * The log may be read while a device appends to it; refresh maps the
+ * records added since.
+ */
+class SoapyBB60OccupancyReader {
+public:
+    SoapyBB60OccupancyReader(const std::string &path);
+
+    ~SoapyBB60OccupancyReader(void);
+
+    //! Pick up new records, returns the number of records
+    size_t refresh(void);
+
+    size_t getNumRecords(void) const;
+
+    size_t getNumBins(void) const;
+
+    //! Frequency of bin 0 in Hz, bin i is at start + i * bin width
+    double getStartFrequency(void) const;
+
+    double getBinWidth(void) const;
+
+    long long getBucketNs(void) const;
+
+    double getThreshold(void) const;
+
+    //! Index of the first record whose bucket starts at or after timeNs
+    size_t find(const long long timeNs) const;
+
+    const SoapyBB60OccupancyRecord &getRecord(const size_t index) const;
+
+    /*!
+     * Combine records [first, last) for bins [firstBin, firstBin + numBins).
+     * \return false if the range holds no records
+     */
+    bool queryRecords(const size_t first, const size_t last,
+            const size_t firstBin, const size_t numBins, SoapyBB60OccupancySpan &span) const;
+
+    //! Combine the buckets that start in [startNs, stopNs)
+    bool query(const long long startNs, const long long stopNs,
+            const size_t firstBin, const size_t numBins, SoapyBB60OccupancySpan &span) const;
+
+private:
+    bool map(void);
+
+    long long startOf(const size_t index) const;
+
+    int fd = -1;
+    int indexFd = -1;
+    void *data = nullptr;
+    size_t dataSize = 0;
+    const int64_t *index = nullptr;
+    size_t indexSize = 0;
+    const SoapyBB60OccupancyHeader *header = nullptr;
+    size_t numRecords = 0;
+    std::vector<float> power;          // mW for every stored level
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "Network.hpp"
+
+#include <SoapySDR/Device.hpp>
+#include <SoapySDR/Logger.h>
+#include <SoapySDR/Types.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*!
+ * Client for a SoapyBB60 served over the network with the serve device arg.
+ * TCP servers are fully controllable, UDP servers are receive only.
+ */
+class SoapyBB60Remote: public SoapySDR::Device {
+public:
+    SoapyBB60Remote(const SoapySDR::Kwargs &args);
+
+    ~SoapyBB60Remote(void);
+
+    /*******************************************************************
+     * Identification API
+     ******************************************************************/
+
+    std::string getDriverKey(void) const;
+
+    std::string getHardwareKey(void) const;
+
+    SoapySDR::Kwargs getHardwareInfo(void) const;
+
+    /*******************************************************************
+     * Channels API
+     ******************************************************************/
+
+    size_t getNumChannels(const int) const;
+
+    /*******************************************************************
+     * Stream API
+     ******************************************************************/
+
+    std::vector<std::string> getStreamFormats(const int direction, const size_t channel) const;
+
+    std::string getNativeStreamFormat(const int direction, const size_t channel, double &fullScale) const;
+
+    SoapySDR::Stream *setupStream(const int direction, const std::string &format,
+            const std::vector<size_t> &channels = std::vector<size_t>(),
+            const SoapySDR::Kwargs &args = SoapySDR::Kwargs());
+
+    void closeStream(SoapySDR::Stream *stream);
+
+    size_t getStreamMTU(SoapySDR::Stream *stream) const;
+
+    int activateStream(
+            SoapySDR::Stream *stream,
+            const int flags = 0,
+            const long long timeNs = 0,
+            const size_t numElems = 0);
+
+    int deactivateStream(SoapySDR::Stream *stream, const int flags = 0, const long long timeNs = 0);
+
+    int readStream(
+            SoapySDR::Stream *stream,
+            void * const *buffs,
+            const size_t numElems,
+            int &flags,
+            long long &timeNs,
+            const long timeoutUs = 100000);
+
+    /*******************************************************************
+     * Antenna API
+     ******************************************************************/
+
+    std::vector<std::string> listAntennas(const int direction, const size_t channel) const;
+
+    std::string getAntenna(const int direction, const size_t channel) const;
+
+    /*******************************************************************
+     * Gain API
+     ******************************************************************/
+
+    std::vector<std::string> listGains(const int direction, const size_t channel) const;
+
+    void setGain(const int direction, const size_t channel, const std::string &name, const double value);
+
+    void setGain(const int direction, const size_t channel, const double value);
+
+    double getGain(const int dir, const size_t channel) const;
+
+    double getGain(const int direction, const size_t channel, const std::string &name) const;
+
+    SoapySDR::Range getGainRange(const int direction, const size_t channel, const std::string &name) const;
+
+    /*******************************************************************
+     * Frequency API
+     ******************************************************************/
+
+    void setFrequency(
+            const int direction,
+            const size_t channel,
+            const std::string &name,
+            const double frequency,
+            const SoapySDR::Kwargs &args = SoapySDR::Kwargs());
+
+    double getFrequency(const int direction, const size_t channel, const std::string &name) const;
+
+    std::vector<std::string> listFrequencies(const int direction, const size_t channel) const;
+
+    SoapySDR::RangeList getFrequencyRange(const int direction, const size_t channel, const std::string &name) const;
+
+    /*******************************************************************
+     * Sample Rate API
+     ******************************************************************/
+
+    void setSampleRate(const int direction, const size_t channel, const double rate);
+
+    double getSampleRate(const int direction, const size_t channel) const;
+
+    std::vector<double> listSampleRates(const int direction, const size_t channel) const;
+
+    /*******************************************************************
+     * Bandwidth API
+     ******************************************************************/
+
+    void setBandwidth(const int direction, const size_t channel, const double bw);
+
+    double getBandwidth(const int direction, const size_t channel) const;
+
+    std::vector<double> listBandwidths(const int direction, const size_t channel) const;
+
+    /*******************************************************************
+     * Sensor API
+     ******************************************************************/
+
+    std::vector<std::string> listSensors(void) const;
+
+    std::string readSensor(const std::string &key) const;
+
+    /*******************************************************************
+     * Settings API
+     ******************************************************************/
+
+    void writeSetting(const std::string &key, const std::string &value);
+
+    std::string readSetting(const std::string &key) const;
+
+private:
+    std::string call(const std::vector<std::string> &cmd) const;
+
+    std::vector<double> callList(const std::vector<std::string> &cmd) const;
+
+    int readPending(void * const *buffs, const size_t numElems, int &flags, long long &timeNs);
+
+    std::string url;
+    bool udp = false;
+    int ctrlFd = -1;
+    int dataFd = -1;
+    mutable std::mutex ctrlMutex;
+
+    // Stream state, one stream per connection
+    std::string format;
+    size_t elemSize = 0;
+    size_t mtu = 0;
+    double rate = 0.0;
+    bool streamSetup = false;
+    unsigned long long nextSeq = 0;
+    bool seqValid = false;
+
+    // Payload left over when a packet is larger than the read buffer
+    SoapyBB60NetHeader pendingHdr;
+    std::vector<char> pending;
+    size_t pendingOffset = 0;
+    std::vector<char> spill;            // UDP receive overflow area
+};
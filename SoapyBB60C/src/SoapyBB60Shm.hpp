@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ShmRing.hpp"
+
+#include <complex>
+#include <string>
+
+/*!
+ * One block borrowed from the shared memory ring.
+ * data points straight into shared memory and stays valid until the
+ * writer laps the reader; check with SoapyBB60ShmReader::release.
+ */
+struct SoapyBB60ShmBlock {
+    const std::complex<float> *data = nullptr;
+    size_t numElems = 0;
+    unsigned long long seq = 0;
+    long long timeNs = 0;
+    int flags = 0;
+    double frequency = 0.0;
+    double sampleRate = 0.0;
+};
+
+/*!
+ * Zero-copy reader for a BB60 opened with the shm device arg.
+ * Any number of processes may read the same ring, each with its own cursor.
+ * The writer never waits for readers; a reader that falls behind by a whole
+ * ring gets SOAPY_SDR_OVERFLOW and skips ahead.
+ */
+class SoapyBB60ShmReader {
+public:
+    SoapyBB60ShmReader(const std::string &name);
+
+    ~SoapyBB60ShmReader(void);
+
+    /*!
+     * Wait for the next block.
+     * \return 0, SOAPY_SDR_TIMEOUT, SOAPY_SDR_OVERFLOW when blocks were
+     * missed, or SOAPY_SDR_STREAM_ERROR once the device has closed
+     */
+    int acquire(SoapyBB60ShmBlock &block, const long timeoutUs = 100000);
+
+    /*!
+     * Finish with a block.
+     * \return false if the writer overwrote the samples while they were held
+     */
+    bool release(const SoapyBB60ShmBlock &block) const;
+
+    size_t getBlockLength(void) const;
+
+    size_t getNumBlocks(void) const;
+
+private:
+    int fd = -1;
+    void *base = nullptr;
+    size_t size = 0;
+    SoapyBB60ShmHeader *header = nullptr;
+    SoapyBB60ShmSlot *slots = nullptr;
+    unsigned long long cursor = 0;
+};
@@ -0,0 +1,228 @@
+#include "SoapyBB60.hpp"
+#include "Kernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+/*******************************************************************
+ * Squelch setup
+ ******************************************************************/
+
+void SoapyBB60::setupSquelch(SoapyBB60Stream *s, const SoapySDR::Kwargs &args)
+{
+    SoapyBB60Squelch &sq = s->squelch;
+
+    if(args.count("squelch") == 0 or args.at("squelch").empty()) {
+        return;
+    }
+
+    try {
+        const double thresholdDb = std::stod(args.at("squelch"));
+        sq.threshold = std::pow(10.0, thresholdDb / 10.0);
+        sq.hangtime = std::stoul(args.count("squelch_hang") ? args.at("squelch_hang") : "1024");
+        sq.preroll = std::stoul(args.count("squelch_preroll") ? args.at("squelch_preroll") : "256");
+        sq.postroll = std::stoul(args.count("squelch_postroll") ? args.at("squelch_postroll") : "256");
+    } catch (const std::exception &) {
+        throw std::runtime_error("setupStream: squelch arguments must be numbers");
+    }
+
+    sq.enabled = true;
+    squelchStreams++;
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Squelch %s dBFS, hang %zu, pre-roll %zu, post-roll %zu",
+        args.at("squelch").c_str(), sq.hangtime, sq.preroll, sq.postroll);
+}
+
+void SoapyBB60::resetSquelch(SoapyBB60Stream *s)
+{
+    SoapyBB60Squelch &sq = s->squelch;
+
+    for(auto block : sq.window) releaseBlock(block);
+    sq.window.clear();
+
+    sq.state = SoapyBB60Squelch::CLOSED;
+    sq.scanPos = sq.emitPos = sq.startPos = sq.endPos = 0;
+    sq.quiet = sq.tail = 0;
+}
+
+/*******************************************************************
+ * Gated read
+ ******************************************************************/
+
+// Held block containing the sample position, the window is contiguous
+static SoapyBB60Block *windowBlock(const std::deque<SoapyBB60Block *> &window, const unsigned long long pos)
+{
+    auto it = std::upper_bound(window.begin(), window.end(), pos,
+        [](const unsigned long long p, const SoapyBB60Block *block) { return p < block->firstSample; });
+    return *(it - 1);
+}
+
+void SoapyBB60::trimSquelch(SoapyBB60Stream *s)
+{
+    // Drop held blocks that are neither needed for pre-roll nor still to be returned
+    SoapyBB60Squelch &sq = s->squelch;
+
+    unsigned long long keepFrom = (sq.scanPos > sq.preroll) ? sq.scanPos - sq.preroll : 0;
+    if(sq.state != SoapyBB60Squelch::CLOSED or sq.emitPos < sq.endPos) {
+        keepFrom = std::min(keepFrom, sq.emitPos);
+    }
+
+    while(not sq.window.empty() and sq.window.front()->firstSample + sq.window.front()->numElems <= keepFrom) {
+        releaseBlock(sq.window.front());
+        sq.window.pop_front();
+    }
+}
+
+int SoapyBB60::readSquelch(
+        SoapyBB60Stream *s,
+        void * const *buffs,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    SoapyBB60Squelch &sq = s->squelch;
+    const size_t elemSize = SoapyBB60Kernels::formatSize(s->format);
+    char *out = (char *)buffs[0];
+    size_t produced = 0;
+
+    flags = 0;
+
+    // A quiet channel still delivers blocks, so the timeout is one deadline for the whole read
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+
+    while(produced < numElems) {
+        // Return samples of the current burst that have already been judged
+        const unsigned long long limit = (sq.state == SoapyBB60Squelch::CLOSED) ? sq.endPos : sq.scanPos;
+        if(sq.emitPos < limit) {
+            SoapyBB60Block *block = windowBlock(sq.window, sq.emitPos);
+            const size_t offset = sq.emitPos - block->firstSample;
+
+            // A read never spans a settings change, the first read after one is flagged
+            if(sq.epochKnown and block->epoch != sq.epoch) {
+                if(produced != 0) break;
+                flags |= SOAPY_SDR_USER_FLAG1;
+            }
+            sq.epochKnown = true;
+            sq.epoch = block->epoch;
+
+            if(produced == 0) {
+                if(sq.emitPos == sq.startPos) flags |= SOAPY_SDR_USER_FLAG0;
+                if(block->timeNs != 0) {
+                    timeNs = block->timeNs + (long long)(offset * 1e9 / block->sampleRate);
+                    flags |= SOAPY_SDR_HAS_TIME;
+                }
+            }
+
+            const size_t n = std::min<unsigned long long>(std::min<unsigned long long>(numElems - produced,
+                limit - sq.emitPos), block->numElems - offset);
+            // Bursts are not contiguous, a phase step never spans two of them
+            if(sq.emitPos == sq.startPos) s->convert.hasLast = false;
+            s->convert.freqScale = (float)(block->sampleRate / (2 * M_PI));
+            SoapyBB60Kernels::convertSamples(s->format, block->data + offset, out + produced * elemSize, n, &s->convert);
+            produced += n;
+            sq.emitPos += n;
+
+            if(sq.state == SoapyBB60Squelch::CLOSED and sq.emitPos == sq.endPos) {
+                // End of burst, report it and never mix two bursts in one read
+                flags |= SOAPY_SDR_END_BURST;
+
+                SoapyBB60Event event;
+                event.flags = SOAPY_SDR_END_BURST | ((sq.startNs != 0) ? SOAPY_SDR_HAS_TIME : 0);
+                event.timeNs = sq.startNs;
+                event.chanMask = sq.burstId++;
+                postEvent(s, event);
+
+                trimSquelch(s);
+                break;
+            }
+
+            trimSquelch(s);
+            continue;
+        }
+
+        // Need another block to judge
+        if(sq.window.empty() or sq.scanPos >= sq.window.back()->firstSample + sq.window.back()->numElems) {
+            SoapyBB60Block *block = nullptr;
+            const long waitUs = (produced != 0) ? 0 : std::max<long>(std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now()).count(), 0);
+            int ret = waitForBlock(s, block, waitUs);
+            if(ret == SOAPY_SDR_OVERFLOW) {
+                // The gap truncates any open burst
+                resetSquelch(s);
+                if(produced == 0) return ret;
+                s->overflow = true;
+                break;
+            }
+            if(ret != 0) {
+                if(produced == 0) return ret;
+                break;
+            }
+
+            if(sq.window.empty()) {
+                sq.scanPos = block->firstSample;
+            }
+            checkEpoch(s, block, 0);
+            sq.window.push_back(block);
+            continue;
+        }
+
+        // Judge the next chunk of the newest block
+        SoapyBB60Block *block = sq.window.back();
+        const size_t offset = sq.scanPos - block->firstSample;
+        const size_t len = std::min<size_t>(BB60_POWER_CHUNK, block->numElems - offset);
+        const bool loud = block->hasPower and block->power[offset / BB60_POWER_CHUNK] >= sq.threshold;
+        const unsigned long long chunkStart = sq.scanPos;
+        sq.scanPos += len;
+
+        switch(sq.state) {
+        case SoapyBB60Squelch::CLOSED:
+            if(loud) {
+                // Open, reaching back for pre-roll but not into the previous burst
+                const unsigned long long oldest = sq.window.front()->firstSample;
+                unsigned long long start = (chunkStart > sq.preroll) ? chunkStart - sq.preroll : 0;
+                start = std::max(start, std::max(oldest, sq.endPos));
+
+                SoapyBB60Block *first = windowBlock(sq.window, start);
+                sq.startNs = (first->timeNs != 0) ?
+                    first->timeNs + (long long)((start - first->firstSample) * 1e9 / first->sampleRate) : 0;
+                sq.startPos = sq.emitPos = start;
+                sq.quiet = 0;
+                sq.state = SoapyBB60Squelch::OPEN;
+            }
+            break;
+        case SoapyBB60Squelch::OPEN:
+            if(loud) {
+                sq.quiet = 0;
+                break;
+            }
+            sq.quiet += len;
+            if(sq.quiet >= sq.hangtime) {
+                if(sq.postroll == 0) {
+                    sq.endPos = sq.scanPos;
+                    sq.state = SoapyBB60Squelch::CLOSED;
+                } else {
+                    sq.tail = sq.postroll;
+                    sq.state = SoapyBB60Squelch::TAIL;
+                }
+            }
+            break;
+        case SoapyBB60Squelch::TAIL:
+            if(loud) {
+                sq.quiet = 0;
+                sq.state = SoapyBB60Squelch::OPEN;
+            } else if(sq.tail <= len) {
+                sq.endPos = chunkStart + sq.tail;
+                sq.state = SoapyBB60Squelch::CLOSED;
+            } else {
+                sq.tail -= len;
+            }
+            break;
+        }
+
+        trimSquelch(s);
+    }
+
+    return produced;
+}
@@ -0,0 +1,201 @@
+#include "SoapyBB60.hpp"
+#include "Kernels.hpp"
+
+#include <chrono>
+#include <cmath>
+
+/*******************************************************************
+ * Power statistics setup
+ ******************************************************************/
+
+void SoapyBB60::setupStats(SoapyBB60Stream *s, const SoapySDR::Kwargs &args)
+{
+    std::unique_ptr<SoapyBB60Stats> st(new SoapyBB60Stats);
+
+    try {
+        st->interval = std::stod(args.at("stats"));
+        if(args.count("ccdf_max") != 0) st->ccdfMax = std::stod(args.at("ccdf_max"));
+        if(args.count("ccdf_step") != 0) st->ccdfStep = std::stod(args.at("ccdf_step"));
+        if(args.count("apd_min") != 0) st->apdMin = std::stod(args.at("apd_min"));
+        if(args.count("apd_max") != 0) st->apdMax = std::stod(args.at("apd_max"));
+        if(args.count("apd_step") != 0) st->apdStep = std::stod(args.at("apd_step"));
+    } catch (const std::exception &) {
+        throw std::runtime_error("setupStream: stats, ccdf_max, ccdf_step, apd_min, apd_max and apd_step must be numbers");
+    }
+
+    if(st->interval <= 0.0 or st->ccdfStep <= 0.0 or st->ccdfMax < 0.0 or st->apdStep <= 0.0 or st->apdMax < st->apdMin) {
+        throw std::runtime_error("setupStream: stats needs a positive interval and steps and non-empty CCDF and APD ranges");
+    }
+
+    // From the floor up to +30 dBm, well above the BB60 input range
+    const size_t numBins = (size_t)std::ceil(std::log2(1e3 / st->floor) * (1 << (23 - BB60_HISTOGRAM_SHIFT))) + 1;
+    st->hist.assign(numBins, 0);
+
+    const size_t ccdfPoints = (size_t)std::floor(st->ccdfMax / st->ccdfStep + 1e-9) + 1;
+    const size_t apdPoints = (size_t)std::floor((st->apdMax - st->apdMin) / st->apdStep + 1e-9) + 1;
+    st->output.assign(3 + ccdfPoints + apdPoints, 0.0f);
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Power statistics: %.3f ms records, %zu CCDF and %zu APD points",
+            st->interval * 1e3, ccdfPoints, apdPoints);
+
+    s->stats = std::move(st);
+    resetStats(s);
+}
+
+void SoapyBB60::resetStats(SoapyBB60Stream *s)
+{
+    SoapyBB60Stats *st = s->stats.get();
+
+    st->planRate = 0.0;
+    st->count = 0;
+    std::fill(st->hist.begin(), st->hist.end(), 0);
+    st->sum = 0.0;
+    st->peak = 0.0f;
+    st->changed = false;
+    st->outOffset = 0;
+}
+
+/*******************************************************************
+ * Curves
+ ******************************************************************/
+
+void SoapyBB60::finishStats(SoapyBB60Stats *st)
+{
+    const size_t numBins = st->hist.size();
+    const double count = st->count;
+
+    // Samples at or above each bin
+    std::vector<double> above(numBins + 1, 0.0);
+    for(size_t i = numBins; i-- > 0;) {
+        above[i] = above[i + 1] + st->hist[i];
+    }
+
+    uint32_t floorBits;
+    std::memcpy(&floorBits, &st->floor, sizeof(floorBits));
+    const uint32_t mask = (1u << BB60_HISTOGRAM_SHIFT) - 1;
+    const uint32_t topBits = floorBits + (uint32_t(numBins - 1) << BB60_HISTOGRAM_SHIFT);
+
+    // Percentage of samples above a power in mW, interpolated within its bin
+    auto exceed = [&](const double level) {
+        const float t = (float)level;
+        uint32_t bits;
+        std::memcpy(&bits, &t, sizeof(bits));
+        if(not (t > st->floor)) return 100.0;
+        bits = std::min(bits, topBits);
+        const uint32_t offset = bits - floorBits;
+        const size_t i = offset >> BB60_HISTOGRAM_SHIFT;
+        const double frac = (offset & mask) / (double)(mask + 1);
+        return 100.0 * (above[i + 1] + st->hist[i] * (1.0 - frac)) / count;
+    };
+
+    const double mean = st->sum / count;
+    st->output[0] = 10.0f * std::log10(mean + 1e-20);
+    st->output[1] = 10.0f * std::log10(st->peak + 1e-20);
+    st->output[2] = st->output[1] - st->output[0];
+
+    const size_t ccdfPoints = (size_t)std::floor(st->ccdfMax / st->ccdfStep + 1e-9) + 1;
+    float *ccdf = st->output.data() + 3;
+    for(size_t k = 0; k < ccdfPoints; k++) {
+        ccdf[k] = (float)exceed(mean * std::pow(10.0, k * st->ccdfStep / 10.0));
+    }
+
+    float *apd = ccdf + ccdfPoints;
+    for(size_t k = 0; k < st->output.size() - 3 - ccdfPoints; k++) {
+        apd[k] = (float)exceed(std::pow(10.0, (st->apdMin + k * st->apdStep) / 10.0));
+    }
+
+    st->outputNs = st->recordNs;
+    st->count = 0;
+    std::fill(st->hist.begin(), st->hist.end(), 0);
+    st->sum = 0.0;
+    st->peak = 0.0f;
+}
+
+/*******************************************************************
+ * Record read
+ ******************************************************************/
+
+int SoapyBB60::readStats(
+        SoapyBB60Stream *s,
+        void * const *buffs,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    SoapyBB60Stats *st = s->stats.get();
+
+    flags = 0;
+
+    // Accumulate the next record once the previous one was read out completely
+    if(st->outOffset == 0) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+
+        while(st->planRate == 0.0 or st->count < st->samplesPerRecord) {
+            const long waitUs = std::max<long>(std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now()).count(), 0);
+            // One sample plans the record length, so no sample past the record is consumed
+            const size_t want = (st->planRate == 0.0) ? 1 : st->samplesPerRecord - st->count;
+
+            int readFlags = 0;
+            long long readNs = 0;
+            bool restarted = false;
+            int ret = readSamples(s, want, readFlags, readNs, waitUs,
+                [&](const std::complex<float> *in, size_t n) {
+                    const SoapyBB60Block *block = s->block;
+
+                    // A record never mixes two configurations, the read starts at a change
+                    const bool change = (readFlags & SOAPY_SDR_USER_FLAG1) != 0 and not restarted;
+                    if(change) {
+                        restarted = true;
+                        st->changed = true;
+                    }
+                    if(change or block->sampleRate != st->planRate) {
+                        st->planRate = block->sampleRate;
+                        st->samplesPerRecord = std::max<long long>(std::llround(st->interval * st->planRate), 1);
+                        st->count = 0;
+                        std::fill(st->hist.begin(), st->hist.end(), 0);
+                        st->sum = 0.0;
+                        st->peak = 0.0f;
+                    }
+                    if(st->count == 0) {
+                        st->recordNs = (block->timeNs != 0) ?
+                            block->timeNs + (long long)(s->offset * 1e9 / block->sampleRate) : 0;
+                    }
+
+                    const size_t len = std::min<unsigned long long>(n, st->samplesPerRecord - st->count);
+                    SoapyBB60Kernels::powerHistogram(in, len, st->floor, st->hist.data(), st->hist.size(), st->sum, st->peak);
+                    st->count += len;
+                });
+
+            // A gap spoils the record, start over after reporting it
+            if(ret == SOAPY_SDR_OVERFLOW or s->overflow) {
+                s->overflow = false;
+                st->planRate = 0.0;
+                return SOAPY_SDR_OVERFLOW;
+            }
+            if(ret < 0) return ret;
+            if(ret == 0 and waitUs == 0) return SOAPY_SDR_TIMEOUT;
+        }
+
+        finishStats(st);
+        flags |= SOAPY_SDR_USER_FLAG0;
+        if(st->changed) flags |= SOAPY_SDR_USER_FLAG1;
+        st->changed = false;
+    }
+
+    const size_t n = std::min(numElems, st->output.size() - st->outOffset);
+    std::memcpy(buffs[0], st->output.data() + st->outOffset, n * sizeof(float));
+    st->outOffset += n;
+    if(st->outputNs != 0) {
+        timeNs = st->outputNs;
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+
+    if(st->outOffset == st->output.size()) {
+        flags |= SOAPY_SDR_END_BURST;
+        st->outOffset = 0;
+    }
+
+    return n;
+}
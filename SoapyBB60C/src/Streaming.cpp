@@ -1,12 +1,27 @@
 #include "SoapyBB60.hpp"
+#include "Kernels.hpp"
+#include "Trace.hpp"
 
 #include <SoapySDR/Formats.hpp>
 
+#include <chrono>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 std::vector<std::string> SoapyBB60::getStreamFormats(const int direction, const size_t channel) const {
     std::vector<std::string> formats;
 
     formats.push_back(SOAPY_SDR_CF32);
     formats.push_back(SOAPY_SDR_CS16);
+    formats.push_back(SOAPY_SDR_CS12);
+    formats.push_back(BB60_FORMAT_CS16Z);
+    formats.push_back(SOAPY_SDR_F32);
+    formats.push_back(BB60_FORMAT_POWER);
+    formats.push_back(BB60_FORMAT_DB);
+    formats.push_back(BB60_FORMAT_MAG);
+    formats.push_back(BB60_FORMAT_PHASE);
+    formats.push_back(BB60_FORMAT_FREQ);
 
     return formats;
 }
@@ -20,71 +35,1072 @@ std::string SoapyBB60::getNativeStreamFormat(const int direction, const size_t c
 SoapySDR::ArgInfoList SoapyBB60::getStreamArgsInfo(const int direction, const size_t channel) const {
     SoapySDR::ArgInfoList streamArgs;
 
+    SoapySDR::ArgInfo arg;
+
+    arg.key = "bufflen";
+    arg.value = std::to_string(bufferLength);
+    arg.name = "Buffer Length";
+    arg.description = "Number of samples per acquisition block, shared by all streams";
+    arg.units = "samples";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "buffers";
+    arg.value = std::to_string(numBuffers);
+    arg.name = "Ring Buffers";
+    arg.description = "Number of acquisition blocks kept for consumers before a slow stream overflows";
+    arg.units = "buffers";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "squelch";
+    arg.value = "";
+    arg.name = "Squelch";
+    arg.description = "Energy squelch threshold, only bursts above it are returned (empty disables)";
+    arg.units = "dBFS";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "squelch_hang";
+    arg.value = "1024";
+    arg.name = "Squelch Hangtime";
+    arg.description = "Samples below the threshold tolerated before a burst closes";
+    arg.units = "samples";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "squelch_preroll";
+    arg.value = "256";
+    arg.name = "Squelch Pre-roll";
+    arg.description = "Samples returned before the start of a burst";
+    arg.units = "samples";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "squelch_postroll";
+    arg.value = "256";
+    arg.name = "Squelch Post-roll";
+    arg.description = "Samples returned after a burst closes";
+    arg.units = "samples";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "pano_start";
+    arg.value = "";
+    arg.name = "Panorama Start";
+    arg.description = "Start of the panoramic scan, set with pano_stop and the F32 format";
+    arg.units = "Hz";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "pano_stop";
+    arg.value = "";
+    arg.name = "Panorama Stop";
+    arg.description = "End of the panoramic scan";
+    arg.units = "Hz";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "pano_fft";
+    arg.value = "1024";
+    arg.name = "Panorama FFT Size";
+    arg.description = "FFT size per scan step, a power of two; the bin width is the sample rate over this";
+    arg.units = "bins";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "channels";
+    arg.value = "";
+    arg.name = "Channels";
+    arg.description = "Channel power measurement with the F32 format, <offset>:<width>,... in Hz from the tuned frequency";
+    arg.units = "Hz";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "chan_fft";
+    arg.value = "1024";
+    arg.name = "Channel FFT Size";
+    arg.description = "FFT size of the channel power measurement, a power of two";
+    arg.units = "bins";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "chan_interval";
+    arg.value = "0.01";
+    arg.name = "Channel Interval";
+    arg.description = "Time averaged into each channel power record";
+    arg.units = "s";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "chan_threshold";
+    arg.value = "-90";
+    arg.name = "Occupancy Threshold";
+    arg.description = "Channel power above which an FFT counts as occupied";
+    arg.units = "dBm";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "stats";
+    arg.value = "";
+    arg.name = "Power Statistics";
+    arg.description = "CCDF, APD and peak to average records with the F32 format, one per this many seconds";
+    arg.units = "s";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "ccdf_max";
+    arg.value = "20";
+    arg.name = "CCDF Range";
+    arg.description = "Highest CCDF point above the mean power";
+    arg.units = "dB";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "ccdf_step";
+    arg.value = "0.1";
+    arg.name = "CCDF Step";
+    arg.description = "Spacing of the CCDF points";
+    arg.units = "dB";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "apd_min";
+    arg.value = "-120";
+    arg.name = "APD Start";
+    arg.description = "Lowest APD level";
+    arg.units = "dBm";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "apd_max";
+    arg.value = "0";
+    arg.name = "APD Stop";
+    arg.description = "Highest APD level";
+    arg.units = "dBm";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "apd_step";
+    arg.value = "1";
+    arg.name = "APD Step";
+    arg.description = "Spacing of the APD levels";
+    arg.units = "dB";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "demod";
+    arg.value = "";
+    arg.name = "Demodulator Bank";
+    arg.description = "Demodulate channels to F32 audio, <frequency>:<AM|FM|USB|LSB>[:<bandwidth>],... in Hz, one buffer per channel";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "demod_fft";
+    arg.value = "65536";
+    arg.name = "Demodulator FFT Size";
+    arg.description = "Channelizer FFT size, a power of two; channel filter edges are 16 bins wide";
+    arg.units = "bins";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "demod_rate";
+    arg.value = "32000";
+    arg.name = "Demodulator Rate";
+    arg.description = "Lowest acceptable audio rate, the actual rate is the sample rate over a power of two";
+    arg.units = "Hz";
+    arg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "demod_threads";
+    arg.value = "";
+    arg.name = "Demodulator Threads";
+    arg.description = "Worker threads besides the reading thread (default: the smaller of cores and channels, minus one)";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "hugepages";
+    arg.value = "false";
+    arg.name = "Huge Pages";
+    arg.description = "Back the sample buffers with huge pages, falling back to transparent huge pages";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::BOOL;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "numa_node";
+    arg.value = "-1";
+    arg.name = "NUMA Node";
+    arg.description = "Allocate the sample buffers on this NUMA node (-1 for the default policy)";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "mlock";
+    arg.value = "false";
+    arg.name = "Lock Buffers";
+    arg.description = "Lock the sample buffers in RAM";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::BOOL;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "acq_cpus";
+    arg.value = "";
+    arg.name = "Acquisition CPUs";
+    arg.description = "CPUs the acquisition thread may run on, e.g. 2 or 2-3 (empty for any)";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "acq_priority";
+    arg.value = "0";
+    arg.name = "Acquisition Priority";
+    arg.description = "SCHED_FIFO priority of the acquisition thread (0 for normal scheduling)";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "notify_samples";
+    arg.value = "0";
+    arg.name = "Notify Samples";
+    arg.description = "Buffered samples that make the stream's pollable fd readable (0 for no fd)";
+    arg.units = "samples";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "worker_cpus";
+    arg.value = "";
+    arg.name = "Worker CPUs";
+    arg.description = "CPUs the other driver threads (network server) may run on (empty for any)";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::STRING;
+
+    streamArgs.push_back(arg);
+
+    arg.key = "worker_priority";
+    arg.value = "0";
+    arg.name = "Worker Priority";
+    arg.description = "SCHED_FIFO priority of the other driver threads (0 for normal scheduling)";
+    arg.units = "";
+    arg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(arg);
+
     return streamArgs;
 }
 
+/*******************************************************************
+ * Stream setup
+ ******************************************************************/
+
 SoapySDR::Stream *SoapyBB60::setupStream(
         const int direction,
         const std::string &format,
         const std::vector<size_t> &channels,
         const SoapySDR::Kwargs &args)
 {
-    // Check channel config
-    if(channels.size() > 1 or (channels.size() > 0 and channels.at(0) != 0)) {
+    // Check channel config, a demodulator bank checks its own
+    if(args.count("demod") == 0 and (channels.size() > 1 or (channels.size() > 0 and channels.at(0) != 0))) {
         throw std::runtime_error("setupStream invalid channel selection");
     }
 
     // Check format
     if(format == SOAPY_SDR_CF32) {
         SoapySDR_log(SOAPY_SDR_INFO, "Using format CF32");
-        bbConfigureIQDataType(deviceId, bbDataType32fc);
     } else if(format == SOAPY_SDR_CS16) {
         SoapySDR_log(SOAPY_SDR_INFO, "Using format CS16");
-        bbConfigureIQDataType(deviceId, bbDataType16sc);
+    } else if(format == SOAPY_SDR_CS12) {
+        SoapySDR_log(SOAPY_SDR_INFO, "Using format CS12");
+    } else if(format == BB60_FORMAT_CS16Z) {
+        SoapySDR_log(SOAPY_SDR_INFO, "Using format CS16Z (compressed CS16, counted in bytes)");
+    } else if(format == SOAPY_SDR_F32 and args.count("pano_start") != 0 and args.count("pano_stop") != 0) {
+        SoapySDR_log(SOAPY_SDR_INFO, "Using format F32 (panorama power in dBm)");
+    } else if(format == SOAPY_SDR_F32 and args.count("demod") != 0) {
+        SoapySDR_log(SOAPY_SDR_INFO, "Using format F32 (demodulated audio, one buffer per channel)");
+    } else if(format == SOAPY_SDR_F32 and args.count("channels") != 0) {
+        SoapySDR_log(SOAPY_SDR_INFO, "Using format F32 (channel power in dBm and occupancy in %)");
+    } else if(format == SOAPY_SDR_F32 and args.count("stats") != 0) {
+        SoapySDR_log(SOAPY_SDR_INFO, "Using format F32 (power statistics, CCDF and APD in %)");
+    } else if(format == SOAPY_SDR_F32) {
+        SoapySDR_log(SOAPY_SDR_INFO, "Using format F32 (real part, for rf_mode DIRECT_RF)");
+    } else if(format == BB60_FORMAT_POWER or format == BB60_FORMAT_DB or format == BB60_FORMAT_MAG
+            or format == BB60_FORMAT_PHASE or format == BB60_FORMAT_FREQ) {
+        SoapySDR_logf(SOAPY_SDR_INFO, "Using format %s (one float per sample)", format.c_str());
     } else {
         throw std::runtime_error("setupStream: Invalid format '" + format
-            + "' -- Only CF32 and CS16 are supported by SoapyBB60C module.");
+            + "' -- Only CF32, CS16, CS12, CS16Z, F32 and the derived F32_ formats are supported by SoapyBB60C module.");
+    }
+
+    // The scanner drives the tuner itself and does not use the block pool
+    if(format == SOAPY_SDR_F32 and args.count("pano_start") != 0 and args.count("pano_stop") != 0) {
+        SoapyBB60Stream *s = new SoapyBB60Stream;
+        s->format = format;
+        try {
+            setupPanorama(s, args);
+        } catch (...) {
+            delete s;
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(streamMutex);
+        streams.push_back(s);
+        return (SoapySDR::Stream *)s;
+    }
+
+    if((format == BB60_FORMAT_CS16Z or args.count("channels") != 0 or args.count("demod") != 0 or args.count("stats") != 0)
+            and args.count("squelch") != 0) {
+        throw std::runtime_error("setupStream: squelch is not supported with CS16Z, channels, stats or demod");
+    }
+    if(format != SOAPY_SDR_F32 and args.count("demod") != 0) {
+        throw std::runtime_error("setupStream: demod needs the F32 format");
+    }
+
+    std::lock_guard<std::mutex> lock(streamMutex);
+
+    // The block pool is shared, so only the first stream can size it
+    if(pool.empty()) {
+        try {
+            if(args.count("bufflen") != 0) bufferLength = std::stoul(args.at("bufflen"));
+            if(args.count("buffers") != 0) numBuffers = std::stoul(args.at("buffers"));
+        } catch (const std::exception &) {
+            throw std::runtime_error("setupStream: bufflen and buffers must be numbers");
+        }
+        if(bufferLength == 0 or numBuffers < 2) {
+            throw std::runtime_error("setupStream: bufflen must be > 0 and buffers >= 2");
+        }
+        setupTuning(args);
+
+        std::lock_guard<std::mutex> ringLock(ringMutex);
+        ring.assign(numBuffers, nullptr);
+        // Every ring slot, plus one block in flight and one spare
+        allocatePool();
+    } else if(args.count("bufflen") != 0 or args.count("buffers") != 0) {
+        SoapySDR_log(SOAPY_SDR_WARNING, "setupStream: bufflen/buffers ignored, buffer pool already in use");
     }
 
-    return (SoapySDR::Stream *)this;
+    SoapyBB60Stream *s = new SoapyBB60Stream;
+    s->format = format;
+    try {
+        if(args.count("notify_samples") != 0) s->notifyThreshold = std::stoul(args.at("notify_samples"));
+    } catch (const std::exception &) {
+        delete s;
+        throw std::runtime_error("setupStream: notify_samples must be a number");
+    }
+    if(s->notifyThreshold != 0) {
+        s->notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(s->notifyFd < 0) {
+            delete s;
+            throw std::runtime_error("setupStream: eventfd failed: " + std::string(strerror(errno)));
+        }
+    }
+    try {
+        setupSquelch(s, args);
+        if(format == SOAPY_SDR_F32 and args.count("demod") != 0) setupDemod(s, channels, args);
+        else if(format == SOAPY_SDR_F32 and args.count("channels") != 0) setupChannels(s, args);
+        else if(format == SOAPY_SDR_F32 and args.count("stats") != 0) setupStats(s, args);
+    } catch (...) {
+        if(s->notifyFd >= 0) close(s->notifyFd);
+        delete s;
+        throw;
+    }
+    streams.push_back(s);
+
+    return (SoapySDR::Stream *)s;
 }
 
 void SoapyBB60::closeStream(SoapySDR::Stream *stream)
 {
-    bbAbort(deviceId);
-    bbCloseDevice(deviceId);
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    deactivateStream(stream);
+
+    std::lock_guard<std::mutex> lock(streamMutex);
+
+    streams.erase(std::remove(streams.begin(), streams.end(), s), streams.end());
+    if(s->squelch.enabled) squelchStreams--;
+    for(auto block : s->held) releaseBlock(block);
+    if(s->notifyFd >= 0) close(s->notifyFd);
+    if(s->panorama and s->panorama->occupancy) closeOccupancy(s->panorama.get());
+    delete s;
+
+    // Let the next setupStream resize the pool once nobody uses it
+    if(streams.empty()) {
+        std::lock_guard<std::mutex> ringLock(ringMutex);
+        ring.clear();
+        freePool();
+    }
 }
 
-bool SoapyBB60::updateStream()
+size_t SoapyBB60::getStreamMTU(SoapySDR::Stream *stream) const
 {
-    if(streamActive) {
-        bbStatus status = bbInitiate(deviceId, BB_STREAMING, BB_STREAM_IQ);
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    // A whole scan per read
+    if(s->panorama) {
+        return s->panorama->numBins;
+    }
+
+    // A whole record, power and occupancy per channel
+    if(s->channels) {
+        return s->channels->output.size();
+    }
+
+    // A whole record, the summary values and both curves
+    if(s->stats) {
+        return s->stats->output.size();
+    }
+
+    // Audio samples per channel for about one block of input
+    if(s->demod) {
+        const size_t m = demodOutSize(s->demod.get(), getConfig()->rate());
+        return std::max<size_t>(bufferLength * m / s->demod->fftSize, 1);
+    }
+
+    // Compressed streams are sized in bytes, enough for a block at worst case
+    if(s->format == BB60_FORMAT_CS16Z) {
+        return ((bufferLength + BB60_COMPRESS_FRAME - 1) / BB60_COMPRESS_FRAME) * BB60_COMPRESS_MAX_FRAME;
+    }
+
+    return bufferLength;
+}
+
+/*******************************************************************
+ * Acquisition
+ ******************************************************************/
+
+void SoapyBB60::startAcquisition(void)
+{
+    // A recovery interrupted by deactivation left the device closed
+    if(not deviceOpen) {
+        const bbStatus status = reopenDevice();
         if(status != bbNoError) {
-            SoapySDR_logf(SOAPY_SDR_ERROR, "Initiate: %s", bbGetErrorString(status));
+            SoapySDR_logf(SOAPY_SDR_ERROR, "OpenDevice: %s", bbGetErrorString(status));
+            acqStatus = status;
+            return;
+        }
+    }
+
+    // Always acquire natively, each stream converts to its own format
+    bbConfigureIQDataType(deviceId, bbDataType32fc);
+    applyConfig(true);
+    historyBreak = true;
+
+    bbStatus status = bbInitiate(deviceId, BB_STREAMING, acqConfig.streamFlags());
+    acqStatus = status < bbNoError ? status : bbNoError;
+    if(status != bbNoError) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Initiate: %s", bbGetErrorString(status));
+        if(status < bbNoError) return;
+    }
+
+    acqRunning = true;
+    acqThread = std::thread(&SoapyBB60::acquisitionLoop, this);
+}
+
+bool SoapyBB60::applyConfig(const bool initial)
+{
+    BB60_TRACE_SCOPE("applyConfig");
+
+    // Generation first, a publish racing with this is applied on the next call
+    const unsigned long long gen = configGen.load(std::memory_order_acquire);
+    const std::shared_ptr<const SoapyBB60Config> next = getConfig();
+    bool changed = initial;
+
+    if(initial or next->centerFrequency != acqConfig.centerFrequency) {
+        bbStatus status = bbConfigureIQCenter(deviceId, next->centerFrequency);
+        if(status != bbNoError) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureIQCenter: %s", bbGetErrorString(status));
+        }
+        changed = true;
+    }
+
+    if(initial or next->decimation != acqConfig.decimation or next->bandwidth != acqConfig.bandwidth) {
+        // Choose the smaller - bandwidth or sample rate
+        double actual_bw = std::min(bb60Decimation.at(next->decimation), next->bandwidth);
+        bbStatus status = bbConfigureIQ(deviceId, next->decimation, actual_bw);
+        if(status != bbNoError) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureIQ: %s", bbGetErrorString(status));
+        }
+        changed = true;
+    }
+
+    if(initial or next->refMode != acqConfig.refMode or next->refLevel != acqConfig.refLevel
+            or next->attenLevel != acqConfig.attenLevel or next->rfGain != acqConfig.rfGain) {
+        configureLevels(*next);
+        changed = true;
+    }
+
+    if(initial or next->rfMode != acqConfig.rfMode) {
+        if(next->rfMode == BB60_RF_DIRECT_IQ) {
+            if(rfDecimator.taps.empty()) rfDecimator.design(BB60_HALFBAND_TAPS);
+            rfDecimator.reset();
+            rfScratch.resize(2 * bufferLength);
+        }
+        changed = true;
+    }
+
+    const bool filterChanged = initial or next->filterTaps != acqConfig.filterTaps
+        or next->filterDecimation != acqConfig.filterDecimation;
+
+    acqConfig = *next;
+    acqGen = gen;
+
+    // A new filter changes the block rate, so it starts a new epoch like a retune
+    if(filterChanged) {
+        designFilter();
+        changed = true;
+    }
+
+    // History from before a change would smear across it
+    if(changed and userFilter.active()) {
+        userFilter.reset();
+    }
+
+    return changed;
+}
+
+/*******************************************************************
+ * USB error recovery
+ ******************************************************************/
+
+// Errors of the USB link, the device itself is fine once reopened
+static bool recoverable(const bbStatus status)
+{
+    return status == bbDeviceConnectionErr or status == bbUSBTimeoutErr or status == bbPacketFramingErr;
+}
+
+bbStatus SoapyBB60::reopenDevice(void)
+{
+    if(deviceOpen) {
+        bbAbort(deviceId);
+        bbCloseDevice(deviceId);
+        deviceOpen = false;
+    }
+
+    int handle = -1;
+    bbStatus status = bbOpenDeviceBySerialNumber(&handle, serial);
+    if(status != bbNoError) {
+        return status;
+    }
+    deviceId = handle;
+    deviceOpen = true;
+
+    // A reopened device starts from its defaults, the ports are only set while idle
+    const std::shared_ptr<const SoapyBB60Config> c = getConfig();
+    status = bbConfigureIO(deviceId, c->port1, c->port2);
+    if(status != bbNoError) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureIO: %s", bbGetErrorString(status));
+    }
+
+    return bbNoError;
+}
+
+bool SoapyBB60::recoverDevice(void)
+{
+    BB60_TRACE_SCOPE("recoverDevice");
+
+    const auto start = std::chrono::steady_clock::now();
+    long backoffMs = BB60_RECOVERY_MIN_MS;
+
+    while(acqRunning) {
+        bbStatus status = reopenDevice();
+        if(status == bbNoError) {
+            // Everything the setters cached, including changes made while disconnected
+            bbConfigureIQDataType(deviceId, bbDataType32fc);
+            applyConfig(true);
+            status = bbInitiate(deviceId, BB_STREAMING, acqConfig.streamFlags());
+            if(status >= bbNoError) {
+                const long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+                recoveryUs = us;
+                recoveryCount++;
+                SoapySDR_logf(SOAPY_SDR_WARNING, "Recovered BB60 S/N %d after %.1f ms", serial, us / 1e3);
+
+                // The samples that follow are a new epoch and the first block reports the gap
+                acqEpoch++;
+                resumePending = true;
+                return true;
+            }
+        }
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "Reopen BB60 S/N %d: %s, retry in %ld ms", serial, bbGetErrorString(status), backoffMs);
+
+        // Sleep in short steps so deactivation is not held up by the backoff
+        const auto retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoffMs);
+        while(acqRunning and std::chrono::steady_clock::now() < retry) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        backoffMs = std::min<long>(backoffMs * 2, BB60_RECOVERY_MAX_MS);
+    }
+
+    return false;
+}
+
+void SoapyBB60::stopAcquisition(void)
+{
+    acqRunning = false;
+    if(acqThread.joinable()) {
+        acqThread.join();
+    }
+    ringCond.notify_all();
+
+    bbAbort(deviceId);
+}
+
+SoapyBB60Block *SoapyBB60::getFreeBlock(void)
+{
+    std::lock_guard<std::mutex> lock(ringMutex);
+
+    // A block with no references is neither published nor held by a stream
+    for(auto &block : pool) {
+        if(block->refs == 0) return block.get();
+    }
+
+    // The pool is fixed, so retire the oldest published blocks until one comes free; readers behind them overflow
+    while(ringTail != ringHead) {
+        SoapyBB60Block *&slot = ring[ringTail % ring.size()];
+        SoapyBB60Block *block = slot;
+        slot = nullptr;
+        ringTail++;
+        releaseBlock(block);
+        if(block->refs == 0) return block;
+    }
+
+    // Every block is held by a consumer, capture into the discard block rather than stall the producer
+    return &discardBlock;
+}
+
+void SoapyBB60::releaseBlock(SoapyBB60Block *block)
+{
+    block->refs--;
+}
+
+void SoapyBB60::acquisitionLoop(void)
+{
+    tuneThread(acqCpus, acqPriority, "Acquisition");
+
+    while(acqRunning) {
+        // Configuration changes are applied here, never while inside bbGetIQ
+        if(configGen.load(std::memory_order_acquire) != acqGen and applyConfig(false)) {
+            BB60_TRACE_SCOPE("bbInitiate");
+            bbStatus status = bbInitiate(deviceId, BB_STREAMING, acqConfig.streamFlags());
+            if(status < bbNoError) {
+                SoapySDR_logf(SOAPY_SDR_ERROR, "Initiate: %s", bbGetErrorString(status));
+                if(recoverable(status) and recoverDevice()) continue;
+                acqStatus = status;
+                acqRunning = false;
+                break;
+            }
+            // Every sample from here on was captured with the new configuration
+            acqEpoch++;
+        }
+
+        SoapyBB60Block *block = getFreeBlock();
+
+        bbIQPacket pkt;
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.iqData = block->data;
+        pkt.iqCount = block->capacity;
+        if(historyData != nullptr and (acqConfig.port2 == BB_PORT2_IN_TRIGGER_RISING_EDGE
+                or acqConfig.port2 == BB_PORT2_IN_TRIGGER_FALLING_EDGE)) {
+            std::fill(historyTriggers.begin(), historyTriggers.end(), 0);
+            pkt.triggers = historyTriggers.data();
+            pkt.triggerCount = historyTriggers.size();
+        }
+        if(acqConfig.rfMode == BB60_RF_DIRECT_IQ) {
+            // Twice the real samples, decimated into the block below
+            pkt.iqData = rfScratch.data();
+            pkt.iqCount = 2 * bufferLength;
+        }
+
+        bbStatus status;
+        {
+            BB60_TRACE_SCOPE("bbGetIQ");
+            status = bbGetIQ(deviceId, &pkt);
+        }
+        if(status < bbNoError) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "GetIQ: %s", bbGetErrorString(status));
+            if(recoverable(status) and recoverDevice()) continue;
+            acqStatus = status;
+            acqRunning = false;
+            break;
+        } else if(status != bbNoError) {
+            SoapySDR_logf(SOAPY_SDR_DEBUG, "GetIQ: %s", bbGetErrorString(status));
+        }
+
+        if(pkt.sampleLoss == BB_TRUE) {
+            BB60_TRACE_INSTANT("sampleLoss");
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Sample Overrun");
+        }
+
+        block->numElems = pkt.iqCount;
+        block->timeNs = (long long)pkt.sec * 1000000000LL + pkt.nano;
+        block->sampleRate = acqConfig.rate();
+        block->frequency = acqConfig.frequency();
+        block->epoch = acqEpoch;
+        block->sampleLoss = (pkt.sampleLoss == BB_TRUE);
+
+        // Direct RF delivers real samples
+        if(acqConfig.rfMode == BB60_RF_DIRECT) {
+            SoapyBB60Kernels::realToComplex((const float *)block->data, block->data, pkt.iqCount);
+        } else if(acqConfig.rfMode == BB60_RF_DIRECT_IQ) {
+            BB60_TRACE_SCOPE("decimate");
+            rfDecimator.process(rfScratch.data(), pkt.iqCount & ~1, block->data);
+            block->numElems = pkt.iqCount / 2;
+            if(block->timeNs != 0) {
+                block->timeNs -= (long long)(rfDecimator.delay() * 1e9 / BB60_DIRECT_RF_RATE);
+            }
+        }
+
+        {
+            BB60_TRACE_SCOPE("levels");
+            measureLevels(block, status == bbADCOverflow);
+        }
+
+        // Power is estimated once here and shared by every gated stream, after the user filter
+        const bool filtering = userFilter.active();
+        block->hasPower = (squelchStreams > 0) and not filtering;
+        if(block->hasPower) {
+            block->power.resize((block->numElems + BB60_POWER_CHUNK - 1) / BB60_POWER_CHUNK);
+        }
+        {
+            BB60_TRACE_SCOPE("correct");
+            // The IQ balance of a real signal is its mirror image, leave it alone
+            const bool corrected = (acqConfig.rfMode != BB60_RF_DIRECT) and correctBlock(block);
+            if(not corrected and block->hasPower) {
+                SoapyBB60Kernels::chunkPower(block->data, block->numElems, BB60_POWER_CHUNK, block->power.data());
+            }
+        }
+
+        {
+            BB60_TRACE_SCOPE("history");
+            feedHistory(block, pkt);
+        }
+
+        if(filtering) {
+            {
+                BB60_TRACE_SCOPE("filter");
+                filterBlock(block);
+            }
+
+            // Nothing to publish while the filter fills its first frame
+            if(block->numElems == 0) continue;
+
+            block->hasPower = (squelchStreams > 0);
+            if(block->hasPower) {
+                block->power.resize((block->numElems + BB60_POWER_CHUNK - 1) / BB60_POWER_CHUNK);
+                SoapyBB60Kernels::chunkPower(block->data, block->numElems, BB60_POWER_CHUNK, block->power.data());
+            }
+        }
+
+        // The streams lose this capture, the next published block reports the gap like a recovery
+        if(block == &discardBlock) {
+            if(not resumePending) {
+                SoapySDR_log(SOAPY_SDR_WARNING, "Every sample block is held by a stream, dropping samples");
+            }
+            acqEpoch++;
+            resumePending = true;
+            continue;
+        }
+
+        block->resumed = resumePending;
+        resumePending = false;
+
+        {
+            std::lock_guard<std::mutex> lock(ringMutex);
+
+            // Publish, dropping the ring's reference to the block it replaces
+            SoapyBB60Block *&slot = ring[ringHead % ring.size()];
+            if(slot != nullptr) releaseBlock(slot);
+            block->seq = ringHead;
+            block->firstSample = ringSamples;
+            block->refs = 1;
+            slot = block;
+            ringHead++;
+            ringSamples += block->numElems;
+            if(ringHead - ringTail > ring.size()) ringTail = ringHead - ring.size();
+
+            for(auto s : notifyStreams) updateNotify(s);
+        }
+        ringCond.notify_all();
+
+        deliverAsync();
+        publishShm(block);
+    }
+
+    // A stopped acquisition is reported by the next read, wake any poller for it
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        for(auto s : notifyStreams) updateNotify(s);
+    }
+    ringCond.notify_all();
+}
+
+bool SoapyBB60::correctBlock(SoapyBB60Block *block)
+{
+    SoapyBB60Kernels::IQCorrection corr;
+    {
+        std::lock_guard<std::mutex> lock(corrMutex);
+        if(not dcAuto and not iqAuto and dcOffset == 0.0 and iqBalance == 0.0) {
             return false;
         }
+        corr.dcI = dcOffset.real();
+        corr.dcQ = dcOffset.imag();
+        corr.balanceRe = iqBalance.real();
+        corr.balanceIm = iqBalance.imag();
+    }
+
+    if(block->numElems == 0) {
+        return false;
+    }
+
+    // One pass corrects, gathers the estimator statistics and the squelch power
+    SoapyBB60Kernels::IQStats stats;
+    SoapyBB60Kernels::correctIQ(block->data, block->numElems, corr, stats,
+            BB60_POWER_CHUNK, block->hasPower ? block->power.data() : nullptr);
+
+    std::lock_guard<std::mutex> lock(corrMutex);
+    const double n = block->numElems;
+
+    if(dcAuto) {
+        dcOffset += BB60_CORRECTION_ALPHA * (std::complex<double>(stats.sumI / n, stats.sumQ / n) - dcOffset);
+    }
+
+    // Drive the residual image term E[y^2] / (2 E[|y|^2]) to zero
+    const double energy = stats.sumII + stats.sumQQ;
+    if(iqAuto and energy > 0.0) {
+        const std::complex<double> residual(stats.sumII - stats.sumQQ, 2.0 * stats.sumIQ);
+        iqBalance -= BB60_CORRECTION_ALPHA * residual / (2.0 * energy);
     }
 
     return true;
 }
 
+int SoapyBB60::waitForBlock(SoapyBB60Stream *s, SoapyBB60Block *&block, const long timeoutUs)
+{
+    std::unique_lock<std::mutex> lock(ringMutex);
+
+    if(ringHead == s->cursor) {
+        ringCond.wait_for(lock, std::chrono::microseconds(timeoutUs),
+            [this, s]{ return ringHead != s->cursor or not acqRunning; });
+        if(ringHead == s->cursor) {
+            return (acqStatus != bbNoError) ? SOAPY_SDR_STREAM_ERROR : SOAPY_SDR_TIMEOUT;
+        }
+    }
+
+    // Lapped by the producer, skip to the oldest block still published
+    if(s->cursor < ringTail) {
+        BB60_TRACE_INSTANT("overflow");
+        s->cursor = ringTail;
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    block = ring[s->cursor % ring.size()];
+    block->refs++;
+    s->cursor++;
+
+    return 0;
+}
+
+void SoapyBB60::updateNotify(SoapyBB60Stream *s)
+{
+    // Called with ringMutex held, the fd is level triggered like the samples it reports
+    const unsigned long long behind = ringHead - s->cursor;
+    const bool lapped = s->cursor < ringTail;
+    const unsigned long long buffered = (behind == 0 or lapped) ? 0 :
+        ringSamples - ring[s->cursor % ring.size()]->firstSample;
+    const bool ready = lapped or buffered + s->partial >= s->notifyThreshold
+        or not acqRunning;
+    if(ready == s->notifySignaled) {
+        return;
+    }
+
+    uint64_t value = 1;
+    const ssize_t ret = ready ? write(s->notifyFd, &value, sizeof(value)) : read(s->notifyFd, &value, sizeof(value));
+    if(ret == sizeof(value)) {
+        s->notifySignaled = ready;
+    }
+}
+
+bool SoapyBB60::checkEpoch(SoapyBB60Stream *s, const SoapyBB60Block *block, const size_t offset)
+{
+    // The first block read sets the stream's configuration, a later change is reported once
+    const bool changed = s->epochKnown and block->epoch != s->epoch;
+    s->epochKnown = true;
+    s->epoch = block->epoch;
+    if(not changed) {
+        return false;
+    }
+
+    SoapyBB60Event event;
+    event.flags = SOAPY_SDR_USER_FLAG1;
+    if(block->resumed) event.flags |= SOAPY_SDR_END_ABRUPT;
+    if(block->timeNs != 0) {
+        event.timeNs = block->timeNs + (long long)(offset * 1e9 / block->sampleRate);
+        event.flags |= SOAPY_SDR_HAS_TIME;
+    }
+    event.chanMask = block->epoch;
+    postEvent(s, event);
+
+    return true;
+}
+
+void SoapyBB60::postEvent(SoapyBB60Stream *s, const SoapyBB60Event &event)
+{
+    {
+        std::lock_guard<std::mutex> lock(s->eventMutex);
+        // Nobody may be polling, keep only the most recent events
+        if(s->events.size() >= 1024) s->events.pop_front();
+        s->events.push_back(event);
+    }
+    s->eventCond.notify_all();
+}
+
+/*******************************************************************
+ * Stream API
+ ******************************************************************/
+
 int SoapyBB60::activateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs, const size_t numElems)
 {
-    if(flags != 0) {
+    BB60_TRACE_SCOPE("activateStream");
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    // Timed and finite activation apply to plain sample streams
+    if((flags & ~(SOAPY_SDR_HAS_TIME | SOAPY_SDR_END_BURST)) != 0
+            or (flags != 0 and (s->panorama or s->channels or s->stats or s->demod or s->squelch.enabled or s->callback))
+            or ((flags & SOAPY_SDR_END_BURST) != 0 and numElems == 0)) {
         return SOAPY_SDR_NOT_SUPPORTED;
     }
 
-    // Choose the smaller - bandwidth or sample rate
-    double actual_bw = std::min(bb60Decimation.at(decimation), bandwidth);
-    bbStatus status = bbConfigureIQ(deviceId, decimation, actual_bw);
-    if(status != bbNoError) {
-        SoapySDR_logf(SOAPY_SDR_ERROR, "ConfigureIQ: %s", bbGetErrorString(status));
+    std::lock_guard<std::mutex> lock(streamMutex);
+
+    // Re-arming an active stream keeps the acquisition running between bursts
+    if(s->active) {
+        if(flags == 0 and not s->finite) {
+            return 0;
+        }
+        // Wake a read waiting for the next burst
+        const int ret = armStream(s, flags, timeNs, numElems);
+        ringCond.notify_all();
+        return ret;
     }
 
-    streamActive = true;
-    if(!updateStream()) {
-        streamActive = false;
-        return SOAPY_SDR_NOT_SUPPORTED;
+    if(s->panorama) {
+        if(getConfig()->rfMode != BB60_RF_IQ) {
+            SoapySDR_log(SOAPY_SDR_ERROR, "activateStream: the panorama needs rf_mode IQ");
+            return SOAPY_SDR_STREAM_ERROR;
+        }
+        if(activeStreams != 0 or panoramaActive) {
+            SoapySDR_log(SOAPY_SDR_ERROR, "activateStream: the panorama needs the tuner, deactivate other streams first");
+            return SOAPY_SDR_STREAM_ERROR;
+        }
+        startPanorama(s);
+        panoramaActive = true;
+        s->offset = 0;
+        s->active = true;
+        return 0;
+    }
+
+    if(panoramaActive) {
+        SoapySDR_log(SOAPY_SDR_ERROR, "activateStream: a panorama scan owns the tuner");
+        return SOAPY_SDR_STREAM_ERROR;
+    }
+
+    // The first active stream starts the shared acquisition
+    if(activeStreams == 0) {
+        startAcquisition();
+        if(acqStatus != bbNoError) {
+            stopAcquisition();
+            return SOAPY_SDR_NOT_SUPPORTED;
+        }
+        streamActive = true;
+    }
+
+    s->active = true;
+    activeStreams++;
+    if(s->demod) startDemod(s->demod.get());
+
+    const int ret = armStream(s, flags, timeNs, numElems);
+    if(s->callback) {
+        std::lock_guard<std::mutex> asyncLock(asyncMutex);
+        asyncStreams.push_back(s);
+    }
+    if(s->notifyFd >= 0) {
+        std::lock_guard<std::mutex> ringLock(ringMutex);
+        notifyStreams.push_back(s);
+        updateNotify(s);
+    }
+
+    return ret;
+}
+
+int SoapyBB60::armStream(SoapyBB60Stream *s, const int flags, const long long timeNs, const size_t numElems)
+{
+    std::lock_guard<std::mutex> ringLock(ringMutex);
+
+    if(s->block != nullptr) {
+        releaseBlock(s->block);
+        s->block = nullptr;
+    }
+    s->offset = 0;
+    s->partial = 0;
+    s->epochKnown = false;
+    s->squelch.epochKnown = false;
+    s->overflow = false;
+    s->convert.hasLast = false;
+    s->cursor = ringHead;
+    s->finite = (flags & SOAPY_SDR_END_BURST) != 0;
+    s->burstRemaining = numElems;
+    s->timedStart = (flags & SOAPY_SDR_HAS_TIME) != 0;
+    s->startNs = timeNs;
+    s->timedStop = false;
+    if(s->channels) resetChannels(s);
+    if(s->stats) resetStats(s);
+    if(s->demod) resetDemod(s);
+
+    if(not s->timedStart) {
+        return 0;
+    }
+
+    // Start from the ring history when the time has already passed
+    const unsigned long long oldest = ringTail;
+    for(unsigned long long seq = oldest; seq < ringHead; seq++) {
+        const SoapyBB60Block *block = ring[seq % ring.size()];
+        if(block->timeNs + (long long)(block->numElems * 1e9 / block->sampleRate) > timeNs) {
+            if(seq == oldest and block->timeNs > timeNs) {
+                s->timedStart = false;
+                return SOAPY_SDR_TIME_ERROR;
+            }
+            s->cursor = seq;
+            break;
+        }
     }
 
     return 0;
@@ -92,17 +1108,230 @@ int SoapyBB60::activateStream(SoapySDR::Stream *stream, const int flags, const l
 
 int SoapyBB60::deactivateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs)
 {
-    if(flags != 0) {
+    BB60_TRACE_SCOPE("deactivateStream");
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    if((flags & ~SOAPY_SDR_HAS_TIME) != 0 or (flags != 0 and (s->panorama or s->channels or s->stats or s->demod or s->squelch.enabled or s->callback))) {
         return SOAPY_SDR_NOT_SUPPORTED;
     }
 
-    bbAbort(deviceId);
+    std::lock_guard<std::mutex> lock(streamMutex);
 
-    streamActive = false;
+    if(not s->active) {
+        return 0;
+    }
+
+    // Timed stop, reads end with END_BURST at timeNs and the stream stays armed
+    if(flags == SOAPY_SDR_HAS_TIME) {
+        s->timedStop = true;
+        s->stopNs = timeNs;
+        return 0;
+    }
+
+    s->active = false;
+    if(s->panorama) {
+        stopPanorama(s);
+        panoramaActive = false;
+        return 0;
+    }
+
+    if(s->block != nullptr) {
+        releaseBlock(s->block);
+        s->block = nullptr;
+        s->offset = 0;
+    }
+    resetSquelch(s);
+    if(s->demod) stopDemod(s->demod.get());
+    if(s->callback) {
+        // No callback runs for the stream once this returns
+        std::lock_guard<std::mutex> asyncLock(asyncMutex);
+        asyncStreams.erase(std::remove(asyncStreams.begin(), asyncStreams.end(), s), asyncStreams.end());
+    }
+    if(s->notifyFd >= 0) {
+        std::lock_guard<std::mutex> ringLock(ringMutex);
+        notifyStreams.erase(std::remove(notifyStreams.begin(), notifyStreams.end(), s), notifyStreams.end());
+        s->partial = 0;
+        updateNotify(s);
+    }
+
+    // The last active stream stops the shared acquisition
+    if(--activeStreams == 0) {
+        stopAcquisition();
+        streamActive = false;
+    }
 
     return 0;
 }
 
+/*******************************************************************
+ * Read API
+ ******************************************************************/
+
+int SoapyBB60::readSamples(
+        SoapyBB60Stream *s,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs,
+        const std::function<void(const std::complex<float> *, size_t)> &sink)
+{
+    size_t produced = 0;
+    long waitUs = timeoutUs;
+
+    flags = 0;
+
+    // A finished burst delivers nothing until the stream is armed again
+    if(s->finite and s->burstRemaining == 0) {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(ringMutex);
+        ringCond.wait_for(lock, std::chrono::microseconds(timeoutUs),
+            [s]{ return not (s->finite and s->burstRemaining == 0) or not s->active; });
+        if(s->finite and s->burstRemaining == 0) {
+            return SOAPY_SDR_TIMEOUT;
+        }
+        const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        waitUs = std::max<long>(timeoutUs - (long)waited.count(), 0);
+    }
+
+    while(produced < numElems) {
+        if(s->block == nullptr) {
+            // Only wait for the first block, return what we have after that
+            int ret = waitForBlock(s, s->block, (produced == 0) ? waitUs : 0);
+            if(ret == SOAPY_SDR_OVERFLOW and produced != 0) {
+                s->overflow = true;
+                break;
+            }
+            if(ret != 0) {
+                if(produced == 0) return ret;
+                break;
+            }
+            s->offset = 0;
+        }
+
+        SoapyBB60Block *block = s->block;
+        const double nsPerSample = 1e9 / block->sampleRate;
+
+        // Timed start, drop whole blocks and then the head of the block before startNs
+        if(s->timedStart and block->timeNs != 0) {
+            const long long first = (long long)std::ceil((s->startNs - block->timeNs) / nsPerSample);
+            if(first >= (long long)block->numElems) {
+                releaseBlock(block);
+                s->block = nullptr;
+                continue;
+            }
+            s->offset = std::max<long long>(first, 0);
+            s->timedStart = false;
+        }
+
+        // A read never mixes two configurations, the first one of the new configuration is flagged
+        if(s->epochKnown and block->epoch != s->epoch and produced != 0) {
+            break;
+        }
+        if(checkEpoch(s, block, s->offset)) {
+            // Samples were lost while the device was reopened, report the gap like an overflow
+            if(block->resumed) return SOAPY_SDR_OVERFLOW;
+            flags |= SOAPY_SDR_USER_FLAG1;
+        }
+
+        if(produced == 0 and block->timeNs != 0) {
+            timeNs = block->timeNs + (long long)(s->offset * nsPerSample);
+            flags |= SOAPY_SDR_HAS_TIME;
+        }
+
+        size_t n = std::min(numElems - produced, block->numElems - s->offset);
+        bool end = false;
+        if(s->finite and s->burstRemaining <= n) {
+            n = s->burstRemaining;
+            end = true;
+        }
+        if(s->timedStop and block->timeNs != 0) {
+            const long long last = (long long)std::ceil((s->stopNs - block->timeNs) / nsPerSample);
+            if(last <= (long long)(s->offset + n)) {
+                n = std::max<long long>(last - (long long)s->offset, 0);
+                end = true;
+            }
+        }
+
+        // Overloaded samples are flagged on every read that has them, and posted once per block
+        if(block->overload and n != 0) {
+            flags |= SOAPY_SDR_USER_FLAG2;
+            if(s->offset == 0) {
+                SoapyBB60Event event;
+                event.flags = SOAPY_SDR_USER_FLAG2 | ((block->timeNs != 0) ? SOAPY_SDR_HAS_TIME : 0);
+                event.timeNs = block->timeNs;
+                event.chanMask = block->clips;
+                postEvent(s, event);
+            }
+        }
+
+        sink(block->data + s->offset, n);
+        produced += n;
+        s->offset += n;
+        if(s->finite) s->burstRemaining -= n;
+
+        if(s->offset == block->numElems) {
+            releaseBlock(block);
+            s->block = nullptr;
+            s->offset = 0;
+        }
+
+        if(end) {
+            flags |= SOAPY_SDR_END_BURST;
+            s->finite = true;
+            s->burstRemaining = 0;
+            s->timedStop = false;
+            break;
+        }
+    }
+
+    return produced;
+}
+
+int SoapyBB60::readCompressed(
+        SoapyBB60Stream *s,
+        void * const *buffs,
+        const size_t numBytes,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    // Read only as many samples as are guaranteed to fit once compressed
+    const size_t numFrames = numBytes / BB60_COMPRESS_MAX_FRAME;
+    if(numFrames == 0) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "readStream: CS16Z needs at least %d bytes", BB60_COMPRESS_MAX_FRAME);
+        return SOAPY_SDR_STREAM_ERROR;
+    }
+
+    uint8_t *out = (uint8_t *)buffs[0];
+    int16_t frame[2 * BB60_COMPRESS_FRAME];
+    size_t count = 0;
+
+    int ret = readSamples(s, numFrames * BB60_COMPRESS_FRAME, flags, timeNs, timeoutUs,
+        [&](const std::complex<float> *in, size_t n) {
+            while(n != 0) {
+                const size_t len = std::min(n, (size_t)BB60_COMPRESS_FRAME - count);
+                SoapyBB60Kernels::toInt16(in, frame + 2 * count, len, 32767.0f);
+                count += len;
+                in += len;
+                n -= len;
+                if(count == BB60_COMPRESS_FRAME) {
+                    out += SoapyBB60Kernels::compressCS16(frame, count, out);
+                    count = 0;
+                }
+            }
+        });
+    if(ret < 0) {
+        return ret;
+    }
+
+    // Short final frame when fewer samples were available
+    if(count != 0) {
+        out += SoapyBB60Kernels::compressCS16(frame, count, out);
+    }
+
+    return out - (uint8_t *)buffs[0];
+}
+
 int SoapyBB60::readStream(
         SoapySDR::Stream *stream,
         void * const *buffs,
@@ -111,20 +1340,210 @@ int SoapyBB60::readStream(
         long long &timeNs,
         const long timeoutUs)
 {
-    bbIQPacket pkt;
-    memset(&pkt, 0, sizeof(pkt));
-    pkt.iqData = buffs[0];
-    pkt.iqCount = numElems;
+    BB60_TRACE_SCOPE("readStream");
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
 
-    bbStatus status = bbGetIQ(deviceId, &pkt);
-    if(status != bbNoError) {
-        SoapySDR_logf(SOAPY_SDR_ERROR, "GetIQ: %s", bbGetErrorString(status));
-        return 0;
+    const int ret = readStreamData(s, buffs, numElems, flags, timeNs, timeoutUs);
+
+    // Clear the pollable fd once fewer than notify_samples are left
+    if(s->notifyFd >= 0) {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        s->partial = (s->block != nullptr) ? s->block->numElems - s->offset : 0;
+        updateNotify(s);
+    }
+
+    return ret;
+}
+
+int SoapyBB60::readStreamData(
+        SoapyBB60Stream *s,
+        void * const *buffs,
+        const size_t numElems,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    if(not s->active) {
+        return SOAPY_SDR_STREAM_ERROR;
+    }
+
+    // Delivered through the callback instead
+    if(s->callback) {
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    if(s->overflow) {
+        s->overflow = false;
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    if(s->squelch.enabled) {
+        return readSquelch(s, buffs, numElems, flags, timeNs, timeoutUs);
+    }
+
+    if(s->panorama) {
+        return readPanorama(s, buffs, numElems, flags, timeNs, timeoutUs);
+    }
+
+    if(s->channels) {
+        return readChannels(s, buffs, numElems, flags, timeNs, timeoutUs);
+    }
+
+    if(s->stats) {
+        return readStats(s, buffs, numElems, flags, timeNs, timeoutUs);
+    }
+
+    if(s->demod) {
+        return readDemod(s, buffs, numElems, flags, timeNs, timeoutUs);
+    }
+
+    if(s->format == BB60_FORMAT_CS16Z) {
+        return readCompressed(s, buffs, numElems, flags, timeNs, timeoutUs);
+    }
+
+    char *out = (char *)buffs[0];
+    const std::string &format = s->format;
+    const size_t elemSize = SoapyBB60Kernels::formatSize(format);
+
+    const int ret = readSamples(s, numElems, flags, timeNs, timeoutUs,
+        [&](const std::complex<float> *in, size_t n) {
+            BB60_TRACE_SCOPE("convert");
+            s->convert.freqScale = (float)(s->block->sampleRate / (2 * M_PI));
+            SoapyBB60Kernels::convertSamples(format, in, out, n, &s->convert);
+            out += n * elemSize;
+        });
+
+    // Samples were skipped, the next phase step would span the gap
+    if(ret == SOAPY_SDR_OVERFLOW or s->overflow) {
+        s->convert.hasLast = false;
     }
 
-    if(pkt.sampleLoss == BB_TRUE) {
-        SoapySDR_logf(SOAPY_SDR_WARNING, "Sample Overrun");
+    return ret;
+}
+
+int SoapyBB60::readStreamStatus(
+        SoapySDR::Stream *stream,
+        size_t &chanMask,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    std::unique_lock<std::mutex> lock(s->eventMutex);
+
+    if(s->events.empty()) {
+        s->eventCond.wait_for(lock, std::chrono::microseconds(timeoutUs),
+            [s]{ return not s->events.empty(); });
+        if(s->events.empty()) {
+            return SOAPY_SDR_TIMEOUT;
+        }
+    }
+
+    const SoapyBB60Event event = s->events.front();
+    s->events.pop_front();
+
+    chanMask = event.chanMask;
+    flags = event.flags;
+    timeNs = event.timeNs;
+
+    return event.ret;
+}
+
+/*******************************************************************
+ * Direct buffer access API
+ ******************************************************************/
+
+size_t SoapyBB60::getNumDirectAccessBuffers(SoapySDR::Stream *stream)
+{
+    std::lock_guard<std::mutex> lock(ringMutex);
+    return pool.size();
+}
+
+int SoapyBB60::getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs)
+{
+    std::lock_guard<std::mutex> lock(ringMutex);
+    if(handle >= pool.size()) {
+        return SOAPY_SDR_NOT_SUPPORTED;
     }
+    buffs[0] = pool[handle]->data;
+    return 0;
+}
 
-    return numElems;
+int SoapyBB60::acquireReadBuffer(
+        SoapySDR::Stream *stream,
+        size_t &handle,
+        const void **buffs,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs)
+{
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    // Blocks are handed out as-is, so only the native format is zero-copy
+    if(s->format != SOAPY_SDR_CF32 or s->callback) {
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    if(not s->active) {
+        return SOAPY_SDR_STREAM_ERROR;
+    }
+
+    // Whole blocks can not be gated by the squelch or cut to a burst
+    if(s->squelch.enabled or s->finite or s->timedStart or s->timedStop) {
+        SoapySDR_log(SOAPY_SDR_ERROR, "acquireReadBuffer: needs a plain CF32 stream without squelch, burst or timed start");
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    // The pool is fixed, so a stream may hold at most half the ring
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        if(s->held.size() >= numBuffers / 2) {
+            SoapySDR_logf(SOAPY_SDR_ERROR, "acquireReadBuffer: %zu blocks held, release one first", s->held.size());
+            return SOAPY_SDR_STREAM_ERROR;
+        }
+    }
+
+    SoapyBB60Block *block = nullptr;
+    int ret = waitForBlock(s, block, timeoutUs);
+    if(ret != 0) {
+        return ret;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        for(size_t i = 0; i < pool.size(); i++) {
+            if(pool[i].get() == block) handle = i;
+        }
+        s->held.push_back(block);
+    }
+
+    buffs[0] = block->data;
+    flags = checkEpoch(s, block, 0) ? SOAPY_SDR_USER_FLAG1 : 0;
+    if(flags != 0 and block->resumed) flags |= SOAPY_SDR_END_ABRUPT;
+    if(block->overload) flags |= SOAPY_SDR_USER_FLAG2;
+    if(block->timeNs != 0) {
+        timeNs = block->timeNs;
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+
+    return block->numElems;
+}
+
+void SoapyBB60::releaseReadBuffer(SoapySDR::Stream *stream, const size_t handle)
+{
+    SoapyBB60Stream *s = (SoapyBB60Stream *)stream;
+
+    // Async callbacks hand out blocks from the acquisition thread, so held is shared
+    std::lock_guard<std::mutex> lock(ringMutex);
+    if(handle >= pool.size()) {
+        return;
+    }
+
+    SoapyBB60Block *block = pool[handle].get();
+    auto it = std::find(s->held.begin(), s->held.end(), block);
+    if(it != s->held.end()) {
+        s->held.erase(it);
+        releaseBlock(block);
+    }
 }
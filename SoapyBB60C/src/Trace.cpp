@@ -0,0 +1,153 @@
+#include "Trace.hpp"
+
+#ifdef BB60_TRACE
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Rings of exited threads kept for the next dump before being reused
+#define BB60_TRACE_RETIRED 8
+
+namespace SoapyBB60Trace {
+
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<Ring>> registry;
+static uint64_t retireCount = 0;
+
+/*******************************************************************
+ * Ring registry
+ ******************************************************************/
+
+static Ring *registerRing(void)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    // Reuse the oldest retired ring once enough are kept for a dump
+    Ring *oldest = nullptr;
+    size_t retired = 0;
+    for(auto &ring : registry) {
+        if(ring->inUse) continue;
+        retired++;
+        if(oldest == nullptr or ring->retired < oldest->retired) oldest = ring.get();
+    }
+
+    Ring *ring = oldest;
+    if(retired < BB60_TRACE_RETIRED) {
+        registry.emplace_back(new Ring);
+        ring = registry.back().get();
+    }
+
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tid = syscall(SYS_gettid);
+    ring->name.clear();
+    ring->inUse = true;
+
+    return ring;
+}
+
+namespace {
+
+struct ThreadRing {
+    Ring *ring = nullptr;
+
+    ~ThreadRing(void)
+    {
+        if(ring == nullptr) return;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        ring->inUse = false;
+        ring->retired = ++retireCount;
+    }
+};
+
+}
+
+Ring *threadRing(void)
+{
+    static thread_local ThreadRing local;
+
+    if(local.ring == nullptr) local.ring = registerRing();
+    return local.ring;
+}
+
+void setThreadName(const char *name)
+{
+    Ring *ring = threadRing();
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    ring->name = name;
+}
+
+/*******************************************************************
+ * Chrome trace export
+ ******************************************************************/
+
+bool dump(const std::string &path)
+{
+    FILE *file = std::fopen(path.c_str(), "w");
+    if(file == nullptr) {
+        return false;
+    }
+
+    const int pid = getpid();
+    bool first = true;
+
+    std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    for(auto &ring : registry) {
+        if(not ring->name.empty()) {
+            std::fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", pid, ring->tid, ring->name.c_str());
+            first = false;
+        }
+
+        // Copy the live part of the ring, then drop whatever the writer may have overwritten meanwhile
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        const uint64_t begin = (head > BB60_TRACE_RING_SIZE) ? head - BB60_TRACE_RING_SIZE : 0;
+
+        struct Copy {
+            const char *name;
+            uint64_t beginNs;
+            uint64_t durNs;
+        };
+        std::vector<Copy> copies;
+        copies.reserve(head - begin);
+        for(uint64_t i = begin; i < head; i++) {
+            const Event &event = ring->events[i % BB60_TRACE_RING_SIZE];
+            copies.push_back({event.name.load(std::memory_order_relaxed),
+                event.beginNs.load(std::memory_order_relaxed),
+                event.durNs.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t after = ring->head.load(std::memory_order_relaxed);
+        const uint64_t valid = (after >= BB60_TRACE_RING_SIZE) ? after - BB60_TRACE_RING_SIZE + 1 : 0;
+
+        for(uint64_t i = std::max(begin, valid); i < head; i++) {
+            const Copy &event = copies[i - begin];
+            if(event.name == nullptr) continue;
+
+            if(event.durNs == 0) {
+                std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f}",
+                    first ? "" : ",", event.name, pid, ring->tid, event.beginNs / 1e3);
+            } else {
+                std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",", event.name, pid, ring->tid, event.beginNs / 1e3, event.durNs / 1e3);
+            }
+            first = false;
+        }
+    }
+
+    std::fprintf(file, "\n]}\n");
+
+    return std::fclose(file) == 0;
+}
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+
+/*******************************************************************
+ * Trace points, built in with -DENABLE_TRACE=ON
+ ******************************************************************/
+
+#ifdef BB60_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#define BB60_TRACE_RING_SIZE (1 << 14)
+
+namespace SoapyBB60Trace {
+
+/*!
+ * One recorded span, or an instant when durNs is zero.
+ * Fields are relaxed atomics so a dump may read a ring while its thread writes.
+ */
+struct Event {
+    std::atomic<const char *> name{nullptr};
+    std::atomic<uint64_t> beginNs{0};
+    std::atomic<uint64_t> durNs{0};
+};
+
+/*!
+ * Events of one thread, overwritten oldest first.
+ * Only the owning thread writes, head is published after each event.
+ */
+struct Ring {
+    std::atomic<uint64_t> head{0};
+    Event events[BB60_TRACE_RING_SIZE];
+    long tid = 0;
+    std::string name;
+    bool inUse = false;
+    uint64_t retired = 0;
+};
+
+inline uint64_t nowNs(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//! The calling thread's ring, registered on first use
+Ring *threadRing(void);
+
+inline void record(const char *name, const uint64_t beginNs, const uint64_t durNs)
+{
+    Ring *ring = threadRing();
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Event &event = ring->events[head % BB60_TRACE_RING_SIZE];
+    event.name.store(name, std::memory_order_relaxed);
+    event.beginNs.store(beginNs, std::memory_order_relaxed);
+    event.durNs.store(durNs, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+//! Records the lifetime of the enclosing scope
+class Scope {
+public:
+    explicit Scope(const char *name):
+        name(name),
+        beginNs(nowNs())
+    {}
+
+    ~Scope(void)
+    {
+        const uint64_t endNs = nowNs();
+        record(name, beginNs, std::max<uint64_t>(endNs - beginNs, 1));
+    }
+
+private:
+    const char *name;
+    const uint64_t beginNs;
+};
+
+//! Name shown for the calling thread in the trace viewer
+void setThreadName(const char *name);
+
+//! Write every ring as Chrome trace event JSON, false when the file cannot be written
+bool dump(const std::string &path);
+
+}
+
+#define BB60_TRACE_SCOPE(name) SoapyBB60Trace::Scope bb60TraceScope(name)
+#define BB60_TRACE_INSTANT(name) SoapyBB60Trace::record(name, SoapyBB60Trace::nowNs(), 0)
+#define BB60_TRACE_THREAD(name) SoapyBB60Trace::setThreadName(name)
+
+#else
+
+#define BB60_TRACE_SCOPE(name) do {} while(0)
+#define BB60_TRACE_INSTANT(name) do {} while(0)
+#define BB60_TRACE_THREAD(name) do {} while(0)
+
+#endif
@@ -0,0 +1,164 @@
+#include "SoapyBB60.hpp"
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+#define BB60_HUGEPAGE_SIZE (2 << 20)
+
+static size_t alignUp(const size_t n, const size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+// "2", "2,3" or "2-5,8"
+static std::vector<int> parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string part;
+
+    while(std::getline(stream, part, ',')) {
+        if(part.empty()) continue;
+        const size_t dash = part.find('-');
+        const int first = std::stoi(part.substr(0, dash));
+        const int last = (dash == std::string::npos) ? first : std::stoi(part.substr(dash + 1));
+        for(int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+void SoapyBB60::setupTuning(const SoapySDR::Kwargs &args)
+{
+    try {
+        if(args.count("hugepages") != 0) useHugepages = (args.at("hugepages") == "true");
+        if(args.count("mlock") != 0) lockMemory = (args.at("mlock") == "true");
+        if(args.count("numa_node") != 0) numaNode = std::stoi(args.at("numa_node"));
+        if(args.count("acq_cpus") != 0) acqCpus = parseCpuList(args.at("acq_cpus"));
+        if(args.count("acq_priority") != 0) acqPriority = std::stoi(args.at("acq_priority"));
+        if(args.count("worker_cpus") != 0) workerCpus = parseCpuList(args.at("worker_cpus"));
+        if(args.count("worker_priority") != 0) workerPriority = std::stoi(args.at("worker_priority"));
+    } catch (const std::exception &) {
+        throw std::runtime_error("numa_node, acq_priority, worker_priority and the cpu lists must be numbers");
+    }
+}
+
+void *SoapyBB60::mapMemory(size_t &size)
+{
+    // Rounded up to whole pages, huge ones if asked for
+    void *base = MAP_FAILED;
+    size = alignUp(size, 4096);
+    if(useHugepages) {
+        size = alignUp(size, BB60_HUGEPAGE_SIZE);
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(base == MAP_FAILED) {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "hugepages: no reserved huge pages (%s), using transparent huge pages",
+                    std::strerror(errno));
+        }
+    }
+    if(base == MAP_FAILED) {
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED) {
+            return nullptr;
+        }
+        if(useHugepages) madvise(base, size, MADV_HUGEPAGE);
+    }
+
+    // Placement must be set before the pages are first touched
+    if(numaNode >= 0) {
+        unsigned long mask[16] = {0};
+        if(numaNode >= (int)(8 * sizeof(mask))) {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "numa_node %d out of range, ignored", numaNode);
+        } else {
+            mask[numaNode / (8 * sizeof(unsigned long))] |= 1UL << (numaNode % (8 * sizeof(unsigned long)));
+            if(syscall(SYS_mbind, base, size, MPOL_BIND, mask, 8 * sizeof(mask), MPOL_MF_MOVE) != 0) {
+                SoapySDR_logf(SOAPY_SDR_WARNING, "numa_node %d: %s", numaNode, std::strerror(errno));
+            }
+        }
+    }
+
+    if(lockMemory and mlock(base, size) != 0) {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "mlock: %s, check RLIMIT_MEMLOCK", std::strerror(errno));
+    }
+
+    // Fault every page in now rather than in the acquisition loop
+    std::memset(base, 0, size);
+
+    return base;
+}
+
+void SoapyBB60::allocatePool(void)
+{
+    // One mapping for every block, so the pool is a single contiguous, prefaulted range
+    const size_t count = numBuffers + 2;
+    const size_t stride = alignUp(bufferLength * sizeof(std::complex<float>), 4096);
+    arenaSize = count * stride;
+
+    arenaBase = mapMemory(arenaSize);
+    if(arenaBase == nullptr) {
+        arenaSize = 0;
+        throw std::runtime_error("setupStream: unable to allocate sample buffers");
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        pool.emplace_back(new SoapyBB60Block);
+        pool.back()->data = (std::complex<float> *)((char *)arenaBase + i * stride);
+        pool.back()->capacity = bufferLength;
+    }
+    discardBlock.heap.resize(bufferLength);
+    discardBlock.data = discardBlock.heap.data();
+    discardBlock.capacity = bufferLength;
+}
+
+void SoapyBB60::freePool(void)
+{
+    pool.clear();
+    discardBlock.heap = std::vector<std::complex<float>>();
+    discardBlock.data = nullptr;
+
+    if(arenaBase != nullptr) {
+        munmap(arenaBase, arenaSize);
+        arenaBase = nullptr;
+        arenaSize = 0;
+    }
+}
+
+void SoapyBB60::tuneThread(const std::vector<int> &cpus, const int priority, const char *name)
+{
+    BB60_TRACE_THREAD(name);
+
+    if(not cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : cpus) CPU_SET(cpu, &set);
+        const int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(ret != 0) {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "%s thread affinity: %s", name, std::strerror(ret));
+        }
+    }
+
+    if(priority > 0) {
+        sched_param param;
+        std::memset(&param, 0, sizeof(param));
+        param.sched_priority = std::min(priority, sched_get_priority_max(SCHED_FIFO));
+        const int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(ret != 0) {
+            SoapySDR_logf(SOAPY_SDR_WARNING, "%s thread SCHED_FIFO priority %d: %s, running unprivileged",
+                    name, priority, std::strerror(ret));
+        }
+    }
+}
@@ -0,0 +1,96 @@
+///////////////////////////////////////////////////////////////////////
+// Serve the BB60C over TCP on loopback and read it back in one process
+//
+// Usage: bb60_net_loopback [seconds] [sample rate]
+//
+// Streams CF32 through serve and connect, checks that packets arrive
+// in sequence with contiguous timestamps and that the client keeps up
+// with the sample rate. Needs a BB60C attached.
+///////////////////////////////////////////////////////////////////////
+
+#include <SoapySDR/Device.hpp>
+#include <SoapySDR/Errors.hpp>
+#include <SoapySDR/Formats.hpp>
+
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+int main(int argc, char *argv[])
+{
+    const double seconds = (argc > 1) ? std::atof(argv[1]) : 5.0;
+    const double rate = (argc > 2) ? std::atof(argv[2]) : 40e6;
+    const char *address = "tcp://127.0.0.1:5599";
+
+    SoapySDR::Device *server = nullptr;
+    SoapySDR::Device *client = nullptr;
+    int status = EXIT_FAILURE;
+
+    try {
+        server = SoapySDR::Device::make(std::string("driver=bb60c,serve=") + address);
+        client = SoapySDR::Device::make(std::string("driver=bb60c,connect=") + address);
+        client->setSampleRate(SOAPY_SDR_RX, 0, rate);
+        const double actual = client->getSampleRate(SOAPY_SDR_RX, 0);
+
+        SoapySDR::Stream *stream = client->setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32);
+        std::vector<std::complex<float>> buff(client->getStreamMTU(stream));
+        void *buffs[] = {buff.data()};
+        client->activateStream(stream);
+
+        // Discard half a second while the acquisition starts up and the backlog drains
+        int flags;
+        long long timeNs;
+        const Clock::time_point warmup = Clock::now();
+        while(Clock::now() - warmup < std::chrono::milliseconds(500)) {
+            client->readStream(stream, buffs, buff.size(), flags, timeNs, 1000000);
+        }
+
+        const long long toleranceNs = 1000;
+        long long expectNs = -1;
+        size_t total = 0, overflows = 0, errors = 0, discontinuities = 0;
+        const Clock::time_point t0 = Clock::now();
+        while(Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+            const int ret = client->readStream(stream, buffs, buff.size(), flags, timeNs, 1000000);
+            if(ret == SOAPY_SDR_OVERFLOW) {
+                overflows++;
+                expectNs = -1;
+                continue;
+            }
+            if(ret < 0) {
+                std::fprintf(stderr, "readStream: %s\n", SoapySDR::errToStr(ret));
+                errors++;
+                expectNs = -1;
+                continue;
+            }
+            if((flags & SOAPY_SDR_HAS_TIME) != 0) {
+                if(expectNs >= 0 and std::llabs(timeNs - expectNs) > toleranceNs) discontinuities++;
+                expectNs = timeNs + (long long)(ret * 1e9 / actual);
+            }
+            total += ret;
+        }
+        const double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+
+        client->deactivateStream(stream);
+        client->closeStream(stream);
+
+        const double msps = total / elapsed / 1e6;
+        std::printf("%.1f MS/s of %.1f MS/s, %zu samples, %zu overflows, %zu errors, %zu discontinuities\n",
+            msps, actual / 1e6, total, overflows, errors, discontinuities);
+
+        if(overflows == 0 and errors == 0 and discontinuities == 0 and msps >= 0.98 * actual / 1e6) {
+            status = EXIT_SUCCESS;
+        }
+    } catch (const std::exception &ex) {
+        std::fprintf(stderr, "bb60_net_loopback: %s\n", ex.what());
+    }
+
+    if(client != nullptr) SoapySDR::Device::unmake(client);
+    if(server != nullptr) SoapySDR::Device::unmake(server);
+
+    return status;
+}
@@ -0,0 +1,143 @@
+///////////////////////////////////////////////////////////////////////
+// Query a BB60 occupancy log
+//
+// Usage: bb60_occupancy [options] file
+//
+// Prints CSV to stdout: one row per bin over the time range, or with -t
+// one row per bucket over the frequency range.
+///////////////////////////////////////////////////////////////////////
+
+#include "SoapyBB60Occupancy.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <string>
+
+#include <getopt.h>
+
+static void usage(void)
+{
+    std::fprintf(stderr,
+        "Usage: bb60_occupancy [options] file\n"
+        "Summarize an occupancy log written by a panorama stream with occ_file.\n\n"
+        "  -s time     start, seconds since the epoch, or negative for before the end of the log\n"
+        "  -e time     end, in the same form (default: the end of the log)\n"
+        "  -f freq     lowest frequency in Hz (default: the start of the span)\n"
+        "  -F freq     highest frequency in Hz (default: the end of the span)\n"
+        "  -t          one row per bucket instead of one row per bin\n"
+        "  -i          describe the log and exit\n");
+}
+
+static std::string formatTime(const long long timeNs)
+{
+    const time_t sec = timeNs / 1000000000LL;
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    char buf[32];
+    const size_t len = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    std::snprintf(buf + len, sizeof(buf) - len, ".%03dZ", (int)(timeNs / 1000000 % 1000));
+    return buf;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string start, end;
+    double fmin = -1.0, fmax = -1.0;
+    bool timeline = false;
+    bool info = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:e:f:F:tih")) != -1) {
+        switch(opt) {
+        case 's': start = optarg; break;
+        case 'e': end = optarg; break;
+        case 'f': fmin = std::atof(optarg); break;
+        case 'F': fmax = std::atof(optarg); break;
+        case 't': timeline = true; break;
+        case 'i': info = true; break;
+        default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if(optind + 1 != argc) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        SoapyBB60OccupancyReader log(argv[optind]);
+        const size_t numRecords = log.getNumRecords();
+        const double binHz = log.getBinWidth();
+        const double startHz = log.getStartFrequency();
+        const long long firstNs = numRecords ? log.getRecord(0).startNs : 0;
+        const long long lastNs = numRecords ? log.getRecord(numRecords - 1).startNs + log.getBucketNs() : 0;
+
+        if(info) {
+            std::printf("bins        %zu, %.6f - %.6f MHz, %.1f Hz wide\n", log.getNumBins(),
+                startHz / 1e6, (startHz + log.getNumBins() * binHz) / 1e6, binHz);
+            std::printf("buckets     %.3f s, threshold %.1f dBm\n", log.getBucketNs() / 1e9, log.getThreshold());
+            std::printf("records     %zu", numRecords);
+            if(numRecords) std::printf(", %s to %s", formatTime(firstNs).c_str(), formatTime(lastNs).c_str());
+            std::printf("\n");
+            return EXIT_SUCCESS;
+        }
+
+        // Negative times count back from the end of the log
+        auto parseTime = [lastNs](const std::string &s, const long long fallback) {
+            if(s.empty()) return fallback;
+            const double sec = std::atof(s.c_str());
+            return (sec < 0.0) ? lastNs + std::llround(sec * 1e9) : std::llround(sec * 1e9);
+        };
+        const long long startNs = parseTime(start, firstNs);
+        const long long stopNs = parseTime(end, lastNs);
+
+        const size_t firstBin = (fmin > startHz) ? (size_t)((fmin - startHz) / binHz) : 0;
+        const size_t lastBin = (fmax >= 0.0) ? std::min<size_t>((size_t)std::ceil((fmax - startHz) / binHz), log.getNumBins()) : log.getNumBins();
+        if(lastBin <= firstBin) {
+            std::fprintf(stderr, "bb60_occupancy: no bins in the frequency range\n");
+            return EXIT_FAILURE;
+        }
+        const size_t numBins = lastBin - firstBin;
+
+        SoapyBB60OccupancySpan span;
+        if(not timeline) {
+            if(not log.query(startNs, stopNs, firstBin, numBins, span)) {
+                std::fprintf(stderr, "bb60_occupancy: no records in the time range\n");
+                return EXIT_FAILURE;
+            }
+            std::printf("# %zu records, %llu scans, %s to %s\n", span.numRecords, span.scans,
+                formatTime(span.startNs).c_str(), formatTime(span.stopNs).c_str());
+            std::printf("frequency_hz,min_dbm,max_dbm,mean_dbm,duty\n");
+            for(size_t i = 0; i < numBins; i++) {
+                std::printf("%.0f,%.2f,%.2f,%.2f,%.4f\n", startHz + (firstBin + i) * binHz,
+                    span.min[i], span.max[i], span.mean[i], span.duty[i]);
+            }
+            return EXIT_SUCCESS;
+        }
+
+        // Per bucket, the bins of the range in one row: the duty is the mean over bins
+        std::printf("time,scans,min_dbm,max_dbm,mean_dbm,duty,partial\n");
+        for(size_t r = log.find(startNs), last = log.find(stopNs); r < last; r++) {
+            if(not log.queryRecords(r, r + 1, firstBin, numBins, span)) continue;
+            float min = span.min[0], max = span.max[0];
+            double power = 0.0, duty = 0.0;
+            for(size_t i = 0; i < numBins; i++) {
+                min = std::min(min, span.min[i]);
+                max = std::max(max, span.max[i]);
+                power += std::pow(10.0, span.mean[i] / 10.0);
+                duty += span.duty[i];
+            }
+            std::printf("%s,%llu,%.2f,%.2f,%.2f,%.4f,%d\n", formatTime(span.startNs).c_str(), span.scans,
+                min, max, 10.0 * std::log10(power / numBins), duty / numBins,
+                (log.getRecord(r).flags & BB60_OCC_PARTIAL) ? 1 : 0);
+        }
+    } catch (const std::exception &ex) {
+        std::fprintf(stderr, "bb60_occupancy: %s\n", ex.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
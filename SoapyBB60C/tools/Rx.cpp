@@ -0,0 +1,371 @@
+///////////////////////////////////////////////////////////////////////
+// Stream IQ from a BB60 to stdout, a FIFO or a file
+//
+// Usage: bb60_rx [options] [output]
+//
+// Pipes are fed with vmsplice straight from the stream's buffers, other
+// outputs through an internal pipe and splice. Statistics go to stderr.
+///////////////////////////////////////////////////////////////////////
+
+#include <SoapySDR/Device.hpp>
+#include <SoapySDR/Errors.hpp>
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Types.hpp>
+
+#include "Kernels.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> running(true);
+
+static void stop(int)
+{
+    running = false;
+}
+
+static void usage(void)
+{
+    std::fprintf(stderr,
+        "Usage: bb60_rx [options] [output]\n"
+        "Stream IQ to output, a file or FIFO path or - for stdout (default).\n\n"
+        "  -d args     device args (default driver=bb60c)\n"
+        "  -f freq     center frequency in Hz (default 100e6)\n"
+        "  -s rate     sample rate in Hz (default 40e6)\n"
+        "  -b bw       IF bandwidth in Hz (default: the widest for the rate)\n"
+        "  -r dBm      reference level, or 'auto' for the AGC (default -20)\n"
+        "  -F format   stream format: CF32 (default), CS16, CS12, CS16Z or F32_POWER, F32_DB, F32_MAG,\n"
+        "              F32_PHASE, F32_FREQ\n"
+        "  -a args     stream args, e.g. bufflen=65536\n"
+        "  -n count    stop after this many samples, bytes for CS16Z (default: until interrupted)\n"
+        "  -q          no statistics\n");
+}
+
+/*!
+ * Output that takes buffers by reference. Pages handed to vmsplice stay
+ * in the pipe until read, so a buffer may only be reused once it is
+ * consumed(). Outputs that are not pipes go through an internal pipe
+ * that is drained with splice before send returns.
+ */
+class Output {
+public:
+    bool open(const std::string &path)
+    {
+        fd = (path == "-") ? STDOUT_FILENO : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            std::fprintf(stderr, "bb60_rx: %s: %s\n", path.c_str(), std::strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        isPipe = fstat(fd, &st) == 0 and S_ISFIFO(st.st_mode);
+        if(isPipe) {
+            target = fd;
+        } else if(pipe(relay) == 0) {
+            target = relay[1];
+        } else {
+            spliced = false;
+        }
+
+        // A larger pipe means fewer wakeups, as far as /proc/sys/fs/pipe-max-size allows
+        if(spliced) fcntl(target, F_SETPIPE_SZ, 1 << 20);
+
+        return true;
+    }
+
+    ~Output(void)
+    {
+        if(relay[0] >= 0) close(relay[0]);
+        if(relay[1] >= 0) close(relay[1]);
+        if(fd > STDOUT_FILENO) close(fd);
+    }
+
+    //! Queue bytes, false once the reader has gone
+    bool send(const void *data, size_t len)
+    {
+        const char *p = (const char *)data;
+        while(len > 0) {
+            const Clock::time_point t0 = Clock::now();
+            ssize_t n = -1;
+            if(spliced) {
+                struct iovec iov = {(void *)p, len};
+                n = vmsplice(target, &iov, 1, 0);
+                if(n < 0 and (errno == EINVAL or errno == ENOSYS)) {
+                    // Not something vmsplice can feed, copy from here on
+                    spliced = false;
+                    target = fd;
+                    continue;
+                }
+            } else {
+                n = write(fd, p, len);
+            }
+            blockedUs += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+
+            if(n < 0 and errno == EINTR) continue;
+            if(n <= 0) {
+                if(errno != EPIPE) std::fprintf(stderr, "bb60_rx: output: %s\n", std::strerror(errno));
+                return false;
+            }
+            if(spliced and not isPipe and not drain(n)) {
+                return false;
+            }
+            p += n;
+            len -= n;
+            sent += n;
+        }
+        return true;
+    }
+
+    //! Bytes sent so far that the reader has taken
+    unsigned long long consumed(void) const
+    {
+        int queued = 0;
+        if(spliced and isPipe and ioctl(fd, FIONREAD, &queued) != 0) queued = 0;
+        return sent - queued;
+    }
+
+    unsigned long long sentBytes(void) const
+    {
+        return sent;
+    }
+
+    bool zeroCopy(void) const
+    {
+        return spliced;
+    }
+
+    unsigned long long blockedUs = 0;
+
+private:
+    //! Move what the internal pipe holds to the output, the file copies it
+    bool drain(size_t len)
+    {
+        while(len > 0) {
+            const ssize_t n = splice(relay[0], nullptr, fd, nullptr, len, SPLICE_F_MOVE);
+            if(n < 0 and errno == EINTR) continue;
+            if(n <= 0) {
+                if(errno != EPIPE) std::fprintf(stderr, "bb60_rx: output: %s\n", std::strerror(errno));
+                return false;
+            }
+            len -= n;
+        }
+        return true;
+    }
+
+    int fd = -1;
+    int target = -1;
+    int relay[2] = {-1, -1};
+    bool isPipe = false;
+    bool spliced = true;
+    unsigned long long sent = 0;
+};
+
+// A buffer in flight, released once the output has consumed up to end
+struct Pending {
+    size_t index;
+    unsigned long long end;
+};
+
+int main(int argc, char *argv[])
+{
+    std::string deviceArgs = "driver=bb60c";
+    std::string streamArgs;
+    std::string format = SOAPY_SDR_CF32;
+    std::string ref = "-20";
+    double frequency = 100e6;
+    double rate = 40e6;
+    double bandwidth = 0.0;
+    unsigned long long count = 0;
+    bool quiet = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "d:f:s:b:r:F:a:n:qh")) != -1) {
+        switch(opt) {
+        case 'd': deviceArgs = optarg; break;
+        case 'f': frequency = std::atof(optarg); break;
+        case 's': rate = std::atof(optarg); break;
+        case 'b': bandwidth = std::atof(optarg); break;
+        case 'r': ref = optarg; break;
+        case 'F': format = optarg; break;
+        case 'a': streamArgs = optarg; break;
+        case 'n': count = std::strtoull(optarg, nullptr, 10); break;
+        case 'q': quiet = true; break;
+        default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if(optind + 1 < argc) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    const std::string path = (optind < argc) ? argv[optind] : "-";
+
+    std::signal(SIGINT, stop);
+    std::signal(SIGTERM, stop);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Open the output first, a FIFO waits here for its reader
+    Output out;
+    if(not out.open(path)) {
+        return EXIT_FAILURE;
+    }
+
+    SoapySDR::Device *sdr = nullptr;
+    SoapySDR::Stream *stream = nullptr;
+    try {
+        sdr = SoapySDR::Device::make(deviceArgs);
+        sdr->setSampleRate(SOAPY_SDR_RX, 0, rate);
+        if(bandwidth > 0.0) sdr->setBandwidth(SOAPY_SDR_RX, 0, bandwidth);
+        sdr->setFrequency(SOAPY_SDR_RX, 0, frequency);
+        if(ref == "auto") {
+            sdr->setGainMode(SOAPY_SDR_RX, 0, true);
+        } else {
+            sdr->setGain(SOAPY_SDR_RX, 0, "REF", std::atof(ref.c_str()));
+        }
+        stream = sdr->setupStream(SOAPY_SDR_RX, format, std::vector<size_t>(), SoapySDR::KwargsFromString(streamArgs));
+    } catch (const std::exception &ex) {
+        std::fprintf(stderr, "bb60_rx: %s\n", ex.what());
+        if(sdr != nullptr) SoapySDR::Device::unmake(sdr);
+        return EXIT_FAILURE;
+    }
+
+    // CS16Z streams count bytes and only whole frames can be written
+    const size_t elemSize = SoapyBB60Kernels::formatSize(format);
+    const bool compressed = (format == BB60_FORMAT_CS16Z);
+    const char *unit = compressed ? "bytes" : "samples";
+    const size_t mtu = sdr->getStreamMTU(stream);
+    const bool direct = (format == SOAPY_SDR_CF32);
+
+    // The driver lets a stream hold half of the ring, which is two blocks short of the pool
+    const size_t maxHeld = direct ? (sdr->getNumDirectAccessBuffers(stream) - 2) / 2 : 0;
+
+    // Other formats are converted into page aligned buffers of our own, reused once consumed
+    std::vector<void *> buffers;
+    std::deque<size_t> freeBuffers;
+    if(not direct) {
+        for(size_t i = 0; i < 64; i++) {
+            void *buf = nullptr;
+            if(posix_memalign(&buf, 4096, mtu * elemSize) != 0) break;
+            buffers.push_back(buf);
+            freeBuffers.push_back(i);
+        }
+    }
+    std::deque<Pending> pending;
+
+    if(not quiet) {
+        std::fprintf(stderr, "bb60_rx: %s at %.6f MHz, %.3f MS/s, %s output%s\n", format.c_str(), frequency / 1e6,
+            sdr->getSampleRate(SOAPY_SDR_RX, 0) / 1e6, out.zeroCopy() ? "zero-copy" : "copied", count ? "" : ", ^C to stop");
+    }
+
+    sdr->activateStream(stream);
+
+    unsigned long long total = 0, overflows = 0, timeouts = 0;
+    unsigned long long lastTotal = 0, lastBlockedUs = 0;
+    const Clock::time_point start = Clock::now();
+    Clock::time_point lastReport = start;
+    int status = EXIT_SUCCESS;
+
+    while(running and (count == 0 or total < count)) {
+        // Hand back whatever the reader has taken
+        const unsigned long long consumed = out.consumed();
+        while(not pending.empty() and pending.front().end <= consumed) {
+            if(direct) {
+                sdr->releaseReadBuffer(stream, pending.front().index);
+            } else {
+                freeBuffers.push_back(pending.front().index);
+            }
+            pending.pop_front();
+        }
+
+        int ret = 0;
+        int flags = 0;
+        long long timeNs = 0;
+        size_t index = 0;
+        const void *data = nullptr;
+
+        if(direct and pending.size() >= maxHeld) {
+            // The reader is behind by every block we may hold, give it a moment
+            usleep(100);
+            continue;
+        } else if(direct) {
+            ret = sdr->acquireReadBuffer(stream, index, &data, flags, timeNs, 1000000);
+        } else if(freeBuffers.empty()) {
+            // The reader is behind by every buffer we own, give it a moment
+            usleep(100);
+            continue;
+        } else {
+            index = freeBuffers.front();
+            void *buffs[] = {buffers[index]};
+            ret = sdr->readStream(stream, buffs, mtu, flags, timeNs, 1000000);
+            data = buffers[index];
+            if(ret > 0) {
+                freeBuffers.pop_front();
+            }
+        }
+
+        if(ret == SOAPY_SDR_OVERFLOW) {
+            overflows++;
+            continue;
+        }
+        if(ret == SOAPY_SDR_TIMEOUT) {
+            timeouts++;
+            continue;
+        }
+        if(ret < 0) {
+            std::fprintf(stderr, "bb60_rx: read: %s\n", SoapySDR::errToStr(ret));
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        size_t n = ret;
+        if(count != 0 and total + n > count and not compressed) n = count - total;
+        const bool ok = out.send(data, n * elemSize);
+        total += n;
+        pending.push_back({index, out.sentBytes()});
+        if(not ok) {
+            break;
+        }
+
+        const Clock::time_point now = Clock::now();
+        const double interval = std::chrono::duration<double>(now - lastReport).count();
+        if(not quiet and interval >= 1.0) {
+            std::fprintf(stderr, "\r%8.3f M%s/s  %12llu %s  %6llu overflows  output busy %3.0f%%   ",
+                (total - lastTotal) / interval / 1e6, compressed ? "B" : "S", total, unit, overflows, (out.blockedUs - lastBlockedUs) / interval / 1e4);
+            lastTotal = total;
+            lastBlockedUs = out.blockedUs;
+            lastReport = now;
+        }
+    }
+
+    sdr->deactivateStream(stream);
+    if(direct) {
+        for(const auto &p : pending) sdr->releaseReadBuffer(stream, p.index);
+    }
+    sdr->closeStream(stream);
+    SoapySDR::Device::unmake(sdr);
+    for(void *buf : buffers) free(buf);
+
+    if(not quiet) {
+        const double sec = std::chrono::duration<double>(Clock::now() - start).count();
+        std::fprintf(stderr, "\nbb60_rx: %llu %s in %.1f s (%.3f M%s/s), %llu overflows, %llu timeouts\n",
+            total, unit, sec, total / sec / 1e6, compressed ? "B" : "S", overflows, timeouts);
+    }
+
+    return status;
+}